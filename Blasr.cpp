@@ -3,22 +3,25 @@
 #include "iblasr/BlasrAlign.hpp"
 #include "iblasr/BlasrMiscs.hpp"
 #include "iblasr/BlasrUtils.hpp"
+#include "iblasr/CompressedOutput.h"
+#include "iblasr/IndexingBamWriter.h"
+#include "iblasr/ReferenceShards.h"
 #include "iblasr/RegisterBlasrOptions.h"
+#include "iblasr/SortingBamWriter.h"
+#include "iblasr/SplitByRefOutput.h"
+#include "iblasr/StartupReport.h"
 
 #if CMAKE_BUILD
 #include "BlasrVersion.h"
 #endif
 
-//#define USE_GOOGLE_PROFILER
-#ifdef USE_GOOGLE_PROFILER
-#include "gperftools/profiler.h"
-#endif
-
 // Declare global structures that are shared between threads.
 MappingSemaphores semaphores;
 std::ostream *outFilePtr = NULL;
 #ifdef USE_PBBAM
-PacBio::BAM::IRecordWriter *bamWriterPtr = NULL;  // use IRecordWriter for both SAM ands BAM
+PacBio::BAM::IRecordWriter *bamWriterPtr = NULL;       // use IRecordWriter for both SAM ands BAM
+SortingBamWriter *sortingWriterPtr = NULL;             // bamWriterPtr when --sorted
+PacBio::BAM::BamWriter *unalignedBamWriterPtr = NULL;  // for BAM --unaligned
 #endif
 
 HDFRegionTableReader *regionTableReader = NULL;
@@ -180,22 +183,27 @@ void MakePrimaryIntervals(std::vector<SMRTSequence> &subreads,
 ///              required to for generating deterministic random
 ///              alignments regardless of nproc.
 /// \params[out] stop: whether or not stop mapping remaining reads.
+/// \params[out] nRecords: number of input records consumed, for progress reporting.
+/// \params[out] readIndex: index of this zmw in the input, counted over all threads.
 /// \returns whether or not to skip mapping reads of this zmw.
 bool FetchReads(ReaderAgglomerate *reader, RegionTable *regionTablePtr, SMRTSequence &smrtRead,
                 CCSSequence &ccsRead, std::vector<SMRTSequence> &subreads,
                 MappingParameters &params, bool &readIsCCS, std::string &readGroupId,
-                int &associatedRandInt, bool &stop)
+                int &associatedRandInt, bool &stop, std::uint64_t &nRecords,
+                std::uint64_t &readIndex)
 {
+    nRecords = 0;
     if ((reader->GetFileType() != FileType::PBBAM and
          reader->GetFileType() != FileType::PBDATASET) or
         not params.concordant) {
         if (reader->GetFileType() == FileType::HDFCCS ||
             reader->GetFileType() == FileType::HDFCCSONLY) {
             if (GetNextReadThroughSemaphore(*reader, params, ccsRead, readGroupId,
-                                            associatedRandInt, semaphores) == false) {
+                                            associatedRandInt, readIndex, semaphores) == false) {
                 stop = true;
                 return false;
             } else {
+                nRecords = 1;
                 readIsCCS = true;
                 smrtRead.Copy(ccsRead);
                 ccsRead.SetQVScale(params.qvScaleType);
@@ -205,10 +213,11 @@ bool FetchReads(ReaderAgglomerate *reader, RegionTable *regionTablePtr, SMRTSequ
                    ccsRead.zmwData.holeNumber == ccsRead.unrolledRead.zmwData.holeNumber);
         } else {
             if (GetNextReadThroughSemaphore(*reader, params, smrtRead, readGroupId,
-                                            associatedRandInt, semaphores) == false) {
+                                            associatedRandInt, readIndex, semaphores) == false) {
                 stop = true;
                 return false;
             } else {
+                nRecords = 1;
                 smrtRead.SetQVScale(params.qvScaleType);
             }
         }
@@ -245,10 +254,11 @@ bool FetchReads(ReaderAgglomerate *reader, RegionTable *regionTablePtr, SMRTSequ
         subreads.clear();
         std::vector<SMRTSequence> reads;
         if (GetNextReadThroughSemaphore(*reader, params, reads, readGroupId, associatedRandInt,
-                                        semaphores) == false) {
+                                        readIndex, semaphores) == false) {
             stop = true;
             return false;
         }
+        nRecords = reads.size();
 
         for (const SMRTSequence &smrtRead : reads) {
             if (IsGoodRead(smrtRead, params, stop)) {
@@ -264,30 +274,40 @@ bool FetchReads(ReaderAgglomerate *reader, RegionTable *regionTablePtr, SMRTSequ
     }
 }
 
-void MapReadsNonCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData,
-                    MappingBuffers &mappingBuffers, SMRTSequence &smrtRead,
-                    SMRTSequence &smrtReadRC, std::vector<SMRTSequence> &subreads,
-                    MappingParameters &params, const int &associatedRandInt,
-                    ReadAlignments &allReadAlignments, std::ofstream &threadOut)
+/// Write the trace of mapping one subread to --traceFile.
+/// \params[in] mapData: thread data holding the trace.
+/// \params[in] read: subread that was mapped.
+/// \params[in] alignmentPtrs: alignments found for the subread.
+void WriteReadTrace(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData,
+                    SMRTSequence &read, std::vector<T_AlignmentCandidate *> &alignmentPtrs)
 {
-    DNASuffixArray sarray;
-    TupleCountTable<T_GenomeSequence, DNATuple> ct;
-    SequenceIndexDatabase<FASTQSequence> seqdb;
-    T_GenomeSequence genome;
-    BWT *bwtPtr;
-
-    mapData->ShallowCopySuffixArray(sarray);
-    mapData->ShallowCopyReferenceSequence(genome);
-    mapData->ShallowCopySequenceIndexDatabase(seqdb);
-    mapData->ShallowCopyTupleCountTable(ct);
-
-    bwtPtr = mapData->bwtPtr;
-    SeqBoundaryFtr<FASTQSequence> seqBoundary(&seqdb);
-
-    std::vector<ReadInterval> subreadIntervals;
-    std::vector<int> subreadDirections;
-    int bestSubreadIndex;
+    if (not mapData->trace.active) return;
+    std::string record =
+        mapData->trace.ToJSON(read.title, read.HoleNumber(), read.SubreadStart(), read.SubreadEnd(),
+                              alignmentPtrs.size(), mapData->histograms);
+    if (mapData->params.nProc > 1) {
+        semaphores.Wait(MappingSemaphore::Trace);
+    }
+    *mapData->traceFilePtr << record << '\n';
+    if (mapData->params.nProc > 1) {
+        semaphores.Post(MappingSemaphore::Trace);
+    }
+}
 
+/// Find the subread intervals of a ZMW, and those that MapReadsNonCCS maps.
+/// \params[in] mapData: thread data holding the reader and region table.
+/// \params[in] smrtRead: the ZMW as a polymerase read.
+/// \params[in] subreads: subreads of the ZMW, for -concordant with BAM input.
+/// \params[out] subreadIntervals, subreadDirections: the subreads.
+/// \params[out] bestSubreadIndex: the longest subread, or -1.
+/// \params[out] startIndex, endIndex: the subreads to map, which with
+///               -concordant is only the longest.
+void MakeMappedIntervals(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData,
+                         SMRTSequence &smrtRead, std::vector<SMRTSequence> &subreads,
+                         MappingParameters &params, std::vector<ReadInterval> &subreadIntervals,
+                         std::vector<int> &subreadDirections, int &bestSubreadIndex,
+                         int &startIndex, int &endIndex)
+{
     if ((mapData->reader->GetFileType() != FileType::PBBAM and
          mapData->reader->GetFileType() != FileType::PBDATASET) or
         not params.concordant) {
@@ -303,15 +323,44 @@ void MapReadsNonCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapDa
         UpdateDirections(subreadDirections, true);
     }
 
-    int startIndex = 0;
-    int endIndex = subreadIntervals.size();
+    startIndex = 0;
+    endIndex = subreadIntervals.size();
 
     if (params.concordant) {
         // Only the longest subread will be aligned in the first round.
         // VR , change the comment
         startIndex = std::max(startIndex, bestSubreadIndex);
         endIndex = std::min(endIndex, bestSubreadIndex + 1);
+    }
+}
 
+void MapReadsNonCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData,
+                    MappingBuffers &mappingBuffers, SMRTSequence &smrtRead,
+                    SMRTSequence &smrtReadRC, std::vector<SMRTSequence> &subreads,
+                    MappingParameters &params, const int &associatedRandInt,
+                    ReadAlignments &allReadAlignments, std::ofstream &threadOut)
+{
+    DNASuffixArray sarray;
+    TupleCountTable<T_GenomeSequence, DNATuple> ct;
+    SequenceIndexDatabase<FASTQSequence> seqdb;
+    T_GenomeSequence genome;
+    BWT *bwtPtr;
+
+    mapData->ShallowCopySuffixArray(sarray);
+    mapData->ShallowCopyReferenceSequence(genome);
+    mapData->ShallowCopySequenceIndexDatabase(seqdb);
+    mapData->ShallowCopyTupleCountTable(ct);
+
+    bwtPtr = mapData->bwtPtr;
+    SeqBoundaryFtr<FASTQSequence> seqBoundary(&seqdb);
+
+    std::vector<ReadInterval> subreadIntervals;
+    std::vector<int> subreadDirections;
+    int bestSubreadIndex, startIndex, endIndex;
+    MakeMappedIntervals(mapData, smrtRead, subreads, params, subreadIntervals, subreadDirections,
+                        bestSubreadIndex, startIndex, endIndex);
+
+    if (params.concordant) {
         if (params.verbosity >= 1) {
             std::cout << "Concordant template subread index: " << bestSubreadIndex << ", "
                       << smrtRead.HoleNumber() << "/" << subreadIntervals[bestSubreadIndex]
@@ -338,6 +387,8 @@ void MapReadsNonCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapDa
 
         std::vector<T_AlignmentCandidate *> alignmentPtrs;
         mapData->metrics.numReads++;
+        MappingThreadProgress::Add(mapData->progress.subreads, 1);
+        mapData->trace.Begin(mapData->histograms);
 
         assert(subreadSequence.zmwData.holeNumber == smrtRead.zmwData.holeNumber);
 
@@ -381,6 +432,7 @@ void MapReadsNonCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapDa
             params.doSensitiveSearch) {
             MappingParameters sensitiveParams = params;
             sensitiveParams.SetForSensitivity();
+            mapData->trace.sensitiveRetry = true;
             MapRead(subreadSequence, subreadSequenceRC, genome, sarray, *bwtPtr, seqBoundary, ct,
                     seqdb, sensitiveParams, mapData->metrics, alignmentPtrs, mappingBuffers,
                     mapData, semaphores);
@@ -391,7 +443,13 @@ void MapReadsNonCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapDa
         //
         if (alignmentPtrs.size() > 0 and alignmentPtrs[0]->score < params.maxScore and
             params.storeMapQV) {
+            mapData->histograms.Tick(MappingStage::StoreMapQVs);
             StoreMapQVs(subreadSequence, alignmentPtrs, params);
+            mapData->histograms.Tock(MappingStage::StoreMapQVs);
+        }
+        WriteReadTrace(mapData, subreadSequence, alignmentPtrs);
+        if (mapData->restrictionPtr != NULL) {
+            RemoveOffTargetAlignments(alignmentPtrs, *mapData->restrictionPtr);
         }
 
         //
@@ -449,8 +507,8 @@ void MapReadsNonCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapDa
 
             for (int alignmentIndex = 0; alignmentIndex < int(selectedAlignmentPtrs.size());
                  alignmentIndex++) {
-                FlankTAlignedSeq(selectedAlignmentPtrs[alignmentIndex], seqdb, genome,
-                                 params.flankSize);
+                FlankTAlignedSeq(selectedAlignmentPtrs[alignmentIndex], seqdb,
+                                 *mapData->contigIndexPtr, genome, params.flankSize);
             }
 
             for (int intvIndex = 0; intvIndex < int(subreadIntervals.size()); intvIndex++) {
@@ -463,6 +521,7 @@ void MapReadsNonCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapDa
                 }
 
                 mapData->metrics.numReads++;
+                MappingThreadProgress::Add(mapData->progress.subreads, 1);
                 SMRTSequence subread;
                 subread.ReferenceSubstring(smrtRead, passStartBase, passNumBases);
                 subread.CopyTitle(smrtRead.title);
@@ -531,6 +590,8 @@ void MapReadsCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData,
     //
     std::vector<T_AlignmentCandidate *> alignmentPtrs;
     mapData->metrics.numReads++;
+    MappingThreadProgress::Add(mapData->progress.subreads, 1);
+    mapData->trace.Begin(mapData->histograms);
     smrtRead.SubreadStart(0).SubreadEnd(smrtRead.length);
     smrtReadRC.SubreadStart(0).SubreadEnd(smrtRead.length);
 
@@ -542,7 +603,13 @@ void MapReadsCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData,
     //
     if (alignmentPtrs.size() > 0 and alignmentPtrs[0]->score < params.maxScore and
         params.storeMapQV) {
+        mapData->histograms.Tick(MappingStage::StoreMapQVs);
         StoreMapQVs(smrtRead, alignmentPtrs, params);
+        mapData->histograms.Tock(MappingStage::StoreMapQVs);
+    }
+    WriteReadTrace(mapData, smrtRead, alignmentPtrs);
+    if (mapData->restrictionPtr != NULL) {
+        RemoveOffTargetAlignments(alignmentPtrs, *mapData->restrictionPtr);
     }
 
     //
@@ -580,8 +647,8 @@ void MapReadsCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData,
         // Flank alignment candidates to both ends.
         for (size_t alignmentIndex = 0; alignmentIndex < selectedAlignmentPtrs.size();
              alignmentIndex++) {
-            FlankTAlignedSeq(selectedAlignmentPtrs[alignmentIndex], seqdb, genome,
-                             params.flankSize);
+            FlankTAlignedSeq(selectedAlignmentPtrs[alignmentIndex], seqdb, *mapData->contigIndexPtr,
+                             genome, params.flankSize);
         }
 
         //
@@ -673,6 +740,108 @@ void MapReadsCCS(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData,
     }
 }
 
+/// A ZMW fetched by MapReads, kept until its alignments are printed.
+class FetchedZmw
+{
+public:
+    SMRTSequence smrtRead;
+    SMRTSequence smrtReadRC;
+    SMRTSequence unrolledReadRC;
+    CCSSequence ccsRead;
+    std::vector<SMRTSequence> subreads;
+    bool readIsCCS = false;
+    AlignmentContext alignmentContext;
+    // Associate each sequence to read in with a determined random int.
+    int associatedRandInt = 0;
+    std::uint64_t readIndex = 0;
+
+    ~FetchedZmw()
+    {
+        smrtRead.Free();
+        smrtReadRC.Free();
+        unrolledReadRC.Free();
+        ccsRead.Free();
+    }
+};
+
+/// Add the reads that MapReadsNonCCS or MapReadsCCS will ask MapRead to
+/// map for a ZMW, in the same order, so they can be mapped to the shards
+/// of a sharded suffix array first.
+/// \params[in] mapData: thread data holding the reader and region table.
+/// \params[in] zmw: the fetched ZMW.
+/// \params[in] params: mapping parameters.
+/// \params[out] shardedReads: the thread's batch.
+void AddShardedReads(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData,
+                     FetchedZmw &zmw, MappingParameters &params, ShardedReads &shardedReads)
+{
+    bool sampled =
+        ReadTrace::Sampled(zmw.smrtRead.title, zmw.smrtRead.HoleNumber(), params.debugSampleRate);
+    if (zmw.readIsCCS == false and params.mapSubreadsSeparately) {
+        std::vector<ReadInterval> subreadIntervals;
+        std::vector<int> subreadDirections;
+        int bestSubreadIndex, startIndex, endIndex;
+        MakeMappedIntervals(mapData, zmw.smrtRead, zmw.subreads, params, subreadIntervals,
+                            subreadDirections, bestSubreadIndex, startIndex, endIndex);
+        for (int intvIndex = startIndex; intvIndex < endIndex; intvIndex++) {
+            ShardedRead &sharded = shardedReads.Add();
+            MakeSubreadOfInterval(sharded.read, zmw.smrtRead, subreadIntervals[intvIndex], params);
+            MakeSubreadRC(sharded.readRC, sharded.read, zmw.smrtRead);
+            sharded.sideOutputSampled = sampled;
+            sharded.withRetry = params.doSensitiveSearch;
+        }
+    } else {
+        ShardedRead &sharded = shardedReads.Add();
+        sharded.read.Copy(zmw.smrtRead);
+        sharded.read.MakeRC(sharded.readRC);
+        sharded.read.SubreadStart(0).SubreadEnd(sharded.read.length);
+        sharded.readRC.SubreadStart(0).SubreadEnd(sharded.read.length);
+        sharded.sideOutputSampled = sampled;
+    }
+}
+
+/// Map a batch of ZMWs to every shard of a sharded suffix array, in step
+/// with the other mapping threads, leaving the merged candidates of each
+/// read for MapRead.
+/// \params[in] mapData: thread data holding the shard cycle.
+/// \params[in] batch: the ZMWs.
+/// \params[in] params: mapping parameters.
+/// \params[in] mappingBuffers: buffers reused by all reads.
+/// \params[out] shardedReads: the reads of the batch and their candidates.
+void MapBatchToShards(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData,
+                      std::vector<std::unique_ptr<FetchedZmw> > &batch, MappingParameters &params,
+                      MappingBuffers &mappingBuffers, ShardedReads &shardedReads)
+{
+    TupleCountTable<T_GenomeSequence, DNATuple> ct;
+    SequenceIndexDatabase<FASTQSequence> seqdb;
+    T_GenomeSequence genome;
+    mapData->ShallowCopyReferenceSequence(genome);
+    mapData->ShallowCopySequenceIndexDatabase(seqdb);
+    mapData->ShallowCopyTupleCountTable(ct);
+
+    for (auto &zmw : batch) {
+        AddShardedReads(mapData, *zmw, params, shardedReads);
+    }
+    // The trace of a read starts when MapReadsNonCCS or MapReadsCCS map it.
+    bool traceActive = mapData->trace.active;
+    mapData->trace.active = false;
+    int nShards = mapData->shardCyclePtr->NumShards();
+    for (int s = 0; s < nShards; s++) {
+        // Busy time leaves out the wait for the other threads and the load.
+        ReferenceShard &shard = mapData->shardCyclePtr->Arrive();
+        MappingHistograms::Clock::time_point workStart = MappingHistograms::Clock::now();
+        std::uint64_t waitStart = mapData->semaphoreStats.TotalWait();
+        MapShardedReads(shardedReads, shard, genome, *mapData->bwtPtr, ct, seqdb, params,
+                        mapData->metrics, mappingBuffers, mapData, semaphores);
+        std::uint64_t workTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     MappingHistograms::Clock::now() - workStart)
+                                     .count();
+        std::uint64_t wait = mapData->semaphoreStats.TotalWait() - waitStart;
+        MappingThreadProgress::Add(mapData->progress.busyNanoseconds,
+                                   workTime > wait ? workTime - wait : 0);
+    }
+    mapData->trace.active = traceActive;
+}
+
 void MapReads(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData)
 {
     //
@@ -693,11 +862,10 @@ void MapReads(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData)
 
     SeqBoundaryFtr<FASTQSequence> seqBoundary(&seqdb);
 
-    int numAligned = 0;
+    MappingSemaphores::SetThreadStats(&mapData->semaphoreStats);
+    MappingProfiler::EnterThread(mapData->threadIndex);
 
-    SMRTSequence smrtRead, smrtReadRC;
-    SMRTSequence unrolledReadRC;
-    CCSSequence ccsRead;
+    int numAligned = 0;
 
     // Print verbose logging to pid.threadid.log for each thread.
     std::ofstream threadOut;
@@ -708,104 +876,289 @@ void MapReads(MappingData<T_SuffixArray, T_GenomeSequence, T_Tuple> *mapData)
         threadOut.open(threadLogFileName.c_str(), std::ios::out | std::ios::app);
     }
 
+    //
+    // With a sharded suffix array, ZMWs are fetched and mapped to the
+    // shards in batches, and then mapped and printed one by one with
+    // the merged candidates.  Otherwise a batch is one ZMW.
+    //
+    ShardedReads shardedReads;
+    int batchSize = 1;
+    if (mapData->shardCyclePtr != NULL) {
+        mapData->shardedReadsPtr = &shardedReads;
+        batchSize = params.shardBatchSize;
+    }
+
     //
     // Reuse the following buffers during alignment.  Since these keep
     // storage contiguous, hopefully this will decrease memory
     // fragmentation.
     //
     MappingBuffers mappingBuffers;
-    while (true) {
+    std::vector<std::unique_ptr<FetchedZmw> > batch;
+    bool stop = false;
+    while (not stop) {
         // Fetch reads from a zmw
-        bool readIsCCS = false;
-        AlignmentContext alignmentContext;
-        // Associate each sequence to read in with a determined random int.
-        int associatedRandInt = 0;
-        bool stop = false;
-        std::vector<SMRTSequence> subreads;
-        bool readsOK =
-            FetchReads(mapData->reader, mapData->regionTablePtr, smrtRead, ccsRead, subreads,
-                       params, readIsCCS, alignmentContext.readGroupId, associatedRandInt, stop);
-        if (stop) break;
-        if (not readsOK) continue;
-
-        if (params.verbosity > 1) {
-            std::cout << "aligning read: " << std::endl;
-            smrtRead.PrintSeq(std::cout);
+        batch.clear();
+        while (int(batch.size()) < batchSize) {
+            std::unique_ptr<FetchedZmw> zmw(new FetchedZmw);
+            std::uint64_t nRecords = 0;
+            mapData->histograms.Tick(MappingStage::ReaderWait);
+            bool readsOK =
+                FetchReads(mapData->reader, mapData->regionTablePtr, zmw->smrtRead, zmw->ccsRead,
+                           zmw->subreads, params, zmw->readIsCCS, zmw->alignmentContext.readGroupId,
+                           zmw->associatedRandInt, stop, nRecords, zmw->readIndex);
+            mapData->histograms.Tock(MappingStage::ReaderWait);
+            MappingThreadProgress::Add(mapData->progress.records, nRecords);
+            if (stop) break;
+            if (readsOK) batch.push_back(std::move(zmw));
+        }
+        if (mapData->shardCyclePtr != NULL and batch.size() > 0) {
+            MapBatchToShards(mapData, batch, params, mappingBuffers, shardedReads);
         }
 
-        smrtRead.MakeRC(smrtReadRC);
+        for (auto &zmw : batch) {
+            SMRTSequence &smrtRead = zmw->smrtRead;
+            SMRTSequence &smrtReadRC = zmw->smrtReadRC;
+            CCSSequence &ccsRead = zmw->ccsRead;
+            bool readIsCCS = zmw->readIsCCS;
 
-        // important
-        // 1. CCS and unrolled mode are mutually exclusive
-        // 2. Reverse Complement Read is generated fort CCS only
-        //
-        if (readIsCCS) {
-            ccsRead.unrolledRead.MakeRC(unrolledReadRC);
-        }
+            MappingThreadProgress::Add(mapData->progress.zmws, 1);
+            BLASR_PROBE2(zmw__start, smrtRead.HoleNumber(), smrtRead.title);
+            mapData->trace.active =
+                mapData->traceFilePtr != NULL and
+                ReadTrace::Sampled(smrtRead.title, smrtRead.HoleNumber(), params.traceSampleRate);
+            mapData->sideOutputSampled =
+                ReadTrace::Sampled(smrtRead.title, smrtRead.HoleNumber(), params.debugSampleRate);
 
-        //
-        // When aligning subreads separately, iterate over each subread, and
-        // print the alignments for these.
-        //
-        ReadAlignments allReadAlignments;
-        allReadAlignments.read = smrtRead;
+            //
+            // Time spent mapping and printing, less time blocked on the output
+            // semaphores.  Waits are taken from the semaphore accounting, which
+            // unlike the stage histograms is on without --latencyMetrics.
+            //
+            MappingHistograms::Clock::time_point workStart = MappingHistograms::Clock::now();
+            std::uint64_t waitStart = mapData->semaphoreStats.TotalWait();
 
-        // currently 3 ways of mapping
-        // regular, CCS , and Polymerase (unrolled)
-        //
-        // for regular subreads MapReadsNonCCS
-        // for mapping ZMW as a whole (CCS or Polymerase) MapReadsCCS
-        // For the future , change the name of functions  to be more desriptive
-        // noSplitSubreads is in essense unrolled - Polymerase read mode
-        //
-        if (readIsCCS == false and params.mapSubreadsSeparately) {
-            // (not readIsCCS and not -noSplitSubreads)
-            MapReadsNonCCS(mapData, mappingBuffers, smrtRead, smrtReadRC, subreads, params,
-                           associatedRandInt, allReadAlignments, threadOut);
-        }       // End of if (readIsCCS == false and params.mapSubreadsSeparately).
-        else {  // if (readIsCCS or (not readIsCCS and -noSplitSubreads) )
-            MapReadsCCS(mapData, mappingBuffers, smrtRead, smrtReadRC, ccsRead, readIsCCS, params,
-                        associatedRandInt, allReadAlignments, threadOut);
-        }  // End of if not (readIsCCS == false and params.mapSubreadsSeparately)
-
-        PrintAllReadAlignments(allReadAlignments, alignmentContext, *mapData->outFilePtr,
-                               *mapData->unalignedFilePtr, params, subreads,
+            if (params.verbosity > 1) {
+                std::cout << "aligning read: " << std::endl;
+                smrtRead.PrintSeq(std::cout);
+            }
+
+            smrtRead.MakeRC(smrtReadRC);
+
+            // important
+            // 1. CCS and unrolled mode are mutually exclusive
+            // 2. Reverse Complement Read is generated fort CCS only
+            //
+            if (readIsCCS) {
+                ccsRead.unrolledRead.MakeRC(zmw->unrolledReadRC);
+            }
+
+            //
+            // When aligning subreads separately, iterate over each subread, and
+            // print the alignments for these.
+            //
+            ReadAlignments allReadAlignments;
+            allReadAlignments.read = smrtRead;
+
+            // currently 3 ways of mapping
+            // regular, CCS , and Polymerase (unrolled)
+            //
+            // for regular subreads MapReadsNonCCS
+            // for mapping ZMW as a whole (CCS or Polymerase) MapReadsCCS
+            // For the future , change the name of functions  to be more desriptive
+            // noSplitSubreads is in essense unrolled - Polymerase read mode
+            //
+            if (readIsCCS == false and params.mapSubreadsSeparately) {
+                // (not readIsCCS and not -noSplitSubreads)
+                MapReadsNonCCS(mapData, mappingBuffers, smrtRead, smrtReadRC, zmw->subreads, params,
+                               zmw->associatedRandInt, allReadAlignments, threadOut);
+            }       // End of if (readIsCCS == false and params.mapSubreadsSeparately).
+            else {  // if (readIsCCS or (not readIsCCS and -noSplitSubreads) )
+                MapReadsCCS(mapData, mappingBuffers, smrtRead, smrtReadRC, ccsRead, readIsCCS,
+                            params, zmw->associatedRandInt, allReadAlignments, threadOut);
+            }  // End of if not (readIsCCS == false and params.mapSubreadsSeparately)
+
+            mapData->histograms.Tick(MappingStage::PrintAlignments);
+            PrintAllReadAlignments(allReadAlignments, zmw->alignmentContext, *mapData->outFilePtr,
+                                   *mapData->unalignedFilePtr, params, zmw->subreads,
 #ifdef USE_PBBAM
-                               bamWriterPtr,
+                                   mapData->bamWriterPtr, mapData->unalignedBamWriterPtr,
 #endif
-                               semaphores);
+                                   semaphores, mapData->histograms, mapData->splitOutput);
+            if (mapData->threadOutput) {
+                mapData->threadOutput->EndZmw(zmw->readIndex);
+            }
+            mapData->histograms.Tock(MappingStage::PrintAlignments);
+            mapData->memory.Record(mappingBuffers, allReadAlignments.CandidateBytes());
+            MappingThreadProgress::Set(mapData->progress.bufferBytes, mapData->memory.Total());
+            BLASR_PROBE2(zmw__end, smrtRead.HoleNumber(), zmw->subreads.size());
+            std::uint64_t workTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         MappingHistograms::Clock::now() - workStart)
+                                         .count();
+            std::uint64_t wait = mapData->semaphoreStats.TotalWait() - waitStart;
+            MappingThreadProgress::Add(mapData->progress.busyNanoseconds,
+                                       workTime > wait ? workTime - wait : 0);
+
+            allReadAlignments.Clear();
+            zmw.reset();
+            numAligned++;
+            if (numAligned % 100 == 0) {
+                mappingBuffers.Reset();
+            }
+        }
+        shardedReads.Clear();
+    }  // End of while (not stop).
+    if (mapData->shardCyclePtr != NULL) {
+        mapData->shardCyclePtr->Leave();
+    }
+    mapData->shardedReadsPtr = NULL;
+    mapData->FlushSideOutputs();
 
-        allReadAlignments.Clear();
-        smrtReadRC.Free();
-        smrtRead.Free();
+    if (params.nProc > 1) {
+        semaphores.Wait(MappingSemaphore::Reader);
+        semaphores.Post(MappingSemaphore::Reader);
+    }
+    MappingSemaphores::SetThreadStats(NULL);
+}
 
-        if (readIsCCS) {
-            ccsRead.Free();
-            unrolledReadRC.Free();
+/// Count the input records in all query files for progress reporting.
+/// \params[in] queryFileNames: BAM or dataset XML files.
+/// \returns the number of records listed in the .pbi indices, or 0 if
+///          any query is not BAM or has no .pbi, in which case
+///          percent of input consumed and ETA are not reported.
+std::uint64_t CountInputRecords(const std::vector<std::string> &queryFileNames)
+{
+    std::uint64_t nRecords = 0;
+#ifdef USE_PBBAM
+    for (const std::string &fileName : queryFileNames) {
+        std::string ext = fileName.substr(fileName.find_last_of('.') + 1);
+        if (ext != "bam" and ext != "xml") {
+            return 0;
         }
-        numAligned++;
-        if (numAligned % 100 == 0) {
-            mappingBuffers.Reset();
+        try {
+            PacBio::BAM::DataSet dataset(fileName);
+            for (const PacBio::BAM::BamFile &bamFile : dataset.BamFiles()) {
+                if (not bamFile.PacBioIndexExists()) {
+                    return 0;
+                }
+                nRecords += PacBio::BAM::PbiRawData(bamFile.PacBioIndexFilename()).NumReads();
+            }
+        } catch (std::exception &e) {
+            return 0;
         }
-    }  // End of while (true).
-    smrtRead.Free();
-    smrtReadRC.Free();
-    unrolledReadRC.Free();
-    ccsRead.Free();
-
-    if (params.nProc > 1) {
-#ifdef __APPLE__
-        sem_wait(semaphores.reader);
-        sem_post(semaphores.reader);
-#else
-        sem_wait(&semaphores.reader);
-        sem_post(&semaphores.reader);
+    }
 #endif
+    return nRecords;
+}
+
+/// Memory held by a suffix array lookup table, which has the start and
+/// end of the suffix array interval of every word of the given length,
+/// and by a tuple count table, which has one count per word.
+std::uint64_t LookupTableBytes(int prefixLength)
+{
+    return (prefixLength > 0) ? 2 * (std::uint64_t(1) << (2 * prefixLength)) * sizeof(SAIndex) : 0;
+}
+
+std::uint64_t CountTableBytes(int tupleSize)
+{
+    return (std::uint64_t(1) << (2 * tupleSize)) * sizeof(int);
+}
+
+std::uint64_t FileBytes(const std::string &fileName)
+{
+    struct stat st;
+    return (stat(fileName.c_str(), &st) == 0) ? st.st_size : 0;
+}
+
+std::uint64_t SeqDBBytes(int nSequences, std::uint64_t nameBytes)
+{
+    return (nSequences + 1) * sizeof(DNALength) + nSequences * (sizeof(char *) + sizeof(int)) +
+           nameBytes;
+}
+
+/// Estimate the memory of the shared structures for --estimateMemory
+/// without loading them: the genome is scanned line by line and only
+/// the header of a suffix array is read.
+/// \params[in] params: sane mapping parameters.
+/// \params[in] report: filled with one entry per structure.
+void EstimateMemory(const MappingParameters &params, MemoryReport &report)
+{
+    std::ifstream genomeIn;
+    CrucialOpen(params.genomeFileName, genomeIn, std::ios::in);
+    std::uint64_t nBases = 0, nameBytes = 0;
+    int nSequences = 0;
+    std::string line;
+    while (std::getline(genomeIn, line)) {
+        if (line.size() > 0 and line[0] == '>') {
+            ++nSequences;
+            nameBytes += line.size();
+        } else {
+            nBases += line.size() - ((line.size() > 0 and line.back() == '\r') ? 1 : 0);
+        }
     }
+    report.Add("genome", nBases);
+    report.Add("seqdb", SeqDBBytes(nSequences, nameBytes));
+
+    // main shortens the words of a suffix array built on the fly, and
+    // so those of the count table, to -minMatch.
+    int lookupTableLength = params.lookupTableLength;
+    if (not params.useBwt and not params.useSuffixArray and params.minMatchLength > 0 and
+        params.anchorParameters.useLookupTable and lookupTableLength > params.minMatchLength) {
+        lookupTableLength = params.minMatchLength;
+    }
+
+    if (params.useBwt) {
+        report.Add("bwt", FileBytes(params.bwtFileName));
+    } else if (params.useSuffixArray and
+               ReferenceShards::IsManifestName(params.suffixArrayFileName)) {
+        // Only the largest shard needs to fit, as one is loaded at a time.
+        ReferenceShards shards;
+        shards.ReadManifest(params.suffixArrayFileName);
+        std::uint64_t saLength = 0, lookupTableBytes = 0;
+        for (int s = 0; s < shards.NumShards(); s++) {
+            DNASuffixArray sa;
+            if (not sa.LightRead(shards.Shard(s).fileName)) {
+                std::cout << "ERROR. " << shards.Shard(s).fileName
+                          << " is not a valid suffix array. " << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            saLength = std::max<std::uint64_t>(saLength, sa.length);
+            if (sa.componentList[DNASuffixArray::CompLookupTable]) {
+                lookupTableBytes = LookupTableBytes(sa.lookupPrefixLength);
+            }
+        }
+        report.Add("suffixArray", saLength * sizeof(SAIndex));
+        report.Add("lookupTable", lookupTableBytes);
+    } else if (params.useSuffixArray) {
+        DNASuffixArray sa;
+        if (not sa.LightRead(params.suffixArrayFileName)) {
+            std::cout << "ERROR. " << params.suffixArrayFileName << " is not a valid suffix array. "
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        report.Add("suffixArray", std::uint64_t(sa.length) * sizeof(SAIndex));
+        report.Add("lookupTable", sa.componentList[DNASuffixArray::CompLookupTable]
+                                      ? LookupTableBytes(sa.lookupPrefixLength)
+                                      : 0);
+    } else {
+        // Larsson-Sadakane needs a second array of the same size while building.
+        report.Add("suffixArray", (nBases + 1) * sizeof(SAIndex));
+        report.Add("suffixArrayBuild", (nBases + 1) * sizeof(SAIndex));
+        report.Add("lookupTable", params.anchorParameters.useLookupTable
+                                      ? LookupTableBytes(lookupTableLength)
+                                      : 0);
+    }
+    report.Add("countTable", params.useCountTable ? FileBytes(params.countTableName)
+                                                  : CountTableBytes(lookupTableLength));
 }
 
 int main(int argc, char *argv[])
 {
+    //
+    // Time each phase of startup, until the first read is mapped.
+    //
+    StartupReport startup;
+
     //
     // Configure parameters for refining alignments.
     //
@@ -824,6 +1177,11 @@ int main(int argc, char *argv[])
     // Parse command line args.
     clp.ParseCommandLine(argc, argv, params.readsFileNames);
 
+    // Before any thread exists, so that only the profiler takes SIGUSR2.
+    if (params.profileFileName != "") {
+        MappingProfiler::BlockSignal();
+    }
+
     std::string commandLine;
     clp.CommandLineToString(argc, argv, commandLine);
 
@@ -881,11 +1239,20 @@ int main(int argc, char *argv[])
         InitializeRandomGeneratorWithTime();
     }
 
+    if (params.estimateMemory) {
+        MemoryReport estimate;
+        EstimateMemory(params, estimate);
+        estimate.PrintEstimate(std::cout);
+        std::exit(EXIT_SUCCESS);
+    }
+
     //
     // Various aspects of timing are stored here.  However this isn't
     // quite finished.
     //
     MappingMetrics metrics;
+    MappingHistograms histograms;
+    std::vector<MappingSemaphoreStats> semaphoreStats(params.nProc);
 
     std::ofstream fullMetricsFile;
     if (params.fullMetricsFileName != "") {
@@ -941,6 +1308,7 @@ int main(int argc, char *argv[])
         CrucialOpen(params.seqDBName, seqdbin);
         seqdb.ReadDatabase(seqdbin);
     }
+    startup.EndPhase("setup");
 
     //
     // Make sure the reads file exists and can be opened before
@@ -991,15 +1359,17 @@ int main(int argc, char *argv[])
     genome.deleteOnExit = false;
     genome.titleLength = fastaGenome.titleLength;
     genome.ToUpper();
+    startup.EndPhase("readGenome");
 
     DNASuffixArray sarray;
+    ReferenceShards shards;
     TupleCountTable<T_GenomeSequence, DNATuple> ct;
 
-    std::ofstream outFile;
-    outFile.exceptions(std::ostream::failbit);
     std::ofstream unalignedOutFile;
     BWT bwt;
 
+    const char *indexPhase =
+        params.useBwt ? "readBwt" : params.useSuffixArray ? "readSuffixArray" : "buildSuffixArray";
     if (params.useBwt) {
         if (bwt.Read(params.bwtFileName) == 0) {
             std::cout << "ERROR! Could not read the BWT file. " << params.bwtFileName << std::endl;
@@ -1026,7 +1396,13 @@ int main(int argc, char *argv[])
             genome.ConvertThreeBitToAscii();
             params.useSuffixArray = 1;
         } else if (params.useSuffixArray) {
-            if (sarray.Read(params.suffixArrayFileName)) {
+            bool sharded = ReferenceShards::IsManifestName(params.suffixArrayFileName);
+            if (sharded ? shards.Open(params.suffixArrayFileName, seqdb.nSeqPos - 1, genome.length)
+                        : sarray.Read(params.suffixArrayFileName)) {
+                if (sharded) {
+                    // Only the lookup table length is taken from 'sarray' below.
+                    sarray.lookupPrefixLength = shards.LookupPrefixLength();
+                }
                 if (params.minMatchLength != 0) {
                     params.listTupleSize = std::min(8, params.minMatchLength);
                 } else {
@@ -1055,6 +1431,7 @@ int main(int argc, char *argv[])
                   << ".  Setting -minMatch to " << sarray.lookupPrefixLength << "." << std::endl;
         params.minMatchLength = sarray.lookupPrefixLength;
     }
+    startup.EndPhase(indexPhase);
 
     //
     // It is required to have a tuple count table
@@ -1064,18 +1441,27 @@ int main(int argc, char *argv[])
     // it in.  If not, this is operating under the mode
     // that everything is computed from scratch.
     //
+    // The count tables of a sharded suffix array add up to that of the
+    // reference, when they count tuples of the searched length.
+    //
     TupleMetrics saLookupTupleMetrics;
+    bool shardCountTables = false;
     if (params.useCountTable) {
         std::ifstream ctIn;
         CrucialOpen(params.countTableName, ctIn, std::ios::in | std::ios::binary);
         ct.Read(ctIn);
         saLookupTupleMetrics = ct.tm;
 
+    } else if (shards.NumShards() > 0 and shards.ReadCountTables(ct, params.lookupTableLength)) {
+        saLookupTupleMetrics = ct.tm;
+        shardCountTables = true;
     } else {
         saLookupTupleMetrics.Initialize(params.lookupTableLength);
         ct.InitCountTable(saLookupTupleMetrics);
         ct.AddSequenceTupleCountsLR(genome);
     }
+    startup.EndPhase(params.useCountTable or shardCountTables ? "readCountTable"
+                                                              : "buildCountTable");
 
     TitleTable titleTable;
     if (params.useTitleTable) {
@@ -1110,10 +1496,46 @@ int main(int argc, char *argv[])
             seqdb.SequenceTitleLinesToNames();
         }
     }
+    // Contig lookup and names for all threads, now the names are final.
+    ContigIndex contigIndex;
+    contigIndex.Build(seqdb);
+    shards.Attach(seqdb);
+    std::unique_ptr<ShardCycle> shardCycle;
+    if (shards.NumShards() > 0) {
+        shardCycle.reset(new ShardCycle(shards));
+    }
+    TargetRestriction restriction;
+    if (params.restrictToFileName != "") {
+        restriction.Read(params.restrictToFileName, contigIndex);
+    }
+    startup.EndPhase("titleTable");
+
+    //
+    // Account for the shared structures now they are loaded.
+    //
+    MemoryReport memoryReport;
+    if (params.memoryReportFileName != "") {
+        std::uint64_t nameBytes = 0;
+        for (int s = 0; s < seqdb.nSeqPos - 1; s++) {
+            nameBytes += seqdb.nameLengths[s];
+        }
+        memoryReport.Add("genome", fastaGenome.length + fastaGenome.titleLength);
+        memoryReport.Add("seqdb", SeqDBBytes(seqdb.nSeqPos - 1, nameBytes));
+        if (params.useBwt) {
+            memoryReport.Add("bwt", FileBytes(params.bwtFileName));
+        } else {
+            // One shard of a sharded suffix array is loaded at a time.
+            memoryReport.Add("suffixArray",
+                             (sarray.length + shards.LargestSuffixArrayLength()) * sizeof(SAIndex));
+            memoryReport.Add("lookupTable", LookupTableBytes(sarray.lookupPrefixLength));
+        }
+        memoryReport.Add("countTable", CountTableBytes(ct.tm.tupleSize));
+    }
 
     std::ostream *outFilePtr = &std::cout;
-    std::ofstream outFileStrm;
-    std::ofstream unalignedFile;
+    TextOutputFile outFile;
+    outFile.exceptions(std::ostream::failbit);
+    TextOutputFile unalignedFile;
     std::ostream *unalignedFilePtr = NULL;
     std::ofstream metricsOut, lcpBoundsOut;
     std::ofstream anchorFileStrm;
@@ -1133,29 +1555,64 @@ int main(int argc, char *argv[])
         clusterOutPtr = NULL;
     }
 
-    if (params.outFileName != "") {
+    // pbbam writes SAM and BAM records to this file.
+    std::string recordFileName = params.outFileName;
+    std::unique_ptr<StreamPipe> samPipe;
+    std::unique_ptr<SplitByRefOutput> splitOutput;
+    bool compressOut = params.compressOutput or BgzfStreambuf::IsCompressedName(params.outFileName);
+    std::vector<std::ostream *> textOutputs(1, outFilePtr);
+    if (params.splitByRef) {
+        std::vector<std::string> refNames;
+        std::vector<std::uint64_t> refLengths;
+        for (int s = 0; s < seqdb.nSeqPos - 1; s++) {
+            refNames.push_back(contigIndex.Name(s));
+            refLengths.push_back(seqdb.seqStartPos[s + 1] - seqdb.seqStartPos[s] - 1);
+        }
+        splitOutput.reset(
+            new SplitByRefOutput(params.outFileName, refNames, refLengths, params.splitMaxFiles));
         if (not params.printBAM) {
-            CrucialOpen(params.outFileName, outFileStrm, std::ios::out);
-            outFilePtr = &outFileStrm;
+            splitOutput->OpenText(compressOut, params.compressThreads);
+            textOutputs.clear();
+            for (int g = 0; g < splitOutput->NumGroups(); g++) {
+                textOutputs.push_back(&splitOutput->Text(g));
+            }
+        }
+    } else if (params.outFileName != "") {
+        if (not params.printBAM or
+            (params.sam_via_bam and (compressOut or params.outputByThread))) {
+            outFile.Open(params.outFileName, compressOut, params.compressThreads);
+            outFilePtr = &outFile;
+            textOutputs[0] = outFilePtr;
+            if (params.printBAM and not params.outputByThread) {
+                // pbbam only writes SAM to a named file, so give it a pipe
+                // into the compressed stream.
+                samPipe.reset(new StreamPipe(outFile));
+                recordFileName = samPipe->Path();
+            }
         }  // otherwise, use bamWriter and initialize it later
     }
 
-    if (params.printHeader) {
-        switch (params.printFormat) {
-            case (SummaryPrint):
-                SummaryOutput::PrintHeader(*outFilePtr);
-                break;
-            case (Interval):
-                IntervalOutput::PrintHeader(*outFilePtr);
-                break;
-            case (CompareSequencesParsable):
-                CompareSequencesOutput::PrintHeader(*outFilePtr);
-                break;
+    for (std::ostream *textOutput : textOutputs) {
+        if (params.printHeader) {
+            switch (params.printFormat) {
+                case (SummaryPrint):
+                    SummaryOutput::PrintHeader(*textOutput);
+                    break;
+                case (Interval):
+                    IntervalOutput::PrintHeader(*textOutput);
+                    break;
+                case (CompareSequencesParsable):
+                    CompareSequencesOutput::PrintHeader(*textOutput);
+                    break;
+            }
         }
     }
 
-    if (params.printUnaligned == true) {
-        CrucialOpen(params.unalignedFileName, unalignedFile, std::ios::out);
+    if (params.printUnaligned == true and not params.unalignedBam) {
+        unalignedFile.Open(
+            params.unalignedFileName,
+            params.compressOutput or BgzfStreambuf::IsCompressedName(params.unalignedFileName),
+            params.compressThreads);
         unalignedFilePtr = &unalignedFile;
     }
 
@@ -1168,6 +1625,11 @@ int main(int argc, char *argv[])
         //    lcpBoundsOut << "pos depth width lnwidth" << std::endl;
     }
 
+    std::ofstream traceOut;
+    if (params.traceFileName != "") {
+        CrucialOpen(params.traceFileName, traceOut, std::ios::out);
+    }
+
     //
     // Configure the mapping database.
     //
@@ -1215,12 +1677,13 @@ int main(int argc, char *argv[])
     std::string commandLineString;  // Restore command.
     clp.CommandLineToString(argc, argv, commandLineString);
 
-    if (params.printSAM or params.printBAM) {
-        std::string so = "UNKNOWN";          // sorting order;
-        std::string version = GetVersion();  //blasr version;
+    std::string headerString;  // SAM/BAM header
+    if (params.printSAM or params.printBAM or params.unalignedBam) {
+        std::string so = params.sortedOutput ? "coordinate" : "UNKNOWN";  // sorting order;
+        std::string version = GetVersion();                               //blasr version;
         SAMHeaderPrinter shp(so, seqdb, params.queryFileNames, params.queryReadType,
                              params.samQVList, "BLASR", version, commandLineString);
-        std::string headerString = shp.ToString();  // SAM/BAM header
+        headerString = shp.ToString();
         if (params.printSAM) {
             // this is not going to be executed since sam is printed via bam
             *outFilePtr << headerString;
@@ -1231,17 +1694,71 @@ int main(int argc, char *argv[])
             // Create bam header
             // Both file name and SAMHeader are required in order to create a BamWriter.
             // sam_via_bam changes
-            if (params.sam_via_bam) {
-                bamWriterPtr = new PacBio::BAM::SamWriter(params.outFileName, header);
+            if (params.outputByThread) {
+                // Each thread opens its own writer.
+            } else if (params.splitByRef) {
+                splitOutput->OpenRecords(header, params.sam_via_bam, compressOut,
+                                         params.compressThreads);
+                bamWriterPtr = new SplitByRefRecordWriter(*splitOutput);
+            } else if (params.sortedOutput) {
+                sortingWriterPtr = new SortingBamWriter(
+                    recordFileName, header, params.sam_via_bam, params.pbiOutput,
+                    params.tempDirectory, std::uint64_t(params.sortMemory) * 1024 * 1024,
+                    params.compressThreads);
+                bamWriterPtr = sortingWriterPtr;
+            } else if (params.sam_via_bam) {
+                bamWriterPtr = new PacBio::BAM::SamWriter(recordFileName, header);
+            } else if (params.pbiOutput) {
+                bamWriterPtr = new IndexingBamWriter(params.outFileName, header, true, false,
+                                                     params.compressThreads);
             } else {
-                bamWriterPtr = new PacBio::BAM::BamWriter(params.outFileName, header);
+                bamWriterPtr = new PacBio::BAM::BamWriter(
+                    params.outFileName, header, PacBio::BAM::BamWriter::DefaultCompression,
+                    params.compressThreads);
             }
 #else
             REQUIRE_PBBAM_ERROR();
 #endif
         }
+#ifdef USE_PBBAM
+        if (params.unalignedBam) {
+            // Input records are written unchanged, in no particular order.
+            PacBio::BAM::BamHeader header = PacBio::BAM::BamHeader(headerString);
+            header.SortOrder("unknown");
+            unalignedBamWriterPtr = new PacBio::BAM::BamWriter(
+                params.unalignedFileName, header, PacBio::BAM::BamWriter::DefaultCompression,
+                params.compressThreads);
+        }
+#endif
     }
+    startup.EndPhase("openOutput");
 
+    //
+    // Profile only the mapping phase.  The toggle signal was blocked
+    // at startup, before the output threads were started.
+    //
+    MappingProfiler profiler;
+    profiler.Start(params.profileFileName, params.profileThread, params.profileOnSignal);
+
+    //
+    // Periodically report throughput summed over all threads.
+    //
+    MappingProgressReporter progressReporter;
+    if (params.progressInterval > 0) {
+        std::vector<const MappingThreadProgress *> threadProgress;
+        for (procIndex = 0; procIndex < params.nProc; procIndex++) {
+            threadProgress.push_back(&mapdb[procIndex].progress);
+        }
+        progressReporter.Start(threadProgress, CountInputRecords(params.queryFileNames),
+                               params.progressInterval, params.statusFileName);
+    }
+
+    bool startupReported = false;
+    //
+    // With --outputByThread, each thread writes one file for all query
+    // files; they are merged once all query files are mapped.
+    //
+    std::vector<std::unique_ptr<ThreadOutput> > threadOutputs;
     for (size_t readsFileIndex = 0; readsFileIndex < params.queryFileNames.size();
          readsFileIndex++) {
         params.readsFileIndex = readsFileIndex;
@@ -1327,6 +1844,16 @@ int main(int argc, char *argv[])
             regionTableReader->Close();
         }
 
+        if (not startupReported) {
+            startup.EndPhase("openReads");
+            if (params.metricsFileName != "") {
+                startup.PrintLog(std::cerr);
+                startup.PrintTable(metricsOut);
+                metricsOut << std::endl;
+            }
+            startupReported = true;
+        }
+
         //
         // Check to see if there is a separate ccs fofn. If there is a separate
         // ccs fofn, use that over the one in the bas file.
@@ -1350,20 +1877,19 @@ int main(int argc, char *argv[])
             params.concordant = false;
         }
 
-#ifdef USE_GOOGLE_PROFILER
-        char *profileFileName = getenv("CPUPROFILE");
-        if (profileFileName != NULL) {
-            ProfilerStart(profileFileName);
-        } else {
-            ProfilerStart("google_profile.txt");
-        }
-#endif
-
         assert(initReturnValue > 0);
+        if (shardCycle) {
+            shardCycle->Start(params.nProc);
+        }
         if (params.nProc == 1) {
             mapdb[0].Initialize(&sarray, &genome, &seqdb, &ct, params, reader, &regionTable,
                                 outFilePtr, unalignedFilePtr, &anchorFileStrm, clusterOutPtr);
             mapdb[0].bwtPtr = &bwt;
+            mapdb[0].contigIndexPtr = &contigIndex;
+            mapdb[0].shardCyclePtr = shardCycle.get();
+            mapdb[0].restrictionPtr = restriction.IsEmpty() ? NULL : &restriction;
+            mapdb[0].threadIndex = 0;
+            mapdb[0].splitOutput = splitOutput.get();
             if (params.fullMetricsFileName != "") {
                 mapdb[0].metrics.SetStoreList(true);
             }
@@ -1372,9 +1898,17 @@ int main(int argc, char *argv[])
             } else {
                 mapdb[0].lcpBoundsOutPtr = NULL;
             }
+            mapdb[0].OpenSideOutputs(semaphores);
+            mapdb[0].traceFilePtr = (params.traceFileName != "") ? &traceOut : NULL;
+#ifdef USE_PBBAM
+            mapdb[0].bamWriterPtr = bamWriterPtr;
+            mapdb[0].unalignedBamWriterPtr = unalignedBamWriterPtr;
+#endif
 
             MapReads(&mapdb[0]);
             metrics.Collect(mapdb[0].metrics);
+            histograms.Collect(mapdb[0].histograms);
+            mapdb[0].histograms.Reset();
         } else {
             pthread_t *threads = new pthread_t[params.nProc];
             for (procIndex = 0; procIndex < params.nProc; procIndex++) {
@@ -1386,6 +1920,11 @@ int main(int argc, char *argv[])
                                             &regionTable, outFilePtr, unalignedFilePtr,
                                             &anchorFileStrm, clusterOutPtr);
                 mapdb[procIndex].bwtPtr = &bwt;
+                mapdb[procIndex].contigIndexPtr = &contigIndex;
+                mapdb[procIndex].shardCyclePtr = shardCycle.get();
+                mapdb[procIndex].restrictionPtr = restriction.IsEmpty() ? NULL : &restriction;
+                mapdb[procIndex].threadIndex = procIndex;
+                mapdb[procIndex].splitOutput = splitOutput.get();
                 if (params.fullMetricsFileName != "") {
                     mapdb[procIndex].metrics.SetStoreList(true);
                 }
@@ -1394,14 +1933,41 @@ int main(int argc, char *argv[])
                 } else {
                     mapdb[procIndex].lcpBoundsOutPtr = NULL;
                 }
+                mapdb[procIndex].OpenSideOutputs(semaphores);
+                mapdb[procIndex].traceFilePtr = (params.traceFileName != "") ? &traceOut : NULL;
+#ifdef USE_PBBAM
+                mapdb[procIndex].bamWriterPtr = bamWriterPtr;
+                mapdb[procIndex].unalignedBamWriterPtr = unalignedBamWriterPtr;
+#endif
 
                 if (params.outputByThread) {
-                    std::ofstream *outPtr = new std::ofstream;
-                    mapdb[procIndex].outFilePtr = outPtr;
                     std::stringstream outNameStream;
                     outNameStream << params.outFileName << "." << procIndex;
                     mapdb[procIndex].params.outFileName = outNameStream.str();
-                    CrucialOpen(mapdb[procIndex].params.outFileName, *outPtr, std::ios::out);
+                    ThreadOutput::Format format =
+                        not params.printBAM
+                            ? ThreadOutput::Text
+                            : (params.sam_via_bam ? ThreadOutput::SAM : ThreadOutput::BAM);
+                    if (readsFileIndex == 0) {
+                        threadOutputs.emplace_back(
+                            new ThreadOutput(outNameStream.str(), format, params.mergeInZmwOrder));
+                        if (format == ThreadOutput::Text) {
+                            threadOutputs.back()->OpenText();
+                        } else {
+#ifdef USE_PBBAM
+                            threadOutputs.back()->OpenRecords(PacBio::BAM::BamHeader(headerString));
+#endif
+                        }
+                    }
+                    ThreadOutput &threadOutput = *threadOutputs[procIndex];
+                    if (format == ThreadOutput::Text) {
+                        mapdb[procIndex].outFilePtr = &threadOutput.text;
+                    } else {
+#ifdef USE_PBBAM
+                        mapdb[procIndex].bamWriterPtr = threadOutput.records.get();
+#endif
+                    }
+                    mapdb[procIndex].threadOutput = &threadOutput;
                 }
                 pthread_create(&threads[procIndex], &threadAttr[procIndex],
                                (void *(*)(void *))MapReads, &mapdb[procIndex]);
@@ -1411,9 +1977,10 @@ int main(int argc, char *argv[])
             }
             for (procIndex = 0; procIndex < params.nProc; procIndex++) {
                 metrics.Collect(mapdb[procIndex].metrics);
-                if (params.outputByThread) {
-                    delete mapdb[procIndex].outFilePtr;
-                }
+                histograms.Collect(mapdb[procIndex].histograms);
+                mapdb[procIndex].histograms.Reset();
+                semaphoreStats[procIndex].Collect(mapdb[procIndex].semaphoreStats);
+                mapdb[procIndex].semaphoreStats.Reset();
             }
             if (threads) {
                 delete[] threads;
@@ -1422,16 +1989,31 @@ int main(int argc, char *argv[])
         }
         reader->Close();
     }
+    for (auto &threadOutput : threadOutputs) {
+        threadOutput->Close();
+    }
+    if (not params.keepThreadOutput) {
+        ThreadOutput::Merge(threadOutputs, *outFilePtr, params.outFileName);
+    }
+    progressReporter.Stop();
+    profiler.Stop();
 
     if (!reader) {
         delete reader;
         reader = NULL;
     }
 
+    if (params.memoryReportFileName != "") {
+        std::ofstream memoryReportOut;
+        CrucialOpen(params.memoryReportFileName, memoryReportOut, std::ios::out);
+        std::vector<const MappingThreadMemory *> threadMemory;
+        for (procIndex = 0; procIndex < params.nProc; procIndex++) {
+            threadMemory.push_back(&mapdb[procIndex].memory);
+        }
+        memoryReport.PrintTable(memoryReportOut, threadMemory);
+    }
+
     fastaGenome.Free();
-#ifdef USE_GOOGLE_PROFILER
-    ProfilerStop();
-#endif
 
     if (mapdb != NULL) {
         delete[] mapdb;
@@ -1445,20 +2027,36 @@ int main(int argc, char *argv[])
     }
     if (params.metricsFileName != "") {
         metrics.PrintSummary(metricsOut);
+        if (params.nProc > 1) {
+            metricsOut << std::endl;
+            MappingSemaphoreStats::PrintSummary(semaphoreStats, metricsOut);
+        }
     }
     if (params.fullMetricsFileName != "") {
         metrics.PrintFullList(fullMetricsFile);
     }
+    if (params.latencyMetricsFileName != "") {
+        std::ofstream latencyMetricsOut;
+        CrucialOpen(params.latencyMetricsFileName, latencyMetricsOut, std::ios::out);
+        histograms.PrintTable(latencyMetricsOut);
+    }
     if (params.outFileName != "") {
         if (params.printBAM) {
 #ifdef USE_PBBAM
-            assert(bamWriterPtr);
+            assert(bamWriterPtr or params.outputByThread);
             try {
-                if (!params.sam_via_bam) {  // no need to flush for SAM , but need to understand why
+                if (sortingWriterPtr) {
+                    sortingWriterPtr->Close();
+                    sortingWriterPtr = NULL;
+                } else if (bamWriterPtr and !params.sam_via_bam) {
+                    // no need to flush for SAM , but need to understand why
                     bamWriterPtr->TryFlush();
                 }
                 delete bamWriterPtr;
                 bamWriterPtr = NULL;
+                if (samPipe) {
+                    samPipe->Close();
+                }
             } catch (std::exception e) {
                 std::cout << "Error, could not flush bam records to bam file." << std::endl;
                 std::exit(EXIT_FAILURE);
@@ -1466,10 +2064,23 @@ int main(int argc, char *argv[])
 #else
             REQUIRE_PBBAM_ERROR();
 #endif
-        } else {
-            outFileStrm.close();
         }
+        if (splitOutput) {
+            splitOutput->Close();
+        }
+        if (outFile.IsOpen()) {
+            outFile.Close();
+        }
+    }
+    if (unalignedFile.IsOpen()) {
+        unalignedFile.Close();
     }
+#ifdef USE_PBBAM
+    if (unalignedBamWriterPtr) {
+        delete unalignedBamWriterPtr;
+        unalignedBamWriterPtr = NULL;
+    }
+#endif
     std::cerr << "[INFO] " << GetTimestamp() << " [blasr] ended." << std::endl;
     return 0;
 }
@@ -0,0 +1,837 @@
+// Microbenchmarks for the kernels that dominate mapping time.
+//
+// Each kernel is run in isolation on a fixed set of simulated reads so
+// that a change to one of them can be judged without timing a whole
+// cram run.  Reads are sampled with a fixed seed from a reference,
+// which is either a FASTA file or a random genome, and mutated with
+// uniform substitution/insertion/deletion errors.  Results are written
+// as one tab separated row per kernel.
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "iblasr/BlasrAlign.hpp"
+#include "iblasr/BlasrMiscs.hpp"
+#include "iblasr/BlasrUtils.hpp"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct SimulatedRead
+{
+    SMRTSequence read;
+    SMRTSequence readRC;
+    DNALength refStart;
+    DNALength refEnd;
+};
+
+struct KernelResult
+{
+    std::uint64_t ops = 0;
+    std::uint64_t nanoseconds = 0;
+    std::uint64_t cells = 0;
+    std::uint64_t anchors = 0;
+    std::uint64_t bases = 0;
+};
+
+std::uint64_t Elapsed(Clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// Write a random genome to 'fileName' so it is read through the same
+// FASTAReader path, including the sequence index database, as blasr.
+void WriteRandomGenome(const std::string &fileName, DNALength length, std::mt19937 &rng)
+{
+    static const char bases[] = "ACGT";
+    std::ofstream out;
+    CrucialOpen(fileName, out, std::ios::out);
+    out << ">synthetic_genome" << std::endl;
+    for (DNALength i = 0; i < length; i++) {
+        out << bases[rng() & 3];
+        if (i % 80 == 79) {
+            out << std::endl;
+        }
+    }
+    out << std::endl;
+}
+
+void SimulateReads(const DNASequence &genome, int nReads, DNALength readLength, float errorRate,
+                   std::mt19937 &rng, std::vector<SimulatedRead> &reads)
+{
+    static const char bases[] = "ACGT";
+    std::uniform_real_distribution<float> uniform(0, 1);
+    DNALength span = std::min<DNALength>(readLength, genome.length);
+    std::uniform_int_distribution<DNALength> startDist(0, genome.length - span);
+    reads.resize(nReads);
+    for (int r = 0; r < nReads; r++) {
+        SimulatedRead &sim = reads[r];
+        sim.refStart = startDist(rng);
+        sim.refEnd = sim.refStart + span;
+        std::string seq;
+        for (DNALength p = sim.refStart; p < sim.refEnd; p++) {
+            if (uniform(rng) < errorRate) {
+                int type = rng() % 3;
+                if (type == 0) {
+                    seq += bases[rng() & 3];  // substitution
+                } else if (type == 1) {
+                    seq += bases[rng() & 3];  // insertion
+                    seq += genome.seq[p];
+                }  // else deletion
+            } else {
+                seq += genome.seq[p];
+            }
+        }
+        sim.read.Copy(seq);
+        std::ostringstream title;
+        title << "sim/" << r << "/0_" << seq.size();
+        sim.read.CopyTitle(title.str());
+        sim.read.SubreadStart(0).SubreadEnd(sim.read.length);
+        sim.read.MakeRC(sim.readRC);
+        sim.readRC.SubreadStart(0).SubreadEnd(sim.readRC.length);
+    }
+}
+
+//
+// Candidates of one read on a repetitive reference, as with a large
+// -nCandidates and -bestn: copies of a handful of repeat units on a few
+// contigs, nested and overlapping both on the read and on the target.
+//
+void SimulateCandidates(int nCandidates, DNALength readLength, std::mt19937 &rng,
+                        std::vector<T_AlignmentCandidate> &candidates)
+{
+    std::uniform_int_distribution<DNALength> lengthDist(readLength / 20, readLength / 2);
+    std::uniform_real_distribution<float> pctDist(60, 100);
+    candidates.resize(nCandidates);
+    for (int c = 0; c < nCandidates; c++) {
+        T_AlignmentCandidate &cand = candidates[c];
+        DNALength length = lengthDist(rng);
+        DNALength repeatStart = (rng() % 8) * readLength;
+        cand.tIndex = rng() % 3;
+        cand.qStrand = rng() & 1;
+        cand.qLength = readLength;
+        cand.qPos = 0;
+        cand.qAlignedSeqPos = rng() % (readLength - length);
+        cand.qAlignedSeqLength = length;
+        cand.tPos = 0;
+        cand.tAlignedSeqPos = repeatStart + rng() % (readLength / 10 + 1);
+        cand.tAlignedSeqLength = length - rng() % (length / 10 + 1);
+        cand.blocks.resize(1);
+        cand.blocks[0].qPos = 0;
+        cand.blocks[0].tPos = 0;
+        cand.blocks[0].length = cand.tAlignedSeqLength;
+        cand.score = -int(rng() % 2000);
+        cand.pctSimilarity = pctDist(rng);
+    }
+}
+
+// The quadratic loops that PartitionOverlappingAlignments replaced.
+void NaivePartitionOverlappingAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs,
+                                         std::vector<std::set<int> > &partitions, float minOverlap)
+{
+    partitions.clear();
+    for (int i = 0; i < int(alignmentPtrs.size()); i++) {
+        bool overlapFound = false;
+        for (int p = 0; p < int(partitions.size()) and overlapFound == false; p++) {
+            for (std::set<int>::iterator setIt = partitions[p].begin();
+                 setIt != partitions[p].end() and overlapFound == false; ++setIt) {
+                if (AlignmentsOverlap(*alignmentPtrs[i], *alignmentPtrs[*setIt], minOverlap) or
+                    ((alignmentPtrs[i]->QAlignStart() <= alignmentPtrs[*setIt]->QAlignStart()) and
+                     (alignmentPtrs[i]->QAlignEnd() > alignmentPtrs[*setIt]->QAlignEnd()))) {
+                    partitions[p].insert(i);
+                    overlapFound = true;
+                }
+            }
+        }
+        if (overlapFound == false) {
+            partitions.push_back(std::set<int>());
+            partitions.back().insert(i);
+        }
+    }
+}
+
+// The quadratic loops that RemoveOverlappingAlignments replaced.
+void NaiveRemoveOverlappingAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs,
+                                      MappingParameters &params)
+{
+    std::vector<unsigned char> contained(alignmentPtrs.size(), false);
+    for (size_t i = 0; i + 1 < alignmentPtrs.size(); i++) {
+        T_AlignmentCandidate *aref = alignmentPtrs[i];
+        if (aref->pctSimilarity < params.minPctSimilarity) {
+            continue;
+        }
+        for (size_t j = i + 1; j < alignmentPtrs.size(); j++) {
+            T_AlignmentCandidate *bref = alignmentPtrs[j];
+            if (contained[j] or aref->tIndex != bref->tIndex) {
+                continue;
+            }
+            if (aref->GenomicTBegin() <= bref->GenomicTBegin() and
+                aref->GenomicTEnd() >= bref->GenomicTEnd()) {
+                if (aref->score <= bref->score) {
+                    contained[j] = true;
+                }
+            } else if (bref->GenomicTBegin() <= aref->GenomicTBegin() and
+                       bref->GenomicTEnd() >= aref->GenomicTEnd()) {
+                if (bref->score <= aref->score) {
+                    contained[i] = true;
+                }
+            }
+        }
+    }
+    size_t nKept = 0;
+    for (size_t i = 0; i < alignmentPtrs.size(); i++) {
+        if (contained[i]) {
+            delete alignmentPtrs[i];
+        } else {
+            alignmentPtrs[nKept++] = alignmentPtrs[i];
+        }
+    }
+    alignmentPtrs.resize(nKept);
+}
+
+// Indices into 'candidates' of the alignments left by 'remove'.
+template <typename T_Remove>
+std::vector<int> KeptCandidates(const std::vector<T_AlignmentCandidate> &candidates,
+                                T_Remove remove, std::uint64_t &nanoseconds)
+{
+    std::vector<T_AlignmentCandidate *> alignmentPtrs;
+    std::map<T_AlignmentCandidate *, int> indexOf;
+    for (size_t c = 0; c < candidates.size(); c++) {
+        alignmentPtrs.push_back(new T_AlignmentCandidate(candidates[c]));
+        indexOf[alignmentPtrs.back()] = c;
+    }
+    Clock::time_point start = Clock::now();
+    remove(alignmentPtrs);
+    nanoseconds += Elapsed(start);
+    std::vector<int> kept;
+    for (T_AlignmentCandidate *alignment : alignmentPtrs) {
+        kept.push_back(indexOf[alignment]);
+        delete alignment;
+    }
+    return kept;
+}
+
+void PrintResult(const std::string &kernel, const KernelResult &r, DNALength readLength)
+{
+    double seconds = r.nanoseconds * 1e-9;
+    if (seconds <= 0) {
+        seconds = 1e-9;
+    }
+    std::cout << kernel << "\t" << r.ops << "\t" << readLength << "\t" << std::fixed
+              << std::setprecision(1) << (r.ops ? double(r.nanoseconds) / r.ops : 0.0) << "\t"
+              << std::setprecision(0) << r.cells / seconds << "\t" << r.anchors / seconds << "\t"
+              << r.bases / seconds << std::endl;
+}
+
+// Keep the fastest of several passes, which is the least noisy.
+template <typename T_Pass>
+KernelResult BestOf(int passes, T_Pass pass)
+{
+    KernelResult best;
+    for (int p = 0; p < passes; p++) {
+        KernelResult r = pass();
+        if (p == 0 or r.nanoseconds < best.nanoseconds) {
+            best = r;
+        }
+    }
+    return best;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string referenceFileName;
+    std::string kernelName = "all";
+    int genomeLength = 1000000;
+    int nReads = 50;
+    int readLength = 10000;
+    float errorRate = 0.12;
+    int seed = 1;
+    int passes = 3;
+    int nCandidates = 4000;
+    int nContigs = 1000000;
+
+    CommandLineParser clp;
+    clp.SetProgramName("blasr-kernels");
+    clp.SetProgramSummary("Time blasr mapping kernels in isolation on simulated reads.");
+    clp.RegisterStringOption("-reference", &referenceFileName,
+                             "Sample reads from this FASTA file rather than a random genome.");
+    clp.RegisterStringOption("-kernel", &kernelName,
+                             "Run only this kernel: mapReadToGenome, findMaxIncreasingInterval, "
+                             "sdpAlign, kbandAlign, affineKBandAlign, guidedAlign, mapRead, "
+                             "format, overlappingAlignments or contigLookup.");
+    clp.RegisterIntOption("-genomeLength", &genomeLength, "Length of the random genome.",
+                          CommandLineParser::PositiveInteger);
+    clp.RegisterIntOption("-nReads", &nReads, "Number of reads to simulate.",
+                          CommandLineParser::PositiveInteger);
+    clp.RegisterIntOption("-readLength", &readLength, "Length of reference sampled per read.",
+                          CommandLineParser::PositiveInteger);
+    clp.RegisterFloatOption("-errorRate", &errorRate, "Per base error rate of reads.",
+                            CommandLineParser::NonNegativeFloat);
+    clp.RegisterIntOption("-seed", &seed, "Random seed.", CommandLineParser::NonNegativeInteger);
+    clp.RegisterIntOption("-passes", &passes, "Report the fastest of this many passes.",
+                          CommandLineParser::PositiveInteger);
+    clp.RegisterIntOption("-nCandidates", &nCandidates,
+                          "Number of candidates per read for overlappingAlignments.",
+                          CommandLineParser::PositiveInteger);
+    clp.RegisterIntOption("-nContigs", &nContigs, "Number of contigs for contigLookup.",
+                          CommandLineParser::PositiveInteger);
+    std::vector<std::string> leftovers;
+    clp.ParseCommandLine(argc, argv, leftovers);
+
+    std::mt19937 rng(seed);
+    std::string genomeFileName = referenceFileName;
+    if (genomeFileName == "") {
+        char tmpName[] = "/tmp/blasr-kernels-XXXXXX";
+        int fd = mkstemp(tmpName);
+        if (fd < 0) {
+            std::cerr << "ERROR, could not create a temporary genome file." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        close(fd);
+        genomeFileName = tmpName;
+        WriteRandomGenome(genomeFileName, genomeLength, rng);
+    }
+
+    //
+    // Use blasr's own defaults for every parameter.
+    //
+    MappingParameters params;
+    params.readsFileNames.push_back("simulated.fasta");
+    params.readsFileNames.push_back(genomeFileName);
+    params.MakeSane();
+
+    //
+    // Load the reference and index it the same way blasr does when no
+    // suffix array or count table is given.
+    //
+    SequenceIndexDatabase<FASTASequence> fastaSeqdb;
+    FASTASequence fastaGenome;
+    FASTAReader genomeReader;
+    if (!genomeReader.Init(genomeFileName)) {
+        std::cerr << "ERROR, could not open genome file " << genomeFileName << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    genomeReader.ReadAllSequencesIntoOne(fastaGenome, &fastaSeqdb);
+    genomeReader.Close();
+    if (referenceFileName == "") {
+        std::remove(genomeFileName.c_str());
+    }
+    fastaGenome.ToUpper();
+
+    DNASuffixArray sarray;
+    fastaGenome.ToThreeBit();
+    std::vector<int> alphabet;
+    sarray.InitThreeBitDNAAlphabet(alphabet);
+    sarray.LarssonBuildSuffixArray(fastaGenome.seq, fastaGenome.length, alphabet);
+    if (params.anchorParameters.useLookupTable == true) {
+        if (params.lookupTableLength > params.minMatchLength) {
+            params.lookupTableLength = params.minMatchLength;
+        }
+        sarray.BuildLookupTable(fastaGenome.seq, fastaGenome.length, params.lookupTableLength);
+    }
+    fastaGenome.ConvertThreeBitToAscii();
+    params.useSuffixArray = 1;
+
+    TupleCountTable<T_GenomeSequence, DNATuple> ct;
+    TupleMetrics saLookupTupleMetrics;
+    saLookupTupleMetrics.Initialize(params.lookupTableLength);
+    ct.InitCountTable(saLookupTupleMetrics);
+    ct.AddSequenceTupleCountsLR(fastaGenome);
+
+    MappingIPC mapData;
+    mapData.Initialize(&sarray, &fastaGenome, &fastaSeqdb, &ct, params, NULL, NULL, &std::cout,
+                       &std::cout, &std::cout);
+    mapData.lcpBoundsOutPtr = NULL;
+    mapData.traceFilePtr = NULL;
+    BWT bwt;
+    mapData.bwtPtr = &bwt;
+    ContigIndex contigIndex;
+    contigIndex.Build(fastaSeqdb);
+    mapData.contigIndexPtr = &contigIndex;
+
+    T_GenomeSequence genome;
+    SequenceIndexDatabase<FASTQSequence> seqdb;
+    mapData.ShallowCopyReferenceSequence(genome);
+    mapData.ShallowCopySequenceIndexDatabase(seqdb);
+    SeqBoundaryFtr<FASTQSequence> seqBoundary(&seqdb);
+
+    std::vector<SimulatedRead> reads;
+    SimulateReads(genome, nReads, readLength, errorRate, rng, reads);
+
+    MappingBuffers mappingBuffers;
+    MappingMetrics metrics;
+    MappingSemaphores semaphores;
+
+    DistanceMatrixScoreFunction<DNASequence, FASTQSequence> distScoreFn(SMRTDistanceMatrix,
+                                                                        params.indel, params.indel);
+    IDSScoreFunction<DNASequence, FASTQSequence> idsScoreFn;
+    idsScoreFn.ins = params.insertion;
+    idsScoreFn.del = params.deletion;
+    idsScoreFn.substitutionPrior = params.substitutionPrior;
+    idsScoreFn.globalDeletionPrior = params.globalDeletionPrior;
+    idsScoreFn.InitializeScoreMatrix(SMRTDistanceMatrix);
+
+    auto run = [&kernelName](const std::string &name) {
+        return kernelName == "all" or kernelName == name;
+    };
+
+    std::cout << "kernel\tops\tread_length\tns_per_op\tcells_per_sec\tanchors_per_sec\tbases_per_"
+                 "sec"
+              << std::endl;
+
+    //
+    // Anchoring with the suffix array, both strands.  The anchors of
+    // the last pass are kept as input for chaining.
+    //
+    std::vector<std::vector<ChainedMatchPos> > forwardAnchors(reads.size());
+    std::vector<std::vector<ChainedMatchPos> > reverseAnchors(reads.size());
+    if (run("mapReadToGenome") or run("findMaxIncreasingInterval")) {
+        KernelResult r = BestOf(passes, [&]() {
+            KernelResult pass;
+            for (size_t i = 0; i < reads.size(); i++) {
+                forwardAnchors[i].clear();
+                reverseAnchors[i].clear();
+                Clock::time_point start = Clock::now();
+                MapReadToGenome(genome, sarray, reads[i].read, params.lookupTableLength,
+                                forwardAnchors[i], params.anchorParameters);
+                MapReadToGenome(genome, sarray, reads[i].readRC, params.lookupTableLength,
+                                reverseAnchors[i], params.anchorParameters);
+                pass.nanoseconds += Elapsed(start);
+                pass.ops++;
+                pass.anchors += forwardAnchors[i].size() + reverseAnchors[i].size();
+                pass.bases += 2 * reads[i].read.length;
+            }
+            return pass;
+        });
+        if (run("mapReadToGenome")) {
+            PrintResult("mapReadToGenome", r, readLength);
+        }
+        for (size_t i = 0; i < reads.size(); i++) {
+            SortMatchPosList(forwardAnchors[i]);
+            SortMatchPosList(reverseAnchors[i]);
+        }
+    }
+
+    //
+    // Chaining anchors into candidate intervals, as MapRead does with
+    // the default p-value weighting.
+    //
+    if (run("findMaxIncreasingInterval")) {
+        IntervalSearchParameters intervalSearchParameters;
+        intervalSearchParameters.globalChainType = params.globalChainType;
+        intervalSearchParameters.advanceHalf = params.advanceHalf;
+        intervalSearchParameters.warp = params.warp;
+        intervalSearchParameters.fastMaxInterval = params.fastMaxInterval;
+        intervalSearchParameters.aggressiveIntervalCut = params.aggressiveIntervalCut;
+        intervalSearchParameters.verbosity = params.verbosity;
+        intervalSearchParameters.maxPValue = log(0.5);
+        intervalSearchParameters.aboveCategoryPValue = -300;
+        LISSizeWeightor<std::vector<ChainedMatchPos> > lisWeightFn;
+
+        KernelResult r = BestOf(passes, [&]() {
+            KernelResult pass;
+            for (size_t i = 0; i < reads.size(); i++) {
+                SMRTSequence &read = reads[i].read;
+                std::vector<ChainedMatchPos> forward = forwardAnchors[i];
+                std::vector<ChainedMatchPos> reverse = reverseAnchors[i];
+                PValueWeightor lisPValue(read, genome, ct.tm, &ct);
+                WeightedIntervalSet topIntervals(params.nCandidates);
+                VarianceAccumulator<float> accumPValue, accumWeight, accumNBases;
+                mappingBuffers.clusterList.Clear();
+                mappingBuffers.revStrandClusterList.Clear();
+                DNALength maxLength = read.SubreadLength() * (1 + params.indelRate);
+
+                Clock::time_point start = Clock::now();
+                FindMaxIncreasingInterval(
+                    Forward, forward, maxLength, params.nCandidates, seqBoundary, lisPValue,
+                    lisWeightFn, topIntervals, genome, read, intervalSearchParameters,
+                    &mappingBuffers.globalChainEndpointBuffer, mappingBuffers.clusterList,
+                    accumPValue, accumWeight, accumNBases);
+                mappingBuffers.clusterList.ResetCoordinates();
+                FindMaxIncreasingInterval(
+                    Reverse, reverse, maxLength, params.nCandidates, seqBoundary, lisPValue,
+                    lisWeightFn, topIntervals, genome, reads[i].readRC, intervalSearchParameters,
+                    &mappingBuffers.globalChainEndpointBuffer, mappingBuffers.revStrandClusterList,
+                    accumPValue, accumWeight, accumNBases);
+                pass.nanoseconds += Elapsed(start);
+                pass.ops++;
+                pass.anchors += forwardAnchors[i].size() + reverseAnchors[i].size();
+                pass.bases += 2 * read.length;
+            }
+            return pass;
+        });
+        PrintResult("findMaxIncreasingInterval", r, readLength);
+    }
+
+    //
+    // Pairwise aligners, each read against the reference interval it
+    // was sampled from.
+    //
+    std::vector<DNASequence> targets(reads.size());
+    for (size_t i = 0; i < reads.size(); i++) {
+        targets[i].ReferenceSubstring(genome, reads[i].refStart,
+                                      reads[i].refEnd - reads[i].refStart);
+    }
+
+    if (run("sdpAlign")) {
+        KernelResult r = BestOf(passes, [&]() {
+            KernelResult pass;
+            for (size_t i = 0; i < reads.size(); i++) {
+                T_AlignmentCandidate alignment;
+                Clock::time_point start = Clock::now();
+                SDPAlign(reads[i].read, targets[i], distScoreFn, params.sdpTupleSize, params.sdpIns,
+                         params.sdpDel, params.indelRate * 3, alignment, mappingBuffers, Local,
+                         params.detailedSDPAlignment, params.extendFrontAlignment,
+                         params.recurseOver, params.fastSDP);
+                pass.nanoseconds += Elapsed(start);
+                pass.ops++;
+                pass.cells += alignment.nCells;
+                pass.bases += reads[i].read.length;
+            }
+            return pass;
+        });
+        PrintResult("sdpAlign", r, readLength);
+    }
+
+    if (run("kbandAlign")) {
+        KernelResult r = BestOf(passes, [&]() {
+            KernelResult pass;
+            for (size_t i = 0; i < reads.size(); i++) {
+                T_AlignmentCandidate alignment;
+                DNALength qLength = reads[i].read.length, tLength = targets[i].length;
+                int k = (qLength > tLength ? qLength - tLength : tLength - qLength) +
+                        params.guidedAlignBandSize;
+                Clock::time_point start = Clock::now();
+                KBandAlign(reads[i].read, targets[i], SMRTDistanceMatrix, params.indel + 2,
+                           params.indel + 2, k, mappingBuffers.scoreMat, mappingBuffers.pathMat,
+                           alignment, distScoreFn, Global);
+                pass.nanoseconds += Elapsed(start);
+                pass.ops++;
+                pass.cells += std::uint64_t(qLength) * (2 * k + 1);
+                pass.bases += qLength;
+            }
+            return pass;
+        });
+        PrintResult("kbandAlign", r, readLength);
+    }
+
+    if (run("affineKBandAlign")) {
+        KernelResult r = BestOf(passes, [&]() {
+            KernelResult pass;
+            for (size_t i = 0; i < reads.size(); i++) {
+                T_AlignmentCandidate alignment;
+                DNALength qLength = reads[i].read.length, tLength = targets[i].length;
+                int k = (qLength > tLength ? qLength - tLength : tLength - qLength) +
+                        params.guidedAlignBandSize;
+                Clock::time_point start = Clock::now();
+                AffineKBandAlign(reads[i].read, targets[i], SMRTDistanceMatrix, params.indel + 2,
+                                 params.indel - 3, params.indel + 2, params.indel - 1, params.indel,
+                                 k, mappingBuffers.scoreMat, mappingBuffers.pathMat,
+                                 mappingBuffers.hpInsScoreMat, mappingBuffers.hpInsPathMat,
+                                 mappingBuffers.insScoreMat, mappingBuffers.insPathMat, alignment,
+                                 Global);
+                pass.nanoseconds += Elapsed(start);
+                pass.ops++;
+                // Three matrices: match, homopolymer insertion, insertion.
+                pass.cells += 3 * std::uint64_t(qLength) * (2 * k + 1);
+                pass.bases += qLength;
+            }
+            return pass;
+        });
+        PrintResult("affineKBandAlign", r, readLength);
+    }
+
+    if (run("guidedAlign")) {
+        KernelResult r = BestOf(passes, [&]() {
+            KernelResult pass;
+            for (size_t i = 0; i < reads.size(); i++) {
+                T_AlignmentCandidate alignment;
+                Clock::time_point start = Clock::now();
+                GuidedAlign(reads[i].read, targets[i], idsScoreFn, 12, params.sdpIns, params.sdpDel,
+                            params.indelRate, mappingBuffers, alignment, Local, false, 6);
+                pass.nanoseconds += Elapsed(start);
+                pass.ops++;
+                pass.cells += alignment.nCells;
+                pass.bases += reads[i].read.length;
+            }
+            return pass;
+        });
+        PrintResult("guidedAlign", r, readLength);
+    }
+
+    //
+    // The whole of MapRead, for reference against the sum of its parts.
+    //
+    if (run("mapRead")) {
+        KernelResult r = BestOf(passes, [&]() {
+            KernelResult pass;
+            for (size_t i = 0; i < reads.size(); i++) {
+                std::vector<T_AlignmentCandidate *> alignmentPtrs;
+                Clock::time_point start = Clock::now();
+                MapRead(reads[i].read, reads[i].readRC, genome, sarray, bwt, seqBoundary, ct, seqdb,
+                        params, metrics, alignmentPtrs, mappingBuffers, &mapData, semaphores);
+                pass.nanoseconds += Elapsed(start);
+                pass.ops++;
+                for (size_t a = 0; a < alignmentPtrs.size(); a++) {
+                    pass.cells += alignmentPtrs[a]->nCells;
+                    delete alignmentPtrs[a];
+                }
+                pass.bases += reads[i].read.length;
+            }
+            return pass;
+        });
+        PrintResult("mapRead", r, readLength);
+    }
+
+    //
+    // Formatting the alignments of each read in every text format,
+    // SAM included, into a std::ostringstream as with plain << and into
+    // the OutputBuffer that FormatAlignments uses.  Formatting happens
+    // outside the writer lock either way; this measures its cost per
+    // format.
+    //
+    if (run("format")) {
+        std::vector<std::vector<T_AlignmentCandidate *> > alignments(reads.size());
+        for (size_t i = 0; i < reads.size(); i++) {
+            MapRead(reads[i].read, reads[i].readRC, genome, sarray, bwt, seqBoundary, ct, seqdb,
+                    params, metrics, alignments[i], mappingBuffers, &mapData, semaphores);
+        }
+        const int formats[] = {
+            StickPrint, SummaryPrint, CompareXML, Vulgar, Interval, CompareSequencesParsable, SAM};
+        OutputBuffer outBuffer;
+        for (int format : formats) {
+            MappingParameters formatParams = params;
+            formatParams.printFormat = format;
+            formatParams.printSAM = format == SAM;
+            for (int buffered = 0; buffered < 2; buffered++) {
+                KernelResult r = BestOf(passes, [&]() {
+                    KernelResult pass;
+                    for (size_t i = 0; i < reads.size(); i++) {
+                        std::ostringstream outStream;
+                        outBuffer.Clear();
+                        std::ostream &out = buffered ? static_cast<std::ostream &>(outBuffer)
+                                                     : static_cast<std::ostream &>(outStream);
+                        Clock::time_point start = Clock::now();
+                        for (T_AlignmentCandidate *alignment : alignments[i]) {
+                            AlignmentContext context;
+                            PrintAlignment(*alignment, reads[i].read, formatParams, context, out
+#ifdef USE_PBBAM
+                                           ,
+                                           reads[i].read, NULL
+#endif
+                                           );
+                            pass.bases += alignment->qAlignedSeq.length;
+                        }
+                        pass.nanoseconds += Elapsed(start);
+                        pass.ops += alignments[i].size();
+                    }
+                    return pass;
+                });
+                std::ostringstream name;
+                name << "format:m" << format << (buffered ? ":buffer" : ":ostream");
+                PrintResult(name.str(), r, readLength);
+            }
+        }
+        for (size_t i = 0; i < reads.size(); i++) {
+            for (T_AlignmentCandidate *alignment : alignments[i]) {
+                delete alignment;
+            }
+        }
+    }
+
+    //
+    // Partitioning candidates that overlap on the read, as StoreMapQVs
+    // does, and removing candidates contained in better ones, on many
+    // candidates per read.  Each is checked against, and timed next to,
+    // the quadratic loops it replaced; a mismatch is an error.
+    //
+    if (run("overlappingAlignments")) {
+        // The quadratic loops are slow on thousands of candidates.
+        std::vector<std::vector<T_AlignmentCandidate> > candidates(
+            std::min<size_t>(reads.size(), 8));
+        for (size_t i = 0; i < candidates.size(); i++) {
+            SimulateCandidates(nCandidates, readLength, rng, candidates[i]);
+        }
+        for (int naive = 0; naive < 2; naive++) {
+            KernelResult r = BestOf(passes, [&]() {
+                KernelResult pass;
+                for (size_t i = 0; i < candidates.size(); i++) {
+                    std::vector<T_AlignmentCandidate *> alignmentPtrs;
+                    for (T_AlignmentCandidate &candidate : candidates[i]) {
+                        alignmentPtrs.push_back(&candidate);
+                    }
+                    std::vector<std::set<int> > partitions, expected;
+                    Clock::time_point start = Clock::now();
+                    if (naive) {
+                        NaivePartitionOverlappingAlignments(
+                            alignmentPtrs, partitions, params.minFractionToBeConsideredOverlapping);
+                    } else {
+                        PartitionOverlappingAlignments(alignmentPtrs, partitions,
+                                                       params.minFractionToBeConsideredOverlapping);
+                    }
+                    pass.nanoseconds += Elapsed(start);
+                    pass.ops++;
+                    if (not naive) {
+                        NaivePartitionOverlappingAlignments(
+                            alignmentPtrs, expected, params.minFractionToBeConsideredOverlapping);
+                        if (partitions != expected) {
+                            std::cerr << "ERROR, PartitionOverlappingAlignments differs from the "
+                                         "quadratic partitioning."
+                                      << std::endl;
+                            std::exit(EXIT_FAILURE);
+                        }
+                    }
+                }
+                return pass;
+            });
+            PrintResult(
+                naive ? "partitionOverlappingAlignments:naive" : "partitionOverlappingAlignments",
+                r, readLength);
+        }
+        for (int naive = 0; naive < 2; naive++) {
+            KernelResult r = BestOf(passes, [&]() {
+                KernelResult pass;
+                for (size_t i = 0; i < candidates.size(); i++) {
+                    std::uint64_t unused = 0;
+                    std::vector<int> kept;
+                    if (naive) {
+                        kept = KeptCandidates(
+                            candidates[i],
+                            [&](std::vector<T_AlignmentCandidate *> &alignmentPtrs) {
+                                NaiveRemoveOverlappingAlignments(alignmentPtrs, params);
+                            },
+                            pass.nanoseconds);
+                    } else {
+                        kept =
+                            KeptCandidates(candidates[i],
+                                           [&](std::vector<T_AlignmentCandidate *> &alignmentPtrs) {
+                                               RemoveOverlappingAlignments(alignmentPtrs, params);
+                                           },
+                                           pass.nanoseconds);
+                        std::vector<int> expected = KeptCandidates(
+                            candidates[i],
+                            [&](std::vector<T_AlignmentCandidate *> &alignmentPtrs) {
+                                NaiveRemoveOverlappingAlignments(alignmentPtrs, params);
+                            },
+                            unused);
+                        if (kept != expected) {
+                            std::cerr << "ERROR, RemoveOverlappingAlignments differs from the "
+                                         "quadratic removal."
+                                      << std::endl;
+                            std::exit(EXIT_FAILURE);
+                        }
+                    }
+                    pass.ops++;
+                }
+                return pass;
+            });
+            PrintResult(naive ? "removeOverlappingAlignments:naive" : "removeOverlappingAlignments",
+                        r, readLength);
+        }
+    }
+
+    //
+    // Finding the contig of a position, and a contig by name, in a
+    // metagenome sized reference: ContigIndex against the binary search
+    // of SequenceIndexDatabase::SearchForIndex and the linear scan of
+    // GetIndexOfSeqName.  Answers are checked; a mismatch is an error.
+    //
+    if (run("contigLookup")) {
+        std::vector<DNALength> starts(1, 0);
+        std::vector<std::string> names;
+        std::uniform_int_distribution<DNALength> contigLength(100, 5000);
+        for (int c = 0; c < nContigs; c++) {
+            // Contigs are separated by an 'N', as in the concatenated genome.
+            starts.push_back(starts.back() + contigLength(rng) + 1);
+            names.push_back("contig" + std::to_string(c));
+        }
+        ContigIndex bigIndex;
+        bigIndex.Build(starts, names, names);
+        std::uniform_int_distribution<DNALength> posDist(0, starts.back() - 1);
+        std::vector<DNALength> positions(1000000);
+        for (DNALength &pos : positions) {
+            pos = posDist(rng);
+        }
+        for (int binary = 0; binary < 2; binary++) {
+            KernelResult r = BestOf(passes, [&]() {
+                KernelResult pass;
+                std::uint64_t checksum = 0;
+                Clock::time_point start = Clock::now();
+                for (DNALength pos : positions) {
+                    if (binary) {
+                        checksum += std::upper_bound(starts.begin(), starts.end(), pos) -
+                                    starts.begin() - 1;
+                    } else {
+                        checksum += bigIndex.Find(pos);
+                    }
+                }
+                pass.nanoseconds += Elapsed(start);
+                pass.ops += positions.size();
+                pass.bases = checksum;  // keeps the loop from being optimized away
+                return pass;
+            });
+            PrintResult(binary ? "contigLookup:binarySearch" : "contigLookup", r, readLength);
+        }
+        for (size_t p = 0; p < positions.size(); p++) {
+            int expected =
+                std::upper_bound(starts.begin(), starts.end(), positions[p]) - starts.begin() - 1;
+            if (bigIndex.Find(positions[p]) != expected) {
+                std::cerr << "ERROR, ContigIndex::Find differs from a binary search at "
+                          << positions[p] << "." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        std::vector<int> queries(100);
+        for (int &query : queries) {
+            query = rng() % nContigs;
+        }
+        for (int linear = 0; linear < 2; linear++) {
+            KernelResult r = BestOf(passes, [&]() {
+                KernelResult pass;
+                Clock::time_point start = Clock::now();
+                for (int query : queries) {
+                    int found = -1;
+                    if (linear) {
+                        for (int c = 0; c < nContigs and found < 0; c++) {
+                            if (names[c] == names[query]) {
+                                found = c;
+                            }
+                        }
+                    } else {
+                        found = bigIndex.IndexOfName(names[query]);
+                    }
+                    if (found != query) {
+                        std::cerr << "ERROR, contig " << names[query] << " found at " << found
+                                  << "." << std::endl;
+                        std::exit(EXIT_FAILURE);
+                    }
+                }
+                pass.nanoseconds += Elapsed(start);
+                pass.ops += queries.size();
+                return pass;
+            });
+            PrintResult(linear ? "contigName:linearScan" : "contigName", r, readLength);
+        }
+    }
+
+    for (size_t i = 0; i < reads.size(); i++) {
+        reads[i].read.Free();
+        reads[i].readRC.Free();
+    }
+    return 0;
+}
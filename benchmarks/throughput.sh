@@ -0,0 +1,293 @@
+#!/usr/bin/env bash
+#
+# End-to-end throughput benchmark for blasr.
+#
+# Builds a synthetic reference with controlled repeat content, samples
+# reads from it with SimpleShredder, adds sequencing errors with
+# Evolve, and then times blasr over a matrix of thread counts, input
+# formats, output formats and mapping modes.  One tab separated row is
+# printed per run:
+#
+#   nproc input output mode reads seconds reads_per_sec peak_rss_kb scaling_efficiency status
+#
+# scaling_efficiency is reads_per_sec relative to the smallest --nproc
+# of the same input/output/mode, divided by the ratio of thread
+# counts, so 1.0 is perfect scaling.  With --minEfficiency the script
+# exits non-zero if any run scales worse than the given value.
+#
+# Tool locations are taken from BLASR, SIMPLESHREDDER and EVOLVE, or
+# found on PATH.
+
+set -euo pipefail
+
+BLASR=${BLASR:-blasr}
+SIMPLESHREDDER=${SIMPLESHREDDER:-SimpleShredder}
+EVOLVE=${EVOLVE:-Evolve}
+TIME=${TIME:-/usr/bin/time}
+
+reference=""
+bamInput=""
+genomeLength=2000000
+repeatFraction=0.05
+repeatLength=5000
+repeatDivergence=0.02
+nReads=2000
+readLength=5000
+accuracy=0.87
+seed=1
+nprocList="1 2 4 8"
+inputFormats="fasta fastq"
+outputFormats="sam bam m4"
+modes="default concordant noSplitSubreads useccs"
+outDir=""
+minEfficiency=""
+extraArgs=""
+
+usage()
+{
+    cat <<EOF
+Usage: $0 [options]
+
+Data set:
+  --reference FILE        Sample reads from FILE instead of a synthetic genome.
+  --bam FILE              Also time FILE (PacBio BAM) as input format "bam".
+  --genomeLength N        Length of the synthetic genome ($genomeLength).
+  --repeatFraction F      Fraction of the genome made of repeat copies ($repeatFraction).
+  --repeatLength N        Length of each repeat element ($repeatLength).
+  --repeatDivergence F    Per base divergence between repeat copies ($repeatDivergence).
+  --nReads N              Number of reads ($nReads).
+  --readLength N          Read length before errors are added ($readLength).
+  --accuracy F            Read accuracy ($accuracy).
+  --seed N                Seed for the synthetic genome ($seed).
+
+Matrix:
+  --nproc "LIST"          Thread counts ($nprocList).
+  --inputFormats "LIST"   Any of fasta fastq bam ($inputFormats).
+  --outputFormats "LIST"  Any of sam bam m4 ($outputFormats).
+  --modes "LIST"          Any of default concordant noSplitSubreads useccs ($modes).
+                          concordant and useccs need subreads, so they are
+                          only run on --bam input.
+  --blasrArgs "ARGS"      Extra arguments passed to every blasr run.
+
+Output:
+  --out DIR               Working directory (a new temporary directory).
+  --minEfficiency F       Fail if any run has scaling_efficiency below F.
+EOF
+}
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --reference) reference=$2; shift ;;
+        --bam) bamInput=$2; shift ;;
+        --genomeLength) genomeLength=$2; shift ;;
+        --repeatFraction) repeatFraction=$2; shift ;;
+        --repeatLength) repeatLength=$2; shift ;;
+        --repeatDivergence) repeatDivergence=$2; shift ;;
+        --nReads) nReads=$2; shift ;;
+        --readLength) readLength=$2; shift ;;
+        --accuracy) accuracy=$2; shift ;;
+        --seed) seed=$2; shift ;;
+        --nproc) nprocList=$2; shift ;;
+        --inputFormats) inputFormats=$2; shift ;;
+        --outputFormats) outputFormats=$2; shift ;;
+        --modes) modes=$2; shift ;;
+        --blasrArgs) extraArgs=$2; shift ;;
+        --out) outDir=$2; shift ;;
+        --minEfficiency) minEfficiency=$2; shift ;;
+        -h|--help) usage; exit 0 ;;
+        *) echo "ERROR, unknown option $1" >&2; usage >&2; exit 1 ;;
+    esac
+    shift
+done
+
+if ! "$TIME" -f %M true > /dev/null 2>&1; then
+    echo "ERROR, GNU time is required to measure peak RSS; set TIME." >&2
+    exit 1
+fi
+
+if [ "$outDir" == "" ]; then
+    outDir=$(mktemp -d "${TMPDIR:-/tmp}/blasr-throughput.XXXXXX")
+fi
+mkdir -p "$outDir"
+
+#
+# Reference: random sequence with repeatFraction of its length made of
+# diverged copies of a few repeat elements.
+#
+if [ "$reference" == "" ]; then
+    reference=$outDir/reference.fasta
+    awk -v length_="$genomeLength" -v fraction="$repeatFraction" -v repLen="$repeatLength" \
+        -v divergence="$repeatDivergence" -v seed="$seed" '
+        function base() { return substr("ACGT", int(rand() * 4) + 1, 1) }
+        # Bases are printed as they are drawn, 80 per line, so the
+        # genome is never held in one string.
+        function emit(c) {
+            printf "%s%s", c, (++n % 80 == 0) ? "\n" : "";
+        }
+        BEGIN {
+            srand(seed);
+            nElements = 4;
+            for (e = 0; e < nElements; e++) {
+                for (i = 0; i < repLen; i++) element[e, i] = base();
+            }
+            nCopies = int(length_ * fraction / repLen);
+            spacing = (nCopies > 0) ? int(length_ / nCopies) : length_ + 1;
+            print ">synthetic_reference";
+            n = 0;
+            while (n < length_) {
+                if (nCopies > 0 && n % spacing < repLen && n + repLen <= length_) {
+                    e = int(rand() * nElements);
+                    for (i = 0; i < repLen; i++) emit((rand() < divergence) ? base() : element[e, i]);
+                    nCopies--;
+                }
+                fill = (nCopies > 0) ? spacing - repLen : length_;
+                for (i = 0; i < fill && n < length_; i++) emit(base());
+            }
+            if (n % 80 != 0) printf "\n";
+        }' > "$reference"
+fi
+
+#
+# Reads: sample error free reads, then add errors split between
+# insertions, deletions and substitutions roughly as in raw PacBio
+# reads.  Titles are rewritten to movie/zmw/start_end so that every
+# mode can parse them.
+#
+"$SIMPLESHREDDER" "$reference" -readLength "$readLength" -nReads "$nReads" -nonRandInit \
+    -readsFile "$outDir/shredded.fasta" > /dev/null
+errorRate=$(awk -v a="$accuracy" 'BEGIN { print 1 - a }')
+"$EVOLVE" "$outDir/shredded.fasta" "$outDir/evolved.fasta" -nonRandInit \
+    -i "$(awk -v e="$errorRate" 'BEGIN { print e * 0.5 }')" \
+    -d "$(awk -v e="$errorRate" 'BEGIN { print e * 0.3 }')" \
+    -m "$(awk -v e="$errorRate" 'BEGIN { print e * 0.2 }')" > /dev/null
+
+awk '
+    function flush() { if (n > 0) print ">synthetic/" n "/0_" length(seq) "\n" seq }
+    /^>/ { flush(); n++; seq = ""; next }
+    { seq = seq toupper($0) }
+    END { flush() }' "$outDir/evolved.fasta" > "$outDir/reads.fasta"
+awk '
+    /^>/ { title = substr($0, 2); next }
+    { q = $0; gsub(/./, "5", q); print "@" title "\n" $0 "\n+\n" q }' \
+    "$outDir/reads.fasta" > "$outDir/reads.fastq"
+
+InputFile()
+{
+    case "$1" in
+        fasta) echo "$outDir/reads.fasta" ;;
+        fastq) echo "$outDir/reads.fastq" ;;
+        bam) echo "$bamInput" ;;
+    esac
+}
+
+CountReads()
+{
+    case "$1" in
+        fasta) grep -c '^>' "$outDir/reads.fasta" ;;
+        fastq) echo $(( $(wc -l < "$outDir/reads.fastq") / 4 )) ;;
+        bam) samtools view -c "$bamInput" ;;
+    esac
+}
+
+OutputArgs()
+{
+    case "$1" in
+        sam) echo "--sam --out $2.sam" ;;
+        bam) echo "--bam --out $2.bam" ;;
+        m4) echo "-m 4 --out $2.m4" ;;
+    esac
+}
+
+ModeArgs()
+{
+    case "$1" in
+        default) echo "" ;;
+        concordant) echo "--concordant" ;;
+        noSplitSubreads) echo "--noSplitSubreads" ;;
+        useccs) echo "--useccs" ;;
+    esac
+}
+
+if [ "$bamInput" != "" ]; then
+    case " $inputFormats " in
+        *" bam "*) ;;
+        *) inputFormats="$inputFormats bam" ;;
+    esac
+fi
+
+results=$outDir/results.tsv
+printf "nproc\tinput\toutput\tmode\treads\tseconds\treads_per_sec\tpeak_rss_kb\tstatus\n" \
+    > "$results.raw"
+
+for input in $inputFormats; do
+    if [ "$input" == "bam" ] && [ "$bamInput" == "" ]; then
+        continue
+    fi
+    reads=$(CountReads "$input")
+    for output in $outputFormats; do
+        for mode in $modes; do
+            if [ "$input" != "bam" ] && { [ "$mode" == "concordant" ] || [ "$mode" == "useccs" ]; }; then
+                continue
+            fi
+            for nproc in $nprocList; do
+                name=$outDir/run.$input.$output.$mode.$nproc
+                status=ok
+                # shellcheck disable=SC2046
+                if ! "$TIME" -f "%e %M" -o "$name.time" \
+                    "$BLASR" "$(InputFile "$input")" "$reference" --nproc "$nproc" \
+                    $(OutputArgs "$output" "$name") $(ModeArgs "$mode") $extraArgs \
+                    > "$name.log" 2>&1; then
+                    status=failed
+                fi
+                read -r seconds rss < <(tail -n 1 "$name.time")
+                printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "$nproc" "$input" "$output" "$mode" \
+                    "$reads" "$seconds" "$rss" "$status" \
+                    | awk -F'\t' -v OFS='\t' '{
+                        rate = ($6 > 0) ? $5 / $6 : 0;
+                        print $1, $2, $3, $4, $5, $6, sprintf("%.2f", rate), $7, $8 }' \
+                    >> "$results.raw"
+            done
+        done
+    done
+done
+
+#
+# Scaling efficiency against the smallest thread count of each
+# input/output/mode combination.
+#
+awk -F'\t' -v OFS='\t' -v minEfficiency="$minEfficiency" '
+    NR == 1 {
+        print $1, $2, $3, $4, $5, $6, $7, $8, "scaling_efficiency", $9;
+        next
+    }
+    {
+        row[NR] = $0;
+        key = $2 SUBSEP $3 SUBSEP $4;
+        if ($9 == "ok" && (!(key in baseN) || $1 < baseN[key])) {
+            baseN[key] = $1;
+            baseRate[key] = $7;
+        }
+    }
+    END {
+        failed = 0;
+        for (i = 2; i <= NR; i++) {
+            split(row[i], f, "\t");
+            key = f[2] SUBSEP f[3] SUBSEP f[4];
+            efficiency = "NA";
+            if (f[9] == "ok" && (key in baseN) && baseRate[key] > 0) {
+                efficiency = sprintf("%.3f", (f[7] / baseRate[key]) / (f[1] / baseN[key]));
+                if (minEfficiency != "" && efficiency + 0 < minEfficiency + 0) {
+                    failed = 1;
+                }
+            }
+            print f[1], f[2], f[3], f[4], f[5], f[6], f[7], f[8], efficiency, f[9];
+        }
+        exit failed;
+    }' "$results.raw" > "$results" && efficient=1 || efficient=0
+
+cat "$results"
+echo "Results written to $results" >&2
+if [ $efficient -eq 0 ]; then
+    echo "ERROR, scaling efficiency below $minEfficiency." >&2
+    exit 1
+fi
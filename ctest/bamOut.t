@@ -20,3 +20,105 @@ Test if bam cigar strings are correct
   $ head -2 $TMP1.bam_in_soft |cut -f 6
   25=1I28=1I41=1I5=1D6=1X12=1I15=1I2=1I16=1D10=1I11=1I74=1D12=1D7=3I4=1I6=1D1=2D14=1D16=1I8=1D4=1D5=1D20=1I3=1I10=1I37=1I13=1I25=1I15=1I7=1I11=1I3=2I1=1I16=1I6=1I8=1I11=1X1=1I5=1I56=1I17=
   28=1D7=1I1=1I9=2I12=1I3=1D13=1I15=1I2=1X49=1I19=1I14=1I5=1D17=1D20=1D86=1I21=1I9=1I24=1I6=1I1=1I2=1D11=1D4=1D3=1D31=1D6=1I6=1I9=1I57=2I24=1I26=1I8=1I43=1S
+
+Test --sorted, spilling a sorted run every few records, gives the same records in coordinate order with an index
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $DATDIR/lambda_ref.fasta --bam --out $OUTDIR/tiny_bam_in_sorted.bam --clipping soft --sorted --sortMemory 1 --tempDirectory $OUTDIR
+  [INFO]* (glob)
+  [INFO]* (glob)
+
+  $ $SAMTOOLS_EXE view -H $OUTDIR/tiny_bam_in_sorted.bam | grep -c 'SO:coordinate'
+  1
+  $ $SAMTOOLS_EXE view $OUTDIR/tiny_bam_in_sorted.bam | cut -f 3,4 > $TMP1.sorted_pos
+  $ sort -s -k1,1 -k2,2n $TMP1.sorted_pos | diff - $TMP1.sorted_pos
+  $ $SAMTOOLS_EXE view $OUTDIR/tiny_bam_in_soft.bam | sort > $TMP1.unsorted_records
+  $ $SAMTOOLS_EXE view $OUTDIR/tiny_bam_in_sorted.bam | sort | diff - $TMP1.unsorted_records
+  $ test -f $OUTDIR/tiny_bam_in_sorted.bam.bai && echo indexed
+  indexed
+  $ $SAMTOOLS_EXE idxstats $OUTDIR/tiny_bam_in_sorted.bam | awk 'NR == 1 { print ($3 > 0) }'
+  1
+  $ ls $OUTDIR | grep -c 'sort\..*\.bam$'
+  0
+  [1]
+
+Test --sorted requires SAM or BAM output
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $DATDIR/lambda_ref.fasta -m 4 --sorted 2>/dev/null
+  ERROR, --sorted requires --bam or --sam.
+  [1]
+
+Test --pbi writes the PacBio index alongside the BAM
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $DATDIR/lambda_ref.fasta --bam --out $OUTDIR/tiny_bam_in_pbi.bam --clipping soft --pbi
+  [INFO]* (glob)
+  [INFO]* (glob)
+
+  $ test -s $OUTDIR/tiny_bam_in_pbi.bam.pbi && echo indexed
+  indexed
+  $ $SAMTOOLS_EXE view $OUTDIR/tiny_bam_in_pbi.bam | sed -n '6,$p' | diff - $TMP1.bam_in_soft
+
+Test --pbi requires BAM output
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $DATDIR/lambda_ref.fasta --sam --out $TMP1.sam --pbi 2>/dev/null
+  ERROR, --pbi requires --bam.
+  [1]
+
+Test --outputByThread merges per-thread BAM files into one, and --mergeInZmwOrder restores input order
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $DATDIR/lambda_ref.fasta --bam --out $OUTDIR/tiny_bam_in_bythread.bam --clipping soft --nproc 4 --outputByThread
+  [INFO]* (glob)
+  [INFO]* (glob)
+
+  $ $SAMTOOLS_EXE view $OUTDIR/tiny_bam_in_bythread.bam | sort | diff - $TMP1.unsorted_records
+  $ ls $OUTDIR | grep -c 'tiny_bam_in_bythread.bam.[0-9]'
+  0
+  [1]
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $DATDIR/lambda_ref.fasta --bam --out $OUTDIR/tiny_bam_in_zmworder.bam --clipping soft --nproc 4 --outputByThread --mergeInZmwOrder
+  [INFO]* (glob)
+  [INFO]* (glob)
+
+  $ $SAMTOOLS_EXE view $OUTDIR/tiny_bam_in_zmworder.bam | sed -n '6,$p' | diff - $TMP1.bam_in_soft
+
+Test SAM output to a .gz file is compressed, also when merged from per-thread files
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $DATDIR/lambda_ref.fasta --sam --out $OUTDIR/tiny_bam_in_soft.sam.gz --clipping soft
+  [INFO]* (glob)
+  [INFO]* (glob)
+  $ gzip -dc $OUTDIR/tiny_bam_in_soft.sam.gz | grep -v '^@' | sed -n '6,$p' | diff - $TMP1.bam_in_soft
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $DATDIR/lambda_ref.fasta --sam --out $OUTDIR/tiny_bam_in_bythread.sam.gz --clipping soft --nproc 4 --outputByThread
+  [INFO]* (glob)
+  [INFO]* (glob)
+  $ gzip -dc $OUTDIR/tiny_bam_in_bythread.sam.gz | grep -v '^@' | sort | diff - $TMP1.unsorted_records
+
+Test --outputByThread keeps the alignments of every query file, under one header
+  $ sed "s|^\([^/]\)|$DATDIR/test_bam/\1|" $DATDIR/test_bam/tiny_bam.fofn > $TMP1.once.fofn
+  $ cat $TMP1.once.fofn $TMP1.once.fofn > $OUTDIR/tiny_bam_twice.fofn
+  $ sort $TMP1.unsorted_records $TMP1.unsorted_records > $TMP1.twice_records
+  $ $BLASR_EXE $OUTDIR/tiny_bam_twice.fofn $DATDIR/lambda_ref.fasta --bam --out $OUTDIR/tiny_bam_twice_bythread.bam --clipping soft --nproc 4 --outputByThread 2>/dev/null
+  $ $SAMTOOLS_EXE view $OUTDIR/tiny_bam_twice_bythread.bam | sort | diff - $TMP1.twice_records
+  $ $BLASR_EXE $OUTDIR/tiny_bam_twice.fofn $DATDIR/lambda_ref.fasta --sam --out $OUTDIR/tiny_bam_twice_bythread.sam --clipping soft --nproc 4 --outputByThread 2>/dev/null
+  $ grep -v '^@' $OUTDIR/tiny_bam_twice_bythread.sam | sort | diff - $TMP1.twice_records
+  $ awk '/^@/ && body { n++ } !/^@/ { body = 1 } END { print n + 0 }' $OUTDIR/tiny_bam_twice_bythread.sam
+  0
+
+Test --splitByRef writes one BAM per contig, listed in out.split, plus unmapped records
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $DATDIR/lambda_ref.fasta --bam --out $OUTDIR/tiny_bam_in_split.bam --clipping soft --nproc 4 --splitByRef
+  [INFO]* (glob)
+  [INFO]* (glob)
+  $ cut -f 1 $OUTDIR/tiny_bam_in_split.bam.split | sort -u | wc -l | tr -d ' '
+  1
+  $ for f in $(cut -f 1 $OUTDIR/tiny_bam_in_split.bam.split | sort -u) $OUTDIR/tiny_bam_in_split.unmapped.bam; do $SAMTOOLS_EXE view $f; done | sort | diff - $TMP1.unsorted_records
+
+Test --splitByRef keeps file names apart when contig names only differ in unsafe characters
+  $ awk 'NR > 1 { s = s $0 } END { n = int(length(s) / 3); print ">lambda:a\n" substr(s, 1, n) "\n>lambda/a\n" substr(s, n + 1, n) "\n>unmapped\n" substr(s, 2 * n + 1) }' $DATDIR/lambda_ref.fasta > $OUTDIR/split_names.fasta
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/split_names.fasta --bam --out $OUTDIR/split_names.bam --splitByRef --splitMaxFiles 3 2>/dev/null
+  $ sed "s|^$OUTDIR/||" $OUTDIR/split_names.bam.split
+  split_names.lambda_a.bam	lambda:a (esc)
+  split_names.lambda_a_2.bam	lambda/a (esc)
+  split_names.unmapped_2.bam	unmapped (esc)
+  $ ls $OUTDIR/split_names.unmapped.bam
+  */split_names.unmapped.bam (glob)
+
+Test --splitByRef writes at most --splitMaxFiles files for mapped records
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/split_names.fasta --bam --out $OUTDIR/split_max.bam --splitByRef --splitMaxFiles 2 2>/dev/null
+  $ cut -f 1 $OUTDIR/split_max.bam.split | sort -u | wc -l | tr -d ' '
+  2
+
+Test --splitByRef requires --out
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $DATDIR/lambda_ref.fasta -m 4 --splitByRef 2>/dev/null
+  ERROR, --splitByRef requires --out.
+  [1]
@@ -45,3 +45,19 @@ and then check if output is determined.
   0
   $ sort $outfile > $outfile.tmp && mv $outfile.tmp $outfile
   $ diff $outfile $stdfile
+
+Per-thread m4 output is merged into the same alignments, in input order with --mergeInZmwOrder
+  $ $BLASR_EXE $infile  $DATDIR/lambda_ref.fasta -m 4 --out $outfile.bythread --nproc 4 --outputByThread && echo $?
+  [INFO]* (glob)
+  [INFO]* (glob)
+  0
+  $ sort $outfile.bythread | diff - $stdfile
+  $ $BLASR_EXE $infile  $DATDIR/lambda_ref.fasta -m 4 --out $outfile.ordered && echo $?
+  [INFO]* (glob)
+  [INFO]* (glob)
+  0
+  $ $BLASR_EXE $infile  $DATDIR/lambda_ref.fasta -m 4 --out $outfile.zmworder --nproc 4 --outputByThread --mergeInZmwOrder && echo $?
+  [INFO]* (glob)
+  [INFO]* (glob)
+  0
+  $ diff $outfile.zmworder $outfile.ordered
@@ -31,3 +31,20 @@ Test blasr with -m 0 ~ 5
   [INFO]* (glob)
   [INFO]* (glob)
   $ diff $OUTDIR/read.m4 $STDDIR/read.m4
+
+Test .gz output and --compressOutput write BGZF that decompresses to the plain output
+  $ $BLASR_EXE $DATDIR/read.fasta  $DATDIR/ref.fasta -m 4 --out $OUTDIR/read.m4.gz --compressThreads 3
+  [INFO]* (glob)
+  [INFO]* (glob)
+  $ gzip -dc $OUTDIR/read.m4.gz | diff - $STDDIR/read.m4
+  $ $BLASR_EXE $DATDIR/read.fasta  $DATDIR/ref.fasta -m 4 --out $OUTDIR/read.m4.bgzf --compressOutput --unaligned $OUTDIR/read.unaligned.gz
+  [INFO]* (glob)
+  [INFO]* (glob)
+  $ gzip -dc $OUTDIR/read.m4.bgzf | diff - $STDDIR/read.m4
+  $ gzip -t $OUTDIR/read.unaligned.gz && echo ok
+  ok
+
+Test --compressOutput requires an output file
+  $ $BLASR_EXE $DATDIR/read.fasta  $DATDIR/ref.fasta -m 4 --compressOutput 2>/dev/null
+  ERROR, --compressOutput requires --out or --unaligned.
+  [1]
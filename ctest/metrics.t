@@ -0,0 +1,125 @@
+Set up
+  $ mkdir -p $OUTDIR
+
+Test --latencyMetrics writes one row per mapping stage.
+  $ O=$OUTDIR/latency.tsv
+  $ rm -f $O
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --holeNumbers 1--200 --nproc 4 --latencyMetrics $O > $TMP1
+  [INFO]* (glob)
+  [INFO]* (glob)
+  $ echo $?
+  0
+  $ cut -f 1 $O
+  stage
+  readerWait
+  mapToGenome
+  sortMatchPosList
+  findMaxIncreasingInterval
+  alignIntervals
+  refineAlignments
+  storeMapQVs
+  mapRead
+  writerWait
+  printAlignments
+  $ awk -F'\t' 'NR > 1 && $1 == "mapRead" { print ($2 > 0) }' $O
+  1
+
+Test --statusFile is left with the final totals when mapping ends.
+  $ S=$OUTDIR/status.json
+  $ rm -f $S $S.tmp
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --holeNumbers 1--200 --nproc 4 --statusFile $S > $TMP1 2>/dev/null
+  $ echo $?
+  0
+  $ grep -c state $S ; grep '"state"' $S
+  1
+    "state": "finished",
+  $ test -f $S.tmp || echo no tmp
+  no tmp
+
+Test --metrics reports semaphore contention per semaphore and thread.
+  $ M=$OUTDIR/metrics.txt
+  $ rm -f $M
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --holeNumbers 1--200 --nproc 4 --metrics $M > $TMP1 2>/dev/null
+  $ echo $?
+  0
+  $ grep -A 5 '^semaphore' $M | cut -f 1,2
+  semaphore\tthread (esc)
+  reader\tall (esc)
+  reader\t0 (esc)
+  reader\t1 (esc)
+  reader\t2 (esc)
+  reader\t3 (esc)
+  $ awk -F'\t' '$1 == "reader" && $2 == "all" { print ($3 > 0) }' $M
+  1
+
+Test --metrics starts with the time spent in each startup phase.
+  $ cut -f 1 $M | sed -n '1,/^total$/p'
+  startup_phase
+  setup
+  readGenome
+  buildSuffixArray
+  buildCountTable
+  titleTable
+  openOutput
+  openReads
+  total
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --holeNumbers 1--200 --metrics $M 2>&1 >/dev/null | grep -c 'startup'
+  9
+
+Test --traceFile writes one JSON object per subread, and --traceSample 0 none.
+  $ T=$OUTDIR/trace.jsonl
+  $ rm -f $T
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --holeNumbers 1--200 --nproc 4 --traceFile $T > $TMP1 2>/dev/null
+  $ echo $?
+  0
+  $ test -s $T && grep -vc '^{"read":".*"wallMicroseconds":[0-9]*}$' $T
+  0
+  [1]
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --holeNumbers 1--200 --nproc 4 --traceFile $T --traceSample 0 > $TMP1 2>/dev/null
+  $ wc -l < $T | tr -d ' '
+  0
+
+Test --clusters is buffered per thread without losing lines, and --debugSample 0 writes only the header.
+  $ C=$OUTDIR/clusters.txt
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --holeNumbers 1--200 --clusters $C > $TMP1 2>/dev/null
+  $ sed 1d $C | sort > $TMP2
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --holeNumbers 1--200 --nproc 4 --clusters $C > $TMP1 2>/dev/null
+  $ sed 1d $C | sort | diff - $TMP2
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --holeNumbers 1--200 --nproc 4 --clusters $C --debugSample 0 > $TMP1 2>/dev/null
+  $ wc -l < $C | tr -d ' '
+  1
+
+Test --profileThread is rejected without --profile.
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --profileThread 0 2>/dev/null
+  ERROR, --profileThread and --profileOnSignal require --profile.
+  [1]
+
+Test --memoryReport lists shared structures and per-thread buffers.
+  $ R=$OUTDIR/memory.tsv
+  $ rm -f $R
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --holeNumbers 1--200 --nproc 2 --memoryReport $R > $TMP1 2>/dev/null
+  $ echo $?
+  0
+  $ awk -F'\t' '$2 == "all" { print $1 }' $R | grep -v 'Mat$\|List$\|Set$\|Chain$\|Buffer$\|Bases$'
+  genome
+  seqdb
+  suffixArray
+  lookupTable
+  countTable
+  alignmentCandidates
+  threadBuffers
+  shared
+  processResident
+  $ awk -F'\t' '$1 == "genome" { print ($3 > 0) }' $R
+  1
+
+Test --estimateMemory prints the shared structures without mapping.
+  $ $BLASR_EXE $DATDIR/lambda_bax.fofn $DATDIR/lambda_ref.fasta --estimateMemory 2>/dev/null | cut -f 1
+  structure
+  genome
+  seqdb
+  suffixArray
+  suffixArrayBuild
+  lookupTable
+  countTable
+  total
@@ -0,0 +1,43 @@
+Set up: a reference of two copies of lambda, so that every read maps equally well to both
+  $ mkdir -p $OUTDIR
+  $ awk 'NR > 1 { s = s $0 } END { print ">lambdaA\n" s "\n>lambdaB\n" s }' $DATDIR/lambda_ref.fasta > $OUTDIR/lambda_twice.fasta
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/lambda_twice.fasta --sam --out $OUTDIR/restrict_all.sam 2>/dev/null
+  $ grep -v '^@' $OUTDIR/restrict_all.sam | awk '$3 == "lambdaB" { print $1, $3, $4, int($2 / 16) % 2 }' | sort > $TMP1.lambdaB
+  $ test -s $TMP1.lambdaB && echo $?
+  0
+
+Test --restrictTo with a contig list reports the alignments to the listed contig only
+  $ printf '# targets\n\nlambdaB\n' > $OUTDIR/restrict_contigs.txt
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/lambda_twice.fasta --sam --out $OUTDIR/restrict_contigs.sam --restrictTo $OUTDIR/restrict_contigs.txt 2>/dev/null
+  $ grep -v '^@' $OUTDIR/restrict_contigs.sam | awk '$3 != "*" { print $1, $3, $4, int($2 / 16) % 2 }' | sort | diff - $TMP1.lambdaB
+
+Test --restrictTo with BED regions reports a reverse-strand hit inside a region at its position
+  $ grep -v '^@' $OUTDIR/restrict_all.sam | awk '$3 == "lambdaB" && int($2 / 16) % 2 == 1 { print $1, $4, length($10); exit }' > $TMP1.hit
+  $ cut -d ' ' -f 1,2 $TMP1.hit > $TMP1.reverse
+  $ awk '{ print "lambdaB", $2 - 1, $2 - 1 + $3 }' $TMP1.hit > $OUTDIR/restrict_regions.bed
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/lambda_twice.fasta --sam --out $OUTDIR/restrict_regions.sam --restrictTo $OUTDIR/restrict_regions.bed 2>/dev/null
+  $ grep -v '^@' $OUTDIR/restrict_regions.sam | awk -v name=$(cut -d ' ' -f 1 $TMP1.reverse) '$1 == name { print $1, $4 }' | diff - $TMP1.reverse
+  $ grep -v '^@' $OUTDIR/restrict_regions.sam | awk -v name=$(cut -d ' ' -f 1 $TMP1.reverse) '$1 == name { print $3, int($2 / 16) % 2 }'
+  lambdaB 1
+
+No alignment outside the region is reported
+  $ grep -v '^@' $OUTDIR/restrict_regions.sam | awk -v end=$(cut -d ' ' -f 3 $OUTDIR/restrict_regions.bed) '$3 != "*" && ($3 != "lambdaB" || $4 > end)' | wc -l | tr -d ' '
+  0
+
+Test --offTargetMapQV lowers the mapQV of on-target alignments that also map off target
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/lambda_twice.fasta --sam --out $OUTDIR/restrict_mapqv.sam --restrictTo $OUTDIR/restrict_contigs.txt --offTargetMapQV 2>/dev/null
+  $ grep -v '^@' $OUTDIR/restrict_mapqv.sam | awk '$3 != "*" { print $1, $3, $4, int($2 / 16) % 2 }' | sort | diff - $TMP1.lambdaB
+  $ grep -hv '^@' $OUTDIR/restrict_contigs.sam $OUTDIR/restrict_mapqv.sam | awk '$3 != "*" { n[$1]++; if (n[$1] == 1) { on[$1] = $5 } else if ($5 >= on[$1]) { bad++ } } END { print bad + 0 }'
+  0
+
+Test --restrictTo rejects a file that lists no targets
+  $ printf '# no targets\n\ntrack name=panel\n' > $OUTDIR/restrict_empty.txt
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/lambda_twice.fasta --sam --out $OUTDIR/restrict_empty.sam --restrictTo $OUTDIR/restrict_empty.txt 2>/dev/null
+  ERROR, */restrict_empty.txt lists no contigs or regions. (glob)
+  [1]
+
+Test --restrictTo rejects contigs that are not in the reference
+  $ printf 'lambdaC\n' > $OUTDIR/restrict_unknown.txt
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/lambda_twice.fasta --sam --out $OUTDIR/restrict_unknown.sam --restrictTo $OUTDIR/restrict_unknown.txt 2>/dev/null
+  ERROR, */restrict_unknown.txt:1: lambdaC is not a contig of the reference. (glob)
+  [1]
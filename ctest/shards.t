@@ -0,0 +1,22 @@
+Set up: a reference of two copies of lambda, and its suffix array in one shard per contig
+  $ mkdir -p $OUTDIR
+  $ awk 'NR > 1 { s = s $0 } END { print ">lambdaA\n" s "\n>lambdaB\n" s }' $DATDIR/lambda_ref.fasta > $OUTDIR/shards_lambda_twice.fasta
+  $ $SAWRITER_EXE $OUTDIR/shards_lambda_twice.fasta.sa $OUTDIR/shards_lambda_twice.fasta
+  $ $SAWRITER_EXE $OUTDIR/shards_lambda_twice.fasta.sa $OUTDIR/shards_lambda_twice.fasta -shards 2
+  $ awk 'NR > 1 { print $2, $3 }' $OUTDIR/shards_lambda_twice.fasta.sa.shards
+  0 1
+  1 1
+  $ ls $OUTDIR/shards_lambda_twice.fasta.sa.0.ctab $OUTDIR/shards_lambda_twice.fasta.sa.1.ctab | wc -l | tr -d ' '
+  2
+
+Test that mapping to the shards, one loaded at a time, reports the alignments and mapQVs of the whole suffix array
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/shards_lambda_twice.fasta --sa $OUTDIR/shards_lambda_twice.fasta.sa --bestn 10 --sam --out $OUTDIR/shards_whole.sam 2>/dev/null
+  $ grep -v '^@' $OUTDIR/shards_whole.sam | awk '$3 != "*" { print $1, $3, $4, int($2 / 16) % 2, $5 }' | sort > $TMP1.whole
+  $ test -s $TMP1.whole && echo $?
+  0
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/shards_lambda_twice.fasta --sa $OUTDIR/shards_lambda_twice.fasta.sa.shards --bestn 10 --sam --out $OUTDIR/shards_one.sam 2>/dev/null
+  $ grep -v '^@' $OUTDIR/shards_one.sam | awk '$3 != "*" { print $1, $3, $4, int($2 / 16) % 2, $5 }' | sort | diff - $TMP1.whole
+
+Test that threads mapping small batches step through the shards together
+  $ $BLASR_EXE $DATDIR/test_bam/tiny_bam.fofn $OUTDIR/shards_lambda_twice.fasta --sa $OUTDIR/shards_lambda_twice.fasta.sa.shards --bestn 10 --nproc 4 --shardBatchSize 3 --sam --out $OUTDIR/shards_threads.sam 2>/dev/null
+  $ grep -v '^@' $OUTDIR/shards_threads.sam | awk '$3 != "*" { print $1, $3, $4, int($2 / 16) % 2, $5 }' | sort | diff - $TMP1.whole
@@ -23,3 +23,34 @@ Test dataset.xml as input
   m121004_000921_42130_c100440700060000001523060402151341_s1_p0/13/327_954
   m121004_000921_42130_c100440700060000001523060402151341_s1_p0/13/1004_1580
   m121004_000921_42130_c100440700060000001523060402151341_s1_p0/13/1625_2202
+
+Test unaligned reads are written as FASTQ by extension, and as the input BAM records with --unaligned out.bam
+  $ $BLASR_EXE $DATDIR/ecoli_subset.fasta $DATDIR/ecoli_reference.fasta --unaligned $OUTDIR/unaligned.fastq --nproc 4 1>/dev/null
+  [INFO]* (glob)
+  [INFO]* (glob)
+  $ awk 'NR % 4 == 1' $OUTDIR/unaligned.fastq | cut -c 2- | sort > $TMP1.fastq_names
+  $ sort $OUTDIR/unaligned.txt | diff - $TMP1.fastq_names
+  $ awk 'NR % 4 == 3' $OUTDIR/unaligned.fastq | sort -u
+  +
+  $ $BLASR_EXE $DATDIR/test_dataset/chunking.subreadset.xml $DATDIR/ecoli_reference.fasta --unaligned $OUTDIR/unaligned.bam --nproc 4 1>/dev/null
+  [INFO]* (glob)
+  [INFO]* (glob)
+  $ $SAMTOOLS_EXE view $OUTDIR/unaligned.bam | awk '{ print ($2 == 4) }' | sort -u
+  1
+  $ $SAMTOOLS_EXE view $OUTDIR/unaligned.bam | awk '{ print ($10 != "*" && length($10) == length($11)) }' | sort -u
+  1
+  $ $SAMTOOLS_EXE view $OUTDIR/unaligned.bam | awk '!/\tzm:i:[0-9]+/' | wc -l | tr -d ' '
+  0
+
+Test --noPrintUnalignedSeqs drops SEQ, QUAL and per-base tags from unaligned BAM records, keeping per-read tags
+  $ $BLASR_EXE $DATDIR/test_dataset/chunking.subreadset.xml $DATDIR/ecoli_reference.fasta --unaligned $OUTDIR/unaligned_noseq.bam --noPrintUnalignedSeqs --nproc 4 1>/dev/null
+  [INFO]* (glob)
+  [INFO]* (glob)
+  $ $SAMTOOLS_EXE view $OUTDIR/unaligned_noseq.bam | awk '{ print $2, $10, $11 }' | sort -u
+  4 * *
+  $ $SAMTOOLS_EXE view $OUTDIR/unaligned_noseq.bam | awk '/\t(dq|dt|iq|mq|sq|st|ip|pw):/' | wc -l | tr -d ' '
+  0
+  $ $SAMTOOLS_EXE view $OUTDIR/unaligned_noseq.bam | awk '!/\tzm:i:[0-9]+/ || !/\tqs:i:[0-9]+/' | wc -l | tr -d ' '
+  0
+  $ $SAMTOOLS_EXE view $OUTDIR/unaligned.bam | cut -f 1 | sort > $TMP1.unaligned_names
+  $ $SAMTOOLS_EXE view $OUTDIR/unaligned_noseq.bam | cut -f 1 | sort | diff - $TMP1.unaligned_names
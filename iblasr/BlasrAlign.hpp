@@ -13,6 +13,23 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
              MappingMetrics &metrics, std::vector<T_AlignmentCandidate *> &alignmentPtrs,
              MappingBuffers &mappingBuffers, MappingIPC *mapData, MappingSemaphores &semaphores);
 
+template <typename T_Sequence, typename T_RefSequence, typename T_SuffixArray,
+          typename T_TupleCountTable>
+void MapReadToIndex(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome,
+                    T_SuffixArray &sarray, BWT &bwt, SeqBoundaryFtr<FASTQSequence> &seqBoundary,
+                    T_TupleCountTable &ct, SequenceIndexDatabase<FASTQSequence> &seqdb,
+                    const ContigIndex &contigIndex, int firstContig, MappingParameters &params,
+                    MappingMetrics &metrics, std::vector<T_AlignmentCandidate *> &alignmentPtrs,
+                    MappingBuffers &mappingBuffers, MappingIPC *mapData,
+                    MappingSemaphores &semaphores);
+
+template <typename T_RefSequence, typename T_TupleCountTable>
+void MapShardedReads(ShardedReads &shardedReads, ReferenceShard &shard, T_RefSequence &genome,
+                     BWT &bwt, T_TupleCountTable &ct, SequenceIndexDatabase<FASTQSequence> &seqdb,
+                     MappingParameters &params, MappingMetrics &metrics,
+                     MappingBuffers &mappingBuffers, MappingIPC *mapData,
+                     MappingSemaphores &semaphores);
+
 template <typename T_Sequence>
 void MapRead(T_Sequence &read, T_Sequence &readRC,
              std::vector<T_AlignmentCandidate *> &alignmentPtrs, MappingBuffers &mappingBuffers,
@@ -27,7 +44,7 @@ template <typename T_TargetSequence, typename T_QuerySequence, typename TDBSeque
 void AlignIntervals(T_TargetSequence &genome, T_QuerySequence &read, T_QuerySequence &rcRead,
                     WeightedIntervalSet &weightedIntervals, int mutationCostMatrix[][5], int ins,
                     int del, int sdpTupleSize, int useSeqDB,
-                    SequenceIndexDatabase<TDBSequence> &seqDB,
+                    SequenceIndexDatabase<TDBSequence> &seqDB, const ContigIndex &contigIndex,
                     std::vector<T_AlignmentCandidate *> &alignments, MappingParameters &params,
                     MappingBuffers &mappingBuffers, int procId = 0);
 
@@ -40,7 +57,7 @@ void PairwiseLocalAlign(T_Sequence &qSeq, T_RefSequence &tSeq, int k, MappingPar
 // by flankSize bases. Update alignment->tAlignedSeqPos,
 // alignment->tAlignedSeqLength and alignment->tAlignedSeq.
 void FlankTAlignedSeq(T_AlignmentCandidate *alignment, SequenceIndexDatabase<FASTQSequence> &seqdb,
-                      DNASequence &genome, int flankSize);
+                      const ContigIndex &contigIndex, DNASequence &genome, int flankSize);
 
 // Align a subread of a SMRT sequence to target sequence of an alignment.
 // Input:
@@ -10,6 +10,26 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
              SequenceIndexDatabase<FASTQSequence> &seqdb, MappingParameters &params,
              MappingMetrics &metrics, std::vector<T_AlignmentCandidate *> &alignmentPtrs,
              MappingBuffers &mappingBuffers, MappingIPC *mapData, MappingSemaphores &semaphores)
+{
+    if (mapData->shardedReadsPtr != NULL) {
+        // Mapped by MapShardedReads; the retry is the second search of a read.
+        mapData->shardedReadsPtr->Take(mapData->trace.sensitiveRetry, read, readRC, alignmentPtrs);
+    } else {
+        MapReadToIndex(read, readRC, genome, sarray, bwt, seqBoundary, ct, seqdb,
+                       *mapData->contigIndexPtr, 0, params, metrics, alignmentPtrs, mappingBuffers,
+                       mapData, semaphores);
+    }
+}
+
+template <typename T_Sequence, typename T_RefSequence, typename T_SuffixArray,
+          typename T_TupleCountTable>
+void MapReadToIndex(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome,
+                    T_SuffixArray &sarray, BWT &bwt, SeqBoundaryFtr<FASTQSequence> &seqBoundary,
+                    T_TupleCountTable &ct, SequenceIndexDatabase<FASTQSequence> &seqdb,
+                    const ContigIndex &contigIndex, int firstContig, MappingParameters &params,
+                    MappingMetrics &metrics, std::vector<T_AlignmentCandidate *> &alignmentPtrs,
+                    MappingBuffers &mappingBuffers, MappingIPC *mapData,
+                    MappingSemaphores &semaphores)
 {
     bool matchFound;
     WeightedIntervalSet topIntervals(params.nCandidates);
@@ -18,6 +38,7 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
     (void)(rcNumKeysMatched);
     int expand = params.minExpand;
     metrics.clocks.total.Tick();
+    mapData->histograms.Tick(MappingStage::MapRead);
     int forwardNumBasesMatched = 0, reverseNumBasesMatched = 0;
     do {
         matchFound = false;
@@ -28,9 +49,13 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
         params.anchorParameters.expand = expand;
 
         metrics.clocks.mapToGenome.Tick();
+        mapData->histograms.Tick(MappingStage::MapToGenome);
 
         if (params.useSuffixArray) {
-            params.anchorParameters.lcpBoundsOutPtr = mapData->lcpBoundsOutPtr;
+            params.anchorParameters.lcpBoundsOutPtr = NULL;
+            if (mapData->lcpBoundsOutPtr != NULL and mapData->sideOutputSampled) {
+                params.anchorParameters.lcpBoundsOutPtr = &mapData->lcpBoundsOutput.Out();
+            }
             numKeysMatched = MapReadToGenome(genome, sarray, read, params.lookupTableLength,
                                              mappingBuffers.matchPosList, params.anchorParameters);
 
@@ -44,6 +69,9 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
                     MapReadToGenome(genome, sarray, readRC, params.lookupTableLength,
                                     mappingBuffers.rcMatchPosList, params.anchorParameters);
             }
+            if (params.anchorParameters.lcpBoundsOutPtr != NULL) {
+                mapData->lcpBoundsOutput.EndRecord();
+            }
         } else if (params.useBwt) {
             numKeysMatched = MapReadToGenome(bwt, read, read.SubreadStart(), read.SubreadEnd(),
                                              mappingBuffers.matchPosList, params.anchorParameters,
@@ -55,43 +83,45 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
             }
         }
 
+        //
+        // With --restrictTo, off-target anchors are dropped here so that
+        // their candidates are neither chained nor aligned, unless they
+        // are kept to compete for mapQV.
+        //
+        if (mapData->restrictionPtr != NULL and not params.offTargetMapQV) {
+            mapData->restrictionPtr->FilterAnchors(mappingBuffers.matchPosList, seqdb, contigIndex,
+                                                   firstContig);
+            mapData->restrictionPtr->FilterAnchors(mappingBuffers.rcMatchPosList, seqdb,
+                                                   contigIndex, firstContig);
+        }
+
         //
         // Look to see if only the anchors are printed.
-        if (params.anchorFileName != "") {
+        if (mapData->anchorOutput.IsOpen() and mapData->sideOutputSampled) {
             size_t i;
-            if (params.nProc > 1) {
-#ifdef __APPLE__
-                sem_wait(semaphores.writer);
-#else
-                sem_wait(&semaphores.writer);
-#endif
-            }
-            *mapData->anchorFilePtr << read.title << std::endl;
+            std::ostream &anchorOut = mapData->anchorOutput.Out();
+            anchorOut << read.title << '\n';
             for (i = 0; i < mappingBuffers.matchPosList.size(); i++) {
-                *mapData->anchorFilePtr << mappingBuffers.matchPosList[i] << std::endl;
+                anchorOut << mappingBuffers.matchPosList[i] << '\n';
             }
-            *mapData->anchorFilePtr << readRC.title << " (RC) " << std::endl;
+            anchorOut << readRC.title << " (RC) " << '\n';
             for (i = 0; i < mappingBuffers.rcMatchPosList.size(); i++) {
-                *mapData->anchorFilePtr << mappingBuffers.rcMatchPosList[i] << std::endl;
-            }
-
-            if (params.nProc > 1) {
-#ifdef __APPLE__
-                sem_post(semaphores.writer);
-#else
-                sem_post(&semaphores.writer);
-#endif
+                anchorOut << mappingBuffers.rcMatchPosList[i] << '\n';
             }
+            mapData->anchorOutput.EndRecord();
         }
 
         metrics.totalAnchors +=
             mappingBuffers.matchPosList.size() + mappingBuffers.rcMatchPosList.size();
         metrics.clocks.mapToGenome.Tock();
+        mapData->histograms.Tock(MappingStage::MapToGenome);
 
         metrics.clocks.sortMatchPosList.Tick();
+        mapData->histograms.Tick(MappingStage::SortMatchPosList);
         SortMatchPosList(mappingBuffers.matchPosList);
         SortMatchPosList(mappingBuffers.rcMatchPosList);
         metrics.clocks.sortMatchPosList.Tock();
+        mapData->histograms.Tock(MappingStage::SortMatchPosList);
 
         PValueWeightor lisPValue(read, genome, ct.tm, &ct);
         MultiplicityPValueWeightor lisPValueByWeight(genome);
@@ -126,6 +156,7 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
         }
 
         metrics.clocks.findMaxIncreasingInterval.Tick();
+        mapData->histograms.Tick(MappingStage::FindMaxIncreasingInterval);
 
         //
         // For now say that something that has a 50% chance of happening
@@ -245,6 +276,7 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
             mappingBuffers.revStrandClusterList.numAnchors.end());
 
         metrics.clocks.findMaxIncreasingInterval.Tock();
+        mapData->histograms.Tock(MappingStage::FindMaxIncreasingInterval);
 
         //
         // Print verbose output.
@@ -277,9 +309,10 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
             alignmentPtrs[i] = new T_AlignmentCandidate;
         }
         metrics.clocks.alignIntervals.Tick();
+        mapData->histograms.Tick(MappingStage::AlignIntervals);
         AlignIntervals(genome, read, readRC, topIntervals, SMRTDistanceMatrix, params.indel,
-                       params.indel, params.sdpTupleSize, params.useSeqDB, seqdb, alignmentPtrs,
-                       params, mappingBuffers, params.startRead);
+                       params.indel, params.sdpTupleSize, params.useSeqDB, seqdb, contigIndex,
+                       alignmentPtrs, params, mappingBuffers, params.startRead);
 
         /*    std::cout << read.title << std::endl;
               for (i = 0; i < alignmentPtrs.size(); i++) {
@@ -290,6 +323,17 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
 
         std::sort(alignmentPtrs.begin(), alignmentPtrs.end(), SortAlignmentPointersByScore());
         metrics.clocks.alignIntervals.Tock();
+        mapData->histograms.Tock(MappingStage::AlignIntervals);
+
+        if (mapData->trace.active) {
+            std::uint64_t expansionCells = 0;
+            for (i = 0; i < alignmentPtrs.size(); i++) {
+                expansionCells += alignmentPtrs[i]->nCells;
+            }
+            mapData->trace.AddExpansion(expand, mappingBuffers.matchPosList.size(),
+                                        mappingBuffers.rcMatchPosList.size(), topIntervals.size(),
+                                        expansionCells);
+        }
 
         //
         // Evalutate the matches that are found for 'good enough'.
@@ -321,6 +365,7 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
         ++expand;
     } while (expand <= params.maxExpand and matchFound == false);
     metrics.clocks.total.Tock();
+    mapData->histograms.Tock(MappingStage::MapRead);
     UInt i;
     int totalCells = 0;
     for (i = 0; i < alignmentPtrs.size(); i++) {
@@ -332,6 +377,8 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
         totalBases += alignmentPtrs[i]->qLength;
     }
     metrics.clocks.AddBases(totalBases);
+    MappingThreadProgress::Add(mapData->progress.alignedBases, totalBases);
+    MappingThreadProgress::Add(mapData->progress.dpCells, totalCells);
     //
     //  Some of the alignments are to spurious regions. Delete the
     //  references that have too small of a score.
@@ -361,9 +408,16 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
     // of an alignment and the alignment score.
     //
     if (params.refineAlignments) {
+        mapData->histograms.Tick(MappingStage::RefineAlignments);
         RefineAlignments(bothQueryStrands, genome, alignmentPtrs, params, mappingBuffers);
+        if (mapData->trace.active) {
+            for (i = 0; i < alignmentPtrs.size(); i++) {
+                mapData->trace.refineDpCells += alignmentPtrs[i]->nCells;
+            }
+        }
         RemoveLowQualityAlignments(read, alignmentPtrs, params);
         RemoveOverlappingAlignments(alignmentPtrs, params);
+        mapData->histograms.Tock(MappingStage::RefineAlignments);
     }
 
     //
@@ -460,30 +514,15 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
         for (i = 0; i < alignmentPtrs.size(); i++) {
             alignmentPtrs[i]->numSignificantClusters = numSignificantClusters;
         }
-        if (mapData->clusterFilePtr != NULL and topIntervals.size() > 0 and
-            alignmentPtrs.size() > 0) {
+        if (mapData->clusterOutput.IsOpen() and mapData->sideOutputSampled and
+            topIntervals.size() > 0 and alignmentPtrs.size() > 0) {
             WeightedIntervalSet::iterator intvIt = topIntervals.begin();
-            if (params.nProc > 1) {
-#ifdef __APPLE__
-                sem_wait(semaphores.hitCluster);
-#else
-                sem_wait(&semaphores.hitCluster);
-#endif
-            }
-
-            *mapData->clusterFilePtr
+            mapData->clusterOutput.Out()
                 << (*intvIt).size << " " << (*intvIt).pValue << " " << (*intvIt).nAnchors << " "
                 << read.length << " " << alignmentPtrs[0]->score << " "
                 << alignmentPtrs[0]->pctSimilarity << " "
-                << " " << minExpAnchors << " " << alignmentPtrs[0]->qAlignedSeq.length << std::endl;
-
-            if (params.nProc > 1) {
-#ifdef __APPLE__
-                sem_post(semaphores.hitCluster);
-#else
-                sem_post(&semaphores.hitCluster);
-#endif
-            }
+                << " " << minExpAnchors << " " << alignmentPtrs[0]->qAlignedSeq.length << '\n';
+            mapData->clusterOutput.EndRecord();
         }
     }
 
@@ -500,7 +539,47 @@ void MapRead(T_Sequence &read, T_Sequence &readRC, T_RefSequence &genome, T_Suff
         }
     }
 
-    AssignRefContigLocations(alignmentPtrs, seqdb, genome);
+    AssignRefContigLocations(alignmentPtrs, seqdb, contigIndex, genome);
+}
+
+//
+// Maps the reads of a thread's batch to the loaded 'shard' with the
+// shard's part of the reference, and merges the candidates into those
+// of each read.  The sensitive retry is searched for every read that
+// may need it, as whether it is needed depends on all of the shards.
+//
+template <typename T_RefSequence, typename T_TupleCountTable>
+void MapShardedReads(ShardedReads &shardedReads, ReferenceShard &shard, T_RefSequence &genome,
+                     BWT &bwt, T_TupleCountTable &ct, SequenceIndexDatabase<FASTQSequence> &seqdb,
+                     MappingParameters &params, MappingMetrics &metrics,
+                     MappingBuffers &mappingBuffers, MappingIPC *mapData,
+                     MappingSemaphores &semaphores)
+{
+    T_RefSequence shardGenome;
+    shardGenome.ShallowCopy(genome);
+    shardGenome.deleteOnExit = false;
+    shardGenome.seq = genome.seq + shard.start;
+    shardGenome.length = shard.length;
+    DNASuffixArray shardSarray;
+    shard.ShallowCopySuffixArray(shardSarray);
+    SequenceIndexDatabase<FASTQSequence> shardSeqdb;
+    shard.ShallowCopySequenceIndexDatabase(seqdb, shardSeqdb);
+    SeqBoundaryFtr<FASTQSequence> shardSeqBoundary(&shardSeqdb);
+    MappingParameters sensitiveParams = params;
+    sensitiveParams.SetForSensitivity();
+
+    std::vector<T_AlignmentCandidate *> alignmentPtrs;
+    for (std::size_t r = 0; r < shardedReads.Size(); r++) {
+        ShardedRead &sharded = shardedReads.Read(r);
+        mapData->sideOutputSampled = sharded.sideOutputSampled;
+        for (int retry = 0; retry < (sharded.withRetry ? 2 : 1); retry++) {
+            MapReadToIndex(sharded.read, sharded.readRC, shardGenome, shardSarray, bwt,
+                           shardSeqBoundary, ct, shardSeqdb, shard.contigIndex, shard.firstContig,
+                           retry ? sensitiveParams : params, metrics, alignmentPtrs, mappingBuffers,
+                           mapData, semaphores);
+            sharded.candidates[retry].Add(shard.firstContig, alignmentPtrs, params.nCandidates);
+        }
+    }
 }
 
 template <typename T_Sequence>
@@ -546,11 +625,22 @@ void MapRead(T_Sequence &read, T_Sequence &readRC,
                    semaphores);
 }
 
+//
+// Every interval ends with ComputeAlignmentStats over its final blocks,
+// which replaces all statistics and the score.  Computing them once the
+// anchors are aligned, before extension, only matters for the score
+// that the extension prints when verbose.
+//
+inline bool StatsNeededBeforeExtension(const MappingParameters &params)
+{
+    return params.verbosity > 0 and params.extendAlignments;
+}
+
 template <typename T_TargetSequence, typename T_QuerySequence, typename TDBSequence>
 void AlignIntervals(T_TargetSequence &genome, T_QuerySequence &read, T_QuerySequence &rcRead,
                     WeightedIntervalSet &weightedIntervals, int mutationCostMatrix[][5], int ins,
                     int del, int sdpTupleSize, int useSeqDB,
-                    SequenceIndexDatabase<TDBSequence> &seqDB,
+                    SequenceIndexDatabase<TDBSequence> &seqDB, const ContigIndex &contigIndex,
                     std::vector<T_AlignmentCandidate *> &alignments, MappingParameters &params,
                     MappingBuffers &mappingBuffers, int procId)
 {
@@ -666,7 +756,7 @@ void AlignIntervals(T_TargetSequence &genome, T_QuerySequence &read, T_QuerySequ
             // Modify bounds similarly for the matchIntervalEnd and the end
             // of a boundary.
             //
-            seqDBIndex = seqDB.SearchForIndex((*intvIt).start);
+            seqDBIndex = contigIndex.Find((*intvIt).start);
             intervalContigStartPos = seqDB.seqStartPos[seqDBIndex];
             if (intervalContigStartPos > matchIntervalStart) {
                 matchIntervalStart = intervalContigStartPos;
@@ -675,7 +765,7 @@ void AlignIntervals(T_TargetSequence &genome, T_QuerySequence &read, T_QuerySequ
             if (intervalContigEndPos < matchIntervalEnd) {
                 matchIntervalEnd = intervalContigEndPos;
             }
-            alignment->tName = seqDB.GetSpaceDelimitedName(seqDBIndex);
+            alignment->tName = contigIndex.Name(seqDBIndex);
             alignment->tLength = intervalContigEndPos - intervalContigStartPos;
             //
             // When there are multiple sequences in the database, store the
@@ -991,8 +1081,10 @@ void AlignIntervals(T_TargetSequence &genome, T_QuerySequence &read, T_QuerySequ
                 }
                 anchorsOnly.tPos = alignment->tPos;
                 anchorsOnly.qPos = alignment->qPos;
-                ComputeAlignmentStats(*alignment, alignment->qAlignedSeq.seq,
-                                      alignment->tAlignedSeq.seq, distScoreFn);
+                if (StatsNeededBeforeExtension(params)) {
+                    ComputeAlignmentStats(*alignment, alignment->qAlignedSeq.seq,
+                                          alignment->tAlignedSeq.seq, distScoreFn);
+                }
 
                 tAlignedSeq.Free();
                 qAlignedSeq.Free();
@@ -1004,8 +1096,10 @@ void AlignIntervals(T_TargetSequence &genome, T_QuerySequence &read, T_QuerySequ
                              sdpTupleSize, params.sdpIns, params.sdpDel, params.indelRate * 3,
                              *alignment, mappingBuffers, Local, params.detailedSDPAlignment,
                              params.extendFrontAlignment, params.recurseOver, params.fastSDP);
-                ComputeAlignmentStats(*alignment, alignment->qAlignedSeq.seq,
-                                      alignment->tAlignedSeq.seq, distScoreFn);
+                if (StatsNeededBeforeExtension(params)) {
+                    ComputeAlignmentStats(*alignment, alignment->qAlignedSeq.seq,
+                                          alignment->tAlignedSeq.seq, distScoreFn);
+                }
             }
         } else {
             //
@@ -1332,7 +1426,7 @@ void PairwiseLocalAlign(T_Sequence &qSeq, T_RefSequence &tSeq, int k, MappingPar
 // by flankSize bases. Update alignment->tAlignedSeqPos,
 // alignment->tAlignedSeqLength and alignment->tAlignedSeq.
 void FlankTAlignedSeq(T_AlignmentCandidate *alignment, SequenceIndexDatabase<FASTQSequence> &seqdb,
-                      DNASequence &genome, int flankSize)
+                      const ContigIndex &contigIndex, DNASequence &genome, int flankSize)
 {
     assert(alignment != NULL and alignment->tIsSubstring);
 
@@ -1354,7 +1448,7 @@ void FlankTAlignedSeq(T_AlignmentCandidate *alignment, SequenceIndexDatabase<FAS
     }
 
     // Find where this chromosome is in the genome.
-    int seqIndex = seqdb.GetIndexOfSeqName(alignment->tName);
+    int seqIndex = contigIndex.IndexOfName(alignment->tName);
     assert(seqIndex != -1);
     UInt newGenomePos = seqdb.ChromosomePositionToGenome(seqIndex, forwardTPos);
 
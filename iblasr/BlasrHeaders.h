@@ -4,6 +4,7 @@
 #include <mcheck.h>
 #endif
 #include <pthread.h>
+#include <sys/stat.h>
 #include <csignal>
 #include <cstdlib>
 #include <ctime>
@@ -22,6 +23,8 @@
 #include <LibBlasrConfig.h>
 #ifdef USE_PBBAM
 #include <pbbam/BamWriter.h>
+#include <pbbam/DataSet.h>
+#include <pbbam/PbiRawData.h>
 #include <pbbam/SamWriter.h>
 #endif
 
@@ -98,7 +101,9 @@
 #include "MappingBuffers.hpp"
 #include "MappingIPC.h"
 #include "MappingSemaphores.h"
+#include "OutputBuffer.h"
 #include "ReadAlignments.hpp"
+#include "RecordBuffer.h"
 
 typedef SMRTSequence T_Sequence;
 typedef FASTASequence T_GenomeSequence;
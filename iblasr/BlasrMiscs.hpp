@@ -7,7 +7,7 @@
 template <typename T_Sequence>
 bool GetNextReadThroughSemaphore(ReaderAgglomerate &reader, MappingParameters &params,
                                  T_Sequence &read, std::string &readGroupId, int &associatedRandInt,
-                                 MappingSemaphores &semaphores);
+                                 std::uint64_t &readIndex, MappingSemaphores &semaphores);
 
 //---------------------MAKE & CHECK READS-------------------------//
 //FIXME: move to SMRTSequence
@@ -6,15 +6,11 @@
 template <typename T_Sequence>
 bool GetNextReadThroughSemaphore(ReaderAgglomerate &reader, MappingParameters &params,
                                  T_Sequence &read, std::string &readGroupId, int &associatedRandInt,
-                                 MappingSemaphores &semaphores)
+                                 std::uint64_t &readIndex, MappingSemaphores &semaphores)
 {
     // Wait on a semaphore
     if (params.nProc > 1) {
-#ifdef __APPLE__
-        sem_wait(semaphores.reader);
-#else
-        sem_wait(&semaphores.reader);
-#endif
+        semaphores.Wait(MappingSemaphore::Reader);
     }
 
     bool returnValue = true;
@@ -24,6 +20,8 @@ bool GetNextReadThroughSemaphore(ReaderAgglomerate &reader, MappingParameters &p
     //
     if (reader.GetNext(read, associatedRandInt) == 0) {
         returnValue = false;
+    } else {
+        readIndex = semaphores.nReadsFetched++;
     }
 
     //
@@ -33,11 +31,7 @@ bool GetNextReadThroughSemaphore(ReaderAgglomerate &reader, MappingParameters &p
     readGroupId = reader.readGroupId;
 
     if (params.nProc > 1) {
-#ifdef __APPLE__
-        sem_post(semaphores.reader);
-#else
-        sem_post(&semaphores.reader);
-#endif
+        semaphores.Post(MappingSemaphore::Reader);
     }
     return returnValue;
 }
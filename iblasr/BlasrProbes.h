@@ -0,0 +1,46 @@
+#pragma once
+
+//
+// USDT (user level statically defined tracing) probes for attaching
+// perf, bpftrace or SystemTap to a running blasr.  A probe is a single
+// nop until a tracer attaches to it, so they are always compiled in
+// when <sys/sdt.h> is available (BLASR_HAVE_SDT, set by meson), and
+// are empty otherwise.  Arguments are evaluated even when no tracer is
+// attached, so only pass values that are already at hand.
+//
+// Provider "blasr":
+//
+//   zmw__start(holeNumber, title)          a thread starts mapping a ZMW
+//   zmw__end(holeNumber, nSubreads)        ... and has printed its alignments
+//   stage__start(stage)                    a MappingStage is entered
+//   stage__end(stage, nanoseconds)         ... and left, with its duration
+//   semaphore__wait(semaphore)             a thread blocks on a MappingSemaphore
+//   semaphore__acquire(semaphore)          ... and holds it
+//   semaphore__release(semaphore)          ... and releases it
+//   buffers__reset()                       MappingBuffers are released
+//
+// 'stage' and 'semaphore' are the integer values of the MappingStage
+// and MappingSemaphore enums.  The stage probes fire only while stages
+// are timed, that is with --latencyMetrics or --traceFile.  For example,
+//
+//   bpftrace -p $(pidof blasr) -e 'usdt:./blasr:blasr:stage__end
+//       /arg0 == 4/ { @alignIntervals = hist(arg1); }'
+//
+
+#if BLASR_HAVE_SDT
+#include <sys/sdt.h>
+
+#define BLASR_PROBE(name) DTRACE_PROBE(blasr, name)
+#define BLASR_PROBE1(name, a) DTRACE_PROBE1(blasr, name, a)
+#define BLASR_PROBE2(name, a, b) DTRACE_PROBE2(blasr, name, a, b)
+#else
+#define BLASR_PROBE(name) \
+    do {                  \
+    } while (0)
+#define BLASR_PROBE1(name, a) \
+    do {                      \
+    } while (0)
+#define BLASR_PROBE2(name, a, b) \
+    do {                         \
+    } while (0)
+#endif
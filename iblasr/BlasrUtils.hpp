@@ -6,11 +6,13 @@
 //----------------------MODIFY ALIGNMENTS--------------------------//
 //FIXME: refactor class SequenceIndexDatabase
 void AssignRefContigLocation(T_AlignmentCandidate &alignment,
-                             SequenceIndexDatabase<FASTQSequence> &seqdb, DNASequence &genome);
+                             SequenceIndexDatabase<FASTQSequence> &seqdb,
+                             const ContigIndex &contigIndex, DNASequence &genome);
 
 //FIXME: refactor class SequenceIndexDatabase
 void AssignRefContigLocations(std::vector<T_AlignmentCandidate *> &alignmentPtrs,
-                              SequenceIndexDatabase<FASTQSequence> &seqdb, DNASequence &genome);
+                              SequenceIndexDatabase<FASTQSequence> &seqdb,
+                              const ContigIndex &contigIndex, DNASequence &genome);
 
 template <typename T_RefSequence>
 //FIXME: refactor class SequenceIndexDatabase
@@ -40,15 +42,43 @@ bool CheckForSufficientMatch(T_Sequence &read, std::vector<T_AlignmentCandidate
 //FIXME: move to class ReadAlignments
 int FindMaxLengthAlignment(std::vector<T_AlignmentCandidate *> alignmentPtrs, int &maxLengthIndex);
 
+/// Prefix sums of the substitution QVs of read: sums[p] is the sum of
+/// the QVs before p, so any interval of the read sums in O(1).
+void SumSubstitutionQVs(SMRTSequence &read, std::vector<int> &sums);
+
 //FIXME: move to class T_AlignmentCandidate
+/// substitutionQVSums are from SumSubstitutionQVs, and only used when
+/// the read has substitution QVs and qualities are not ignored.
 void SumMismatches(SMRTSequence &read, T_AlignmentCandidate &alignment, int mismatchScore,
-                   int fullIntvStart, int fullIntvEnd, MappingParameters &params, int &sum);
+                   int fullIntvStart, int fullIntvEnd, MappingParameters &params,
+                   const std::vector<int> &substitutionQVSums, int &sum);
 
 //FIXME: move to class T_AlignmentCandidate
 /// \returns whether two alignments overlap by more than minPcercentOverlap%
 bool AlignmentsOverlap(T_AlignmentCandidate &alnA, T_AlignmentCandidate &alnB,
                        float minPercentOverlap);
 
+/// The closed interval [begin, end] of alignment 'index'; only intervals
+/// in the same group, e.g. on the same contig, are compared.
+class AlignmentInterval
+{
+public:
+    int group;
+    long long begin;
+    long long end;
+    int index;
+
+    AlignmentInterval(int groupP, long long beginP, long long endP, int indexP)
+        : group(groupP), begin(beginP), end(endP), index(indexP)
+    {
+    }
+};
+
+/// Appends to pairs every (a, b), a < b, of alignments whose intervals
+/// intersect, in O(n log n) plus the number of such pairs.
+void IntersectingAlignmentPairs(std::vector<AlignmentInterval> &intervals,
+                                std::vector<std::pair<int, int> > &pairs);
+
 /// \Partition overlapping alignments.
 void PartitionOverlappingAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs,
                                     std::vector<std::set<int> > &partitions, float minOverlap);
@@ -68,6 +98,10 @@ int RemoveLowQualityAlignments(T_Sequence &read, std::vector<T_AlignmentCandidat
 int RemoveOverlappingAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs,
                                 MappingParameters &params);
 
+// Delete the alignments that miss every target of --restrictTo.
+int RemoveOffTargetAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs,
+                              const TargetRestriction &restriction);
+
 // FIXME: move to class ReadAlignments
 // Delete all alignments from index startIndex in vector, inclusive.
 void DeleteAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs, int startIndex = 0);
@@ -100,22 +134,60 @@ void PrintAlignment(T_AlignmentCandidate &alignment, SMRTSequence &fullRead,
 #endif
                     );
 
-// Print all alignments in std::vector<T_AlignmentCandidate*> alignmentPtrs
-void PrintAlignments(std::vector<T_AlignmentCandidate *> alignmentPtrs, SMRTSequence &read,
-                     MappingParameters &params, std::ostream &outFile,
-                     AlignmentContext alignmentContext,
+//
+// The text and BAM records of the alignments of a ZMW, formatted by a
+// thread without holding the writer semaphore and then written at once.
+// With --splitByRef, splitEnds has the file group of each alignment and
+// where its text ends.
+//
+class AlignmentOutput
+{
+public:
+    OutputBuffer text;
+    std::vector<std::pair<int, std::size_t> > splitEnds;
 #ifdef USE_PBBAM
-                     SMRTSequence &subread, PacBio::BAM::IRecordWriter *bamWriterPtr,
+    RecordBuffer records;
 #endif
-                     MappingSemaphores &semaphores);
+
+    void Clear()
+    {
+        text.Clear();
+        splitEnds.clear();
+#ifdef USE_PBBAM
+        records.Clear();
+#endif
+    }
+};
+
+// Format all alignments in alignmentPtrs, after those already in 'output'.
+void FormatAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs, SMRTSequence &read,
+                      MappingParameters &params, AlignmentContext alignmentContext,
+#ifdef USE_PBBAM
+                      SMRTSequence &subread,
+#endif
+                      SplitByRefOutput *splitOutput, AlignmentOutput &output);
+
+// Write what was formatted into 'output', holding the writer semaphore.
+void WriteAlignments(AlignmentOutput &output, MappingParameters &params, std::ostream &outFile,
+#ifdef USE_PBBAM
+                     PacBio::BAM::IRecordWriter *bamWriterPtr,
+#endif
+                     MappingSemaphores &semaphores, MappingHistograms &histograms,
+                     SplitByRefOutput *splitOutput);
 
 void PrintAlignmentPtrs(std::vector<T_AlignmentCandidate *> &alignmentPtrs,
                         std::ostream &out = std::cout);
 
 // Print an unaligned read, if noPrintUnalignedSeqs is True, print title only;
-// otherwise, print title and sequence of the read.
+// otherwise, print title and sequence of the read, as FASTQ if fastq is True.
 void PrintUnaligned(const SMRTSequence &unalignedRead, std::ostream &unalignedFilePtr,
-                    const bool noPrintUnalignedSeqs);
+                    const bool noPrintUnalignedSeqs, const bool fastq = false);
+
+#ifdef USE_PBBAM
+// The BAM record of an unaligned read without SEQ, QUAL and per-base
+// tags, for --unaligned out.bam with --noPrintUnalignedSeqs.
+PacBio::BAM::BamRecord UnalignedRecordWithoutSeq(const SMRTSequence &unalignedRead);
+#endif
 
 // Print all alignments for subreads in allReadAlignments.
 // Input:
@@ -127,12 +199,15 @@ void PrintUnaligned(const SMRTSequence &unalignedRead, std::ostream &unalignedFi
 // Output:
 //   outFilePtr        - where to print alignments for subreads.
 //   unalignedFilePtr  - where to print sequences for unaligned subreads.
+//   histograms        - per-thread latency histograms, records writer wait.
 void PrintAllReadAlignments(ReadAlignments &allReadAlignments, AlignmentContext &alignmentContext,
                             std::ostream &outFilePtr, std::ostream &unalignedFilePtr,
                             MappingParameters &params, std::vector<SMRTSequence> &subreads,
 #ifdef USE_PBBAM
                             PacBio::BAM::IRecordWriter *bamWriterPtr,
+                            PacBio::BAM::IRecordWriter *unalignedBamWriterPtr,
 #endif
-                            MappingSemaphores &semaphores);
+                            MappingSemaphores &semaphores, MappingHistograms &histograms,
+                            SplitByRefOutput *splitOutput = NULL);
 
 #include "BlasrUtilsImpl.hpp"
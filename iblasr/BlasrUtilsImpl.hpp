@@ -5,7 +5,8 @@
 
 //----------------------MODIFY ALIGNMENTS--------------------------//
 void AssignRefContigLocation(T_AlignmentCandidate &alignment,
-                             SequenceIndexDatabase<FASTQSequence> &seqdb, DNASequence &genome)
+                             SequenceIndexDatabase<FASTQSequence> &seqdb,
+                             const ContigIndex &contigIndex, DNASequence &genome)
 {
     //
     // If the sequence database is used, the start position of
@@ -17,7 +18,7 @@ void AssignRefContigLocation(T_AlignmentCandidate &alignment,
     int seqDBIndex;
     if (alignment.tStrand == 0) {
         forwardTPos = alignment.tAlignedSeqPos;
-        seqDBIndex = seqdb.SearchForIndex(forwardTPos);
+        seqDBIndex = contigIndex.Find(forwardTPos);
         alignment.tAlignedSeqPos -= seqdb.seqStartPos[seqDBIndex];
     } else {
         //
@@ -29,7 +30,7 @@ void AssignRefContigLocation(T_AlignmentCandidate &alignment,
         assert(alignment.tAlignedSeqLength > 0);
         forwardTPos =
             genome.MakeRCCoordinate(alignment.tAlignedSeqPos + alignment.tAlignedSeqLength - 1);
-        seqDBIndex = seqdb.SearchForIndex(forwardTPos);
+        seqDBIndex = contigIndex.Find(forwardTPos);
 
         //
         // Find the reverse comlement coordinate of the last base of this
@@ -44,13 +45,14 @@ void AssignRefContigLocation(T_AlignmentCandidate &alignment,
 }
 
 void AssignRefContigLocations(std::vector<T_AlignmentCandidate *> &alignmentPtrs,
-                              SequenceIndexDatabase<FASTQSequence> &seqdb, DNASequence &genome)
+                              SequenceIndexDatabase<FASTQSequence> &seqdb,
+                              const ContigIndex &contigIndex, DNASequence &genome)
 {
 
     UInt i;
     for (i = 0; i < alignmentPtrs.size(); i++) {
         T_AlignmentCandidate *aref = alignmentPtrs[i];
-        AssignRefContigLocation(*aref, seqdb, genome);
+        AssignRefContigLocation(*aref, seqdb, contigIndex, genome);
     }
 }
 
@@ -208,6 +210,12 @@ void StoreMapQVs(SMRTSequence &read, std::vector<T_AlignmentCandidate *> &alignm
     // extended past the ends of their current alignment.
     //
 
+    //
+    // The substitution QVs are summed once per read, the first time an
+    // alignment needs them, rather than per alignment.
+    //
+    std::vector<int> substitutionQVSums;
+    bool useQVSums = not params.ignoreQualities and read.substitutionQV.Empty() == false;
     for (p = 0; p < int(partitions.size()); p++) {
         partEnd = partitions[p].end();
         int alnStart, alnEnd;
@@ -217,10 +225,13 @@ void StoreMapQVs(SMRTSequence &read, std::vector<T_AlignmentCandidate *> &alignm
             alignmentPtrs[*partIt]->GetQInterval(alnStart, alnEnd, convertToForwardStrand);
             if (alnStart - partitionBeginPos[p] > MAPQV_END_ALIGN_WIGGLE or
                 partitionEndPos[p] - alnEnd > MAPQV_END_ALIGN_WIGGLE) {
+                if (useQVSums and substitutionQVSums.empty()) {
+                    SumSubstitutionQVs(read, substitutionQVSums);
+                }
                 // bug 24363, use updated SumMismatches to compute mismatch score when
                 // no QV is available.
                 SumMismatches(read, *alignmentPtrs[*partIt], 15, partitionBeginPos[p],
-                              partitionEndPos[p], params, mismatchSum);
+                              partitionEndPos[p], params, substitutionQVSums, mismatchSum);
             }
             //
             // Random sequence can be aligned with about 50% similarity due
@@ -234,6 +245,7 @@ void StoreMapQVs(SMRTSequence &read, std::vector<T_AlignmentCandidate *> &alignm
     // Determine mapqv by summing qvscores in partitions
 
     float mapQVDenominator = 0;
+    const double log10 = log(10);
     for (p = 0; p < int(partitions.size()); p++) {
         std::set<int>::iterator nextIt;
         if (partitions[p].size() == 0) {
@@ -269,7 +281,6 @@ void StoreMapQVs(SMRTSequence &read, std::vector<T_AlignmentCandidate *> &alignm
             else if (alignmentPtrs[*partIt]->probScore - mapQVDenominator < -20) {
                 alignmentPtrs[*partIt]->mapQV = 0;
             } else {
-                double log10 = log(10);
                 double sub = alignmentPtrs[*partIt]->probScore - mapQVDenominator;
                 double expo = exp(log10 * sub);
                 double diff = 1.0 - expo;
@@ -331,19 +342,28 @@ int FindMaxLengthAlignment(std::vector<T_AlignmentCandidate *> alignmentPtrs, in
     return (maxLength != -1);
 }
 
+void SumSubstitutionQVs(SMRTSequence &read, std::vector<int> &sums)
+{
+    sums.resize(read.length + 1);
+    sums[0] = 0;
+    for (DNALength p = 0; p < read.length; p++) {
+        sums[p + 1] = sums[p] + read.substitutionQV[p];
+    }
+}
+
 void SumMismatches(SMRTSequence &read, T_AlignmentCandidate &alignment, int mismatchScore,
-                   int fullIntvStart, int fullIntvEnd, MappingParameters &params, int &sum)
+                   int fullIntvStart, int fullIntvEnd, MappingParameters &params,
+                   const std::vector<int> &substitutionQVSums, int &sum)
 {
     int alnStart, alnEnd;
     alignment.GetQIntervalOnForwardStrand(alnStart, alnEnd);
-    int p;
     sum = 0;
     if (not params.ignoreQualities and read.substitutionQV.Empty() == false) {
-        for (p = fullIntvStart; p < alnStart; p++) {
-            sum += read.substitutionQV[p];
+        if (fullIntvStart < alnStart) {
+            sum += substitutionQVSums[alnStart] - substitutionQVSums[fullIntvStart];
         }
-        for (p = alnEnd; p < fullIntvEnd; p++) {
-            sum += read.substitutionQV[p];
+        if (alnEnd < fullIntvEnd) {
+            sum += substitutionQVSums[fullIntvEnd] - substitutionQVSums[alnEnd];
         }
     } else {
         // bug 24363, compute mismatch score when QV is not available.
@@ -389,39 +409,103 @@ bool AlignmentsOverlap(T_AlignmentCandidate &alnA, T_AlignmentCandidate &alnB,
     return (ovpPercent > minPercentOverlap);
 }
 
+//
+// Sort by begin and sweep, keeping the intervals that reach the current
+// begin; every interval that is still kept intersects the current one.
+//
+void IntersectingAlignmentPairs(std::vector<AlignmentInterval> &intervals,
+                                std::vector<std::pair<int, int> > &pairs)
+{
+    std::sort(intervals.begin(), intervals.end(),
+              [](const AlignmentInterval &a, const AlignmentInterval &b) {
+                  if (a.group != b.group) {
+                      return a.group < b.group;
+                  }
+                  if (a.begin != b.begin) {
+                      return a.begin < b.begin;
+                  }
+                  return a.index < b.index;
+              });
+    std::vector<AlignmentInterval> active;
+    for (const AlignmentInterval &cur : intervals) {
+        size_t nKept = 0;
+        for (size_t a = 0; a < active.size(); a++) {
+            if (active[a].group == cur.group and active[a].end >= cur.begin) {
+                pairs.push_back(std::make_pair(std::min(active[a].index, cur.index),
+                                               std::max(active[a].index, cur.index)));
+                active[nKept++] = active[a];
+            }
+        }
+        active.erase(active.begin() + nKept, active.end());
+        active.push_back(cur);
+    }
+}
+
+//
+// Alignment i joins the first partition that holds an alignment it
+// overlaps or contains, or else starts a new one.  Partitions are
+// created in order, so that is the lowest partition of the earlier
+// alignments it matches, and only alignments that intersect it on the
+// read, on the forward strand or as given by QAlignStart/End, can match.
+//
 void PartitionOverlappingAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs,
                                     std::vector<std::set<int> > &partitions, float minOverlap)
 {
+    partitions.clear();
     if (alignmentPtrs.size() == 0) {
-        partitions.clear();
         return;
     }
 
-    std::set<int>::iterator setIt, setEnd;
-    int i, p;
-    bool overlapFound = false;
-    for (i = 0; i < int(alignmentPtrs.size()); i++) {
-        overlapFound = false;
-        for (p = 0; p < int(partitions.size()) and overlapFound == false; p++) {
-            setEnd = partitions[p].end();
-            for (setIt = partitions[p].begin();
-                 setIt != partitions[p].end() and overlapFound == false; ++setIt) {
-                if (AlignmentsOverlap(*alignmentPtrs[i], *alignmentPtrs[*setIt], minOverlap) or
-                    ((alignmentPtrs[i]->QAlignStart() <= alignmentPtrs[*setIt]->QAlignStart()) and
-                     (alignmentPtrs[i]->QAlignEnd() > alignmentPtrs[*setIt]->QAlignEnd()))) {
-                    partitions[p].insert(i);
-                    overlapFound = true;
-                }
+    // Below 0, AlignmentsOverlap holds for any two alignments.
+    if (minOverlap < 0) {
+        partitions.push_back(std::set<int>());
+        for (int i = 0; i < int(alignmentPtrs.size()); i++) {
+            partitions[0].insert(i);
+        }
+        return;
+    }
+
+    std::vector<AlignmentInterval> forwardIntervals, alignIntervals;
+    for (int i = 0; i < int(alignmentPtrs.size()); i++) {
+        int alnStart, alnEnd;
+        alignmentPtrs[i]->GetQInterval(alnStart, alnEnd, true);
+        forwardIntervals.push_back(AlignmentInterval(0, alnStart, alnEnd, i));
+        alignIntervals.push_back(AlignmentInterval(0, alignmentPtrs[i]->QAlignStart(),
+                                                   alignmentPtrs[i]->QAlignEnd(), i));
+    }
+    std::vector<std::pair<int, int> > pairs;
+    IntersectingAlignmentPairs(forwardIntervals, pairs);
+    IntersectingAlignmentPairs(alignIntervals, pairs);
+    // Group the earlier alignments by the later one.
+    for (auto &pair : pairs) {
+        std::swap(pair.first, pair.second);
+    }
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    std::vector<int> partitionOf(alignmentPtrs.size());
+    size_t next = 0;
+    for (int i = 0; i < int(alignmentPtrs.size()); i++) {
+        int p = -1;
+        for (; next < pairs.size() and pairs[next].first == i; next++) {
+            int s = pairs[next].second;
+            if ((p < 0 or partitionOf[s] < p) and
+                (AlignmentsOverlap(*alignmentPtrs[i], *alignmentPtrs[s], minOverlap) or
+                 ((alignmentPtrs[i]->QAlignStart() <= alignmentPtrs[s]->QAlignStart()) and
+                  (alignmentPtrs[i]->QAlignEnd() > alignmentPtrs[s]->QAlignEnd())))) {
+                p = partitionOf[s];
             }
         }
         //
         // If this alignment does not overlap any other, create a
         // partition with it as the first element.
         //
-        if (overlapFound == false) {
+        if (p < 0) {
+            p = partitions.size();
             partitions.push_back(std::set<int>());
-            partitions[partitions.size() - 1].insert(i);
         }
+        partitions[p].insert(i);
+        partitionOf[i] = p;
     }
 }
 
@@ -509,71 +593,75 @@ int RemoveOverlappingAlignments(std::vector<T_AlignmentCandidate *> &alignmentPt
     alignmentIsContained.resize(alignmentPtrs.size());
     std::fill(alignmentIsContained.begin(), alignmentIsContained.end(), false);
 
-    int j;
     int numContained = 0;
     int curNotContained = 0;
 
     if (alignmentPtrs.size() > 0) {
-        UInt i;
-        for (i = 0; i < alignmentPtrs.size() - 1; i++) {
+        //
+        // Only alignments on the same contig whose target intervals
+        // intersect can contain one another.  Find those pairs, and
+        // check them in the order of comparing each alignment i with
+        // every j > i, since whether i is removed by j depends on
+        // whether j was removed before.
+        //
+        std::vector<AlignmentInterval> intervals;
+        for (int i = 0; i < int(alignmentPtrs.size()); i++) {
+            intervals.push_back(AlignmentInterval(alignmentPtrs[i]->tIndex,
+                                                  alignmentPtrs[i]->GenomicTBegin(),
+                                                  alignmentPtrs[i]->GenomicTEnd(), i));
+        }
+        std::vector<std::pair<int, int> > pairs;
+        IntersectingAlignmentPairs(intervals, pairs);
+        std::sort(pairs.begin(), pairs.end());
+
+        for (const auto &pair : pairs) {
+            int i = pair.first, j = pair.second;
             T_AlignmentCandidate *aref = alignmentPtrs[i];
             if (aref->pctSimilarity < params.minPctSimilarity) {
                 continue;
             }
-            for (j = i + 1; j < int(alignmentPtrs.size()); j++) {
-                //
-                // Make sure this alignment isn't already removed.
-                //
-                if (alignmentIsContained[j]) {
-                    continue;
-                }
+            //
+            // Make sure this alignment isn't already removed.
+            //
+            if (alignmentIsContained[j]) {
+                continue;
+            }
 
+            //
+            // Check for an alignment that is fully overlapping another
+            // alignment.
+            if (aref->GenomicTBegin() <= alignmentPtrs[j]->GenomicTBegin() and
+                aref->GenomicTEnd() >= alignmentPtrs[j]->GenomicTEnd()) {
                 //
-                // Only check for containment if the two sequences are from the same contig.
+                // Alignment i is contained in j is only true if it has a worse score.
                 //
-                if (alignmentPtrs[i]->tIndex != alignmentPtrs[j]->tIndex) {
-                    continue;
+                if (aref->score <= alignmentPtrs[j]->score) {
+                    alignmentIsContained[j] = true;
                 }
-
-                //
-                // Check for an alignment that is fully overlapping another
-                // alignment.
-                if (aref->GenomicTBegin() <= alignmentPtrs[j]->GenomicTBegin() and
-                    aref->GenomicTEnd() >= alignmentPtrs[j]->GenomicTEnd() and
-                    alignmentPtrs[i]->tIndex == alignmentPtrs[j]->tIndex) {
-                    //
-                    // Alignment i is contained in j is only true if it has a worse score.
-                    //
-                    if (aref->score <= alignmentPtrs[j]->score) {
-                        alignmentIsContained[j] = true;
-                    }
-                    if (params.verbosity >= 2) {
-                        std::cout << "alignment " << i << " is contained in " << j << std::endl;
-                        std::cout << aref->tAlignedSeqPos << " " << alignmentPtrs[j]->tAlignedSeqPos
-                                  << " " << aref->tAlignedSeqPos + aref->tAlignedSeqLength << " "
-                                  << alignmentPtrs[j]->tAlignedSeqPos +
-                                         alignmentPtrs[j]->tAlignedSeqLength
-                                  << std::endl;
-                    }
-                } else if (alignmentPtrs[j]->GenomicTBegin() <= aref->GenomicTBegin() and
-                           alignmentPtrs[j]->GenomicTEnd() >= aref->GenomicTEnd() and
-                           alignmentPtrs[i]->tIndex == alignmentPtrs[j]->tIndex) {
-                    if (params.verbosity >= 2) {
-                        std::cout << "ALIGNMENT " << j << " is contained in " << i << std::endl;
-                        std::cout << alignmentPtrs[j]->tAlignedSeqPos << " " << aref->tAlignedSeqPos
-                                  << " "
-                                  << alignmentPtrs[j]->tAlignedSeqPos +
-                                         alignmentPtrs[j]->tAlignedSeqLength
-                                  << " " << aref->tAlignedSeqPos + aref->tAlignedSeqLength
-                                  << std::endl;
-                    }
-                    if (alignmentPtrs[j]->score <= aref->score) {
-                        alignmentIsContained[i] = true;
-                    }
+                if (params.verbosity >= 2) {
+                    std::cout << "alignment " << i << " is contained in " << j << std::endl;
+                    std::cout << aref->tAlignedSeqPos << " " << alignmentPtrs[j]->tAlignedSeqPos
+                              << " " << aref->tAlignedSeqPos + aref->tAlignedSeqLength << " "
+                              << alignmentPtrs[j]->tAlignedSeqPos +
+                                     alignmentPtrs[j]->tAlignedSeqLength
+                              << std::endl;
+                }
+            } else if (alignmentPtrs[j]->GenomicTBegin() <= aref->GenomicTBegin() and
+                       alignmentPtrs[j]->GenomicTEnd() >= aref->GenomicTEnd()) {
+                if (params.verbosity >= 2) {
+                    std::cout << "ALIGNMENT " << j << " is contained in " << i << std::endl;
+                    std::cout << alignmentPtrs[j]->tAlignedSeqPos << " " << aref->tAlignedSeqPos
+                              << " "
+                              << alignmentPtrs[j]->tAlignedSeqPos +
+                                     alignmentPtrs[j]->tAlignedSeqLength
+                              << " " << aref->tAlignedSeqPos + aref->tAlignedSeqLength << std::endl;
+                }
+                if (alignmentPtrs[j]->score <= aref->score) {
+                    alignmentIsContained[i] = true;
                 }
             }
         }
-        for (i = 0; i < alignmentPtrs.size(); i++) {
+        for (UInt i = 0; i < alignmentPtrs.size(); i++) {
             T_AlignmentCandidate *aref = alignmentPtrs[i];
             if (alignmentIsContained[i]) {
                 delete alignmentPtrs[i];
@@ -589,6 +677,29 @@ int RemoveOverlappingAlignments(std::vector<T_AlignmentCandidate *> &alignmentPt
     return alignmentPtrs.size();
 }
 
+int RemoveOffTargetAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs,
+                              const TargetRestriction &restriction)
+{
+    size_t nKept = 0;
+    for (size_t i = 0; i < alignmentPtrs.size(); i++) {
+        T_AlignmentCandidate *aref = alignmentPtrs[i];
+        //
+        // Reverse strand positions count from the end of the contig.
+        //
+        DNALength begin = aref->tAlignedSeqPos;
+        if (aref->tStrand != 0) {
+            begin = aref->tLength - aref->tAlignedSeqPos - aref->tAlignedSeqLength;
+        }
+        if (restriction.OnTarget(aref->tIndex, begin, begin + aref->tAlignedSeqLength)) {
+            alignmentPtrs[nKept++] = aref;
+        } else {
+            delete aref;
+        }
+    }
+    alignmentPtrs.resize(nKept);
+    return alignmentPtrs.size();
+}
+
 // Delete all alignments from index startIndex in vector, inclusive.
 void DeleteAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs, int startIndex)
 {
@@ -981,22 +1092,15 @@ void PrintAlignment(T_AlignmentCandidate &alignment, SMRTSequence &fullRead,
     }
 }
 
-// Print all alignments in std::vector<T_AlignmentCandidate*> alignmentPtrs
-void PrintAlignments(std::vector<T_AlignmentCandidate *> alignmentPtrs, SMRTSequence &read,
-                     MappingParameters &params, std::ostream &outFile,
-                     AlignmentContext alignmentContext,
+void FormatAlignments(std::vector<T_AlignmentCandidate *> &alignmentPtrs, SMRTSequence &read,
+                      MappingParameters &params, AlignmentContext alignmentContext,
 #ifdef USE_PBBAM
-                     SMRTSequence &subread, PacBio::BAM::IRecordWriter *bamWriterPtr,
+                      SMRTSequence &subread,
 #endif
-                     MappingSemaphores &semaphores)
+                      SplitByRefOutput *splitOutput, AlignmentOutput &output)
 {
-    if (params.nProc > 1) {
-#ifdef __APPLE__
-        sem_wait(semaphores.writer);
-#else
-        sem_wait(&semaphores.writer);
-#endif
-    }
+    DistanceMatrixScoreFunction<DNASequence, FASTASequence> editdistScoreFn(EditDistanceMatrix, 1,
+                                                                            1);
     for (int i = 0; i < int(alignmentPtrs.size()); i++) {
         T_AlignmentCandidate *aref = alignmentPtrs[i];
 
@@ -1027,27 +1131,72 @@ void PrintAlignments(std::vector<T_AlignmentCandidate *> alignmentPtrs, SMRTSequ
         }
 
         if (params.printSAM or params.printBAM) {
-            DistanceMatrixScoreFunction<DNASequence, FASTASequence> editdistScoreFn(
-                EditDistanceMatrix, 1, 1);
             T_AlignmentCandidate &alignment = *alignmentPtrs[i];
             alignmentContext.editDist = ComputeAlignmentScore(
                 alignment, alignment.qAlignedSeq, alignment.tAlignedSeq, editdistScoreFn);
         }
 
-        PrintAlignment(*alignmentPtrs[i], read, params, alignmentContext, outFile
+        PrintAlignment(*alignmentPtrs[i], read, params, alignmentContext, output.text
 #ifdef USE_PBBAM
                        ,
-                       subread, bamWriterPtr
+                       subread, &output.records
 #endif
                        );
+        if (splitOutput) {
+            output.splitEnds.push_back(
+                std::make_pair(splitOutput->GroupOf(alignmentPtrs[i]->tIndex), output.text.Size()));
+        }
     }
+}
 
-    if (params.nProc > 1) {
-#ifdef __APPLE__
-        sem_post(semaphores.writer);
-#else
-        sem_post(&semaphores.writer);
+void WriteAlignments(AlignmentOutput &output, MappingParameters &params, std::ostream &outFile,
+#ifdef USE_PBBAM
+                     PacBio::BAM::IRecordWriter *bamWriterPtr,
+#endif
+                     MappingSemaphores &semaphores, MappingHistograms &histograms,
+                     SplitByRefOutput *splitOutput)
+{
+    // Threads with their own output file (--outputByThread) need no lock.
+    bool lock = params.nProc > 1 and not params.outputByThread;
+    //
+    // With --splitByRef, the text of each alignment is written to the
+    // file of its reference; records are routed by SplitByRefRecordWriter.
+    //
+    std::size_t nRecords = 0;
+#ifdef USE_PBBAM
+    nRecords = output.records.Size();
 #endif
+    if (output.text.Size() == 0 and nRecords == 0) {
+        return;
+    }
+    if (lock) {
+        histograms.Tick(MappingStage::WriterWait);
+        semaphores.Wait(MappingSemaphore::Writer);
+        histograms.Tock(MappingStage::WriterWait);
+    }
+    try {
+        if (output.text.Size() > 0 and splitOutput) {
+            std::size_t begin = 0;
+            for (const auto &end : output.splitEnds) {
+                splitOutput->Text(end.first).write(output.text.Data() + begin, end.second - begin);
+                begin = end.second;
+            }
+        } else if (output.text.Size() > 0) {
+            output.text.WriteTo(outFile);
+        }
+#ifdef USE_PBBAM
+        if (nRecords > 0) {
+            output.records.WriteTo(*bamWriterPtr);
+        }
+#endif
+    } catch (std::ostream::failure f) {
+        std::cout << "ERROR writing to output file. The output drive may be full, or you  "
+                  << std::endl;
+        std::cout << "may not have proper write permissions." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    if (lock) {
+        semaphores.Post(MappingSemaphore::Writer);
     }
 }
 
@@ -1061,24 +1210,120 @@ void PrintAlignmentPtrs(std::vector<T_AlignmentCandidate *> &alignmentPtrs, std:
     out << std::endl;
 }
 
+//
+// True if 'title' is 'movie/hole/start_end' with plain decimal numbers,
+// which SMRTTitle would print back unchanged.  Subread titles are
+// nearly always of this form, so they need not be parsed.
+//
+bool IsPlainSMRTTitle(const std::string &title)
+{
+    auto isNumber = [&title](size_t begin, size_t end) {
+        if (end <= begin or end - begin > 9 or (title[begin] == '0' and end - begin > 1)) {
+            return false;
+        }
+        for (size_t i = begin; i < end; i++) {
+            if (title[i] < '0' or title[i] > '9') {
+                return false;
+            }
+        }
+        return true;
+    };
+    size_t hole = title.find('/');
+    if (hole == 0 or hole == std::string::npos) {
+        return false;
+    }
+    size_t range = title.find('/', hole + 1);
+    if (range == std::string::npos) {
+        return false;
+    }
+    size_t underscore = title.find('_', range + 1);
+    return underscore != std::string::npos and isNumber(hole + 1, range) and
+           isNumber(range + 1, underscore) and isNumber(underscore + 1, title.size());
+}
+
 void PrintUnaligned(const SMRTSequence &unalignedRead, std::ostream &unalignedFilePtr,
-                    const bool noPrintUnalignedSeqs)
+                    const bool noPrintUnalignedSeqs, const bool fastq)
 {
     if (noPrintUnalignedSeqs) {
         std::string s = unalignedRead.GetTitle();
+        if (IsPlainSMRTTitle(s)) {
+            unalignedFilePtr << s << '\n';
+            return;
+        }
         SMRTTitle st(s);
         if (st.isSMRTTitle)
-            unalignedFilePtr << st.ToString() << std::endl;
+            unalignedFilePtr << st.ToString() << '\n';
         else
             //size_t pos = s.rfind("/");
             //if (pos != string::npos)
             //    unalignedFilePtr << s.substr(0, pos) << std::endl;
             //else
-            unalignedFilePtr << s << std::endl;
+            unalignedFilePtr << s << '\n';
+    } else if (fastq) {
+        unalignedFilePtr << '@' << unalignedRead.GetTitle() << '\n';
+        unalignedFilePtr.write(reinterpret_cast<const char *>(unalignedRead.seq),
+                               unalignedRead.length);
+        unalignedFilePtr << "\n+\n";
+        // Phred+33, with QV 0 for reads without qualities.
+        for (DNALength i = 0; i < unalignedRead.length; i++) {
+            int qv = unalignedRead.qual.Empty() ? 0 : unalignedRead.qual[i];
+            unalignedFilePtr.put(char(qv + 33));
+        }
+        unalignedFilePtr << '\n';
     } else
         unalignedRead.PrintSeq(unalignedFilePtr);
 }
 
+#ifdef USE_PBBAM
+// The number of values in a string or array tag; scalars have none.
+size_t TagLength(const PacBio::BAM::Tag &tag)
+{
+    switch (tag.Type()) {
+        case PacBio::BAM::TagDataType::STRING:
+            return tag.ToString().size();
+        case PacBio::BAM::TagDataType::INT8_ARRAY:
+            return tag.ToInt8Array().size();
+        case PacBio::BAM::TagDataType::UINT8_ARRAY:
+            return tag.ToUInt8Array().size();
+        case PacBio::BAM::TagDataType::INT16_ARRAY:
+            return tag.ToInt16Array().size();
+        case PacBio::BAM::TagDataType::UINT16_ARRAY:
+            return tag.ToUInt16Array().size();
+        case PacBio::BAM::TagDataType::INT32_ARRAY:
+            return tag.ToInt32Array().size();
+        case PacBio::BAM::TagDataType::UINT32_ARRAY:
+            return tag.ToUInt32Array().size();
+        case PacBio::BAM::TagDataType::FLOAT_ARRAY:
+            return tag.ToFloatArray().size();
+        default:
+            return 0;
+    }
+}
+
+PacBio::BAM::BamRecord UnalignedRecordWithoutSeq(const SMRTSequence &unalignedRead)
+{
+    //
+    // As in text output, only the read is named.  Tags with a value per
+    // base, such as QVs and kinetics, go with the sequence; the per-read
+    // tags (zm, qs, qe, rq, sn, ...) are kept.
+    //
+    PacBio::BAM::BamRecord record = unalignedRead.bamRecord;
+    PacBio::BAM::BamRecordImpl &impl = record.Impl();
+    size_t length = impl.SequenceLength();
+    PacBio::BAM::TagCollection tags = impl.Tags();
+    for (auto tag = tags.begin(); tag != tags.end();) {
+        if (length > 0 and TagLength(tag->second) == length) {
+            tag = tags.erase(tag);
+        } else {
+            ++tag;
+        }
+    }
+    impl.SetSequenceAndQualities("", "");
+    impl.Tags(tags);
+    return record;
+}
+#endif
+
 // Print all alignments for subreads in allReadAlignments.
 // Input:
 //   allReadAlignments - contains a set of subreads, each of which
@@ -1089,13 +1334,20 @@ void PrintUnaligned(const SMRTSequence &unalignedRead, std::ostream &unalignedFi
 // Output:
 //   outFilePtr        - where to print alignments for subreads.
 //   unalignedFilePtr  - where to print sequences for unaligned subreads.
+//   unalignedBamWriterPtr - where to write their records for BAM --unaligned.
+//   histograms        - per-thread latency histograms, records writer wait.
+// The alignments of all subreads of the ZMW are formatted first and
+// written together, taking the writer semaphore once, and so are the
+// unaligned subreads, taking the unaligned semaphore once.
 void PrintAllReadAlignments(ReadAlignments &allReadAlignments, AlignmentContext &alignmentContext,
                             std::ostream &outFilePtr, std::ostream &unalignedFilePtr,
                             MappingParameters &params, std::vector<SMRTSequence> &subreads,
 #ifdef USE_PBBAM
                             PacBio::BAM::IRecordWriter *bamWriterPtr,
+                            PacBio::BAM::IRecordWriter *unalignedBamWriterPtr,
 #endif
-                            MappingSemaphores &semaphores)
+                            MappingSemaphores &semaphores, MappingHistograms &histograms,
+                            SplitByRefOutput *splitOutput)
 {
     int subreadIndex;
     int nAlignedSubreads = allReadAlignments.GetNAlignedSeq();
@@ -1116,6 +1368,17 @@ void PrintAllReadAlignments(ReadAlignments &allReadAlignments, AlignmentContext
     }
     alignmentContext.nSubreads = nAlignedSubreads;
 
+    static thread_local AlignmentOutput alignmentOutput;
+    alignmentOutput.Clear();
+    static thread_local OutputBuffer unalignedBuffer;
+    unalignedBuffer.Clear();
+#ifdef USE_PBBAM
+    // Input records are written as they are, or stripped beforehand.
+    std::vector<const SMRTSequence *> unalignedRecords;
+    static thread_local std::vector<PacBio::BAM::BamRecord> strippedRecords;
+    strippedRecords.clear();
+#endif
+
     for (subreadIndex = 0; subreadIndex < nAlignedSubreads; subreadIndex++) {
         alignmentContext.subreadIndex = subreadIndex;
         if (subreadIndex < nAlignedSubreads - 1 and
@@ -1138,37 +1401,62 @@ void PrintAllReadAlignments(ReadAlignments &allReadAlignments, AlignmentContext
             sourceSubread = &subreads[subreadIndex];
         }
         if (allReadAlignments.subreadAlignments[subreadIndex].size() > 0) {
-            PrintAlignments(allReadAlignments.subreadAlignments[subreadIndex],
-                            allReadAlignments.subreads[subreadIndex],
-                            // for these alignments
-                            params, outFilePtr,  //*mapData->outFilePtr,
-                            alignmentContext,
+            FormatAlignments(allReadAlignments.subreadAlignments[subreadIndex],
+                             allReadAlignments.subreads[subreadIndex],
+                             // for these alignments
+                             params, alignmentContext,
 #ifdef USE_PBBAM
-                            *sourceSubread, bamWriterPtr,
+                             *sourceSubread,
 #endif
-                            semaphores);
+                             splitOutput, alignmentOutput);
         } else {
             //
             // Print the unaligned sequences.
             //
             if (params.printUnaligned == true) {
-                if (params.nProc == 1) {
-                    PrintUnaligned(*sourceSubread, unalignedFilePtr, params.noPrintUnalignedSeqs);
-                } else {
-#ifdef __APPLE__
-                    sem_wait(semaphores.unaligned);
-#else
-                    sem_wait(&semaphores.unaligned);
+#ifdef USE_PBBAM
+                if (params.unalignedBam and params.noPrintUnalignedSeqs) {
+                    strippedRecords.push_back(UnalignedRecordWithoutSeq(*sourceSubread));
+                    continue;
+                } else if (params.unalignedBam) {
+                    unalignedRecords.push_back(sourceSubread);
+                    continue;
+                }
 #endif
-                    PrintUnaligned(*sourceSubread,  //subreads[subreadIndex],
-                                   unalignedFilePtr, params.noPrintUnalignedSeqs);
-#ifdef __APPLE__
-                    sem_post(semaphores.unaligned);
-#else
-                    sem_post(&semaphores.unaligned);
+                PrintUnaligned(*sourceSubread,  //subreads[subreadIndex],
+                               unalignedBuffer, params.noPrintUnalignedSeqs, params.unalignedFastq);
+            }  // End of printing  unaligned sequences.
+        }      // End of finding no alignments for the subread with subreadIndex.
+    }          // End of printing and processing alignmentContext for each subread.
+
+    WriteAlignments(alignmentOutput, params, outFilePtr,
+#ifdef USE_PBBAM
+                    bamWriterPtr,
 #endif
-                }  // End of nproc > 1.
-            }      // End of printing  unaligned sequences.
-        }          // End of finding no alignments for the subread with subreadIndex.
-    }              // End of printing and processing alignmentContext for each subread.
+                    semaphores, histograms, splitOutput);
+
+    bool anyUnaligned = unalignedBuffer.Size() > 0;
+#ifdef USE_PBBAM
+    anyUnaligned = anyUnaligned or not unalignedRecords.empty() or not strippedRecords.empty();
+#endif
+    if (not anyUnaligned) {
+        return;
+    }
+    if (params.nProc > 1) {
+        semaphores.Wait(MappingSemaphore::Unaligned);
+    }
+    if (unalignedBuffer.Size() > 0) {
+        unalignedBuffer.WriteTo(unalignedFilePtr);
+    }
+#ifdef USE_PBBAM
+    for (const SMRTSequence *subread : unalignedRecords) {
+        unalignedBamWriterPtr->Write(subread->bamRecord);
+    }
+    for (const PacBio::BAM::BamRecord &record : strippedRecords) {
+        unalignedBamWriterPtr->Write(record);
+    }
+#endif
+    if (params.nProc > 1) {
+        semaphores.Post(MappingSemaphore::Unaligned);
+    }
 }
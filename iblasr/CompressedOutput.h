@@ -0,0 +1,555 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+class BgzfStreambuf;
+
+//
+// Threads that compress and write the blocks of one or more BGZF
+// files: 'nThreads' workers deflate the queued blocks of any file, and
+// one writer thread appends each file's compressed blocks to it in
+// order.  At most QueueBlocksPerThread blocks per worker are queued
+// over all files, so a pool shared by many files (--splitByRef) bounds
+// their threads and their memory alike.  The threads start with the
+// first file, and are joined when the pool is destroyed, after all of
+// its files are closed.
+//
+class BgzfThreadPool
+{
+public:
+    static const int QueueBlocksPerThread = 4;
+
+    BgzfThreadPool(int nThreadsP, int levelP = Z_DEFAULT_COMPRESSION)
+        : nThreads(std::max(1, nThreadsP)), level(levelP), nQueued(0), stopping(false)
+    {
+    }
+
+    ~BgzfThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+        if (writer.joinable()) {
+            writer.join();
+        }
+    }
+
+private:
+    friend class BgzfStreambuf;
+
+    class Block
+    {
+    public:
+        enum State
+        {
+            Waiting,
+            Compressing,
+            Compressed
+        };
+        std::vector<char> input;
+        int inputBytes = 0;
+        std::vector<unsigned char> output;
+        int outputBytes = 0;
+        State state = Waiting;
+    };
+
+    int nThreads;
+    int level;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::vector<BgzfStreambuf *> streams;
+    std::vector<std::unique_ptr<Block> > spare;  // emptied blocks for reuse
+    int nQueued;                                 // blocks queued over all streams
+    bool stopping;
+    std::vector<std::thread> workers;
+    std::thread writer;
+
+    // Called with 'mutex' held.
+    void Attach(BgzfStreambuf *stream)
+    {
+        streams.push_back(stream);
+        if (workers.empty()) {
+            writer = std::thread(&BgzfThreadPool::WriteBlocks, this);
+            for (int t = 0; t < nThreads; t++) {
+                workers.push_back(std::thread(&BgzfThreadPool::CompressBlocks, this));
+            }
+        }
+    }
+
+    // Called with 'mutex' held, once the stream's queue is empty.
+    void Detach(BgzfStreambuf *stream)
+    {
+        streams.erase(std::find(streams.begin(), streams.end(), stream));
+    }
+
+    bool Full() const { return nQueued >= QueueBlocksPerThread * nThreads; }
+
+    std::unique_ptr<Block> NewBlock()
+    {
+        std::unique_ptr<Block> block;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (not spare.empty()) {
+                block = std::move(spare.back());
+                spare.pop_back();
+            }
+        }
+        if (not block) {
+            block.reset(new Block);
+            block->input.resize(BlockInputBytes());
+            block->output.resize(MaxBlockBytes());
+        }
+        block->state = Block::Waiting;
+        return block;
+    }
+
+    static int BlockInputBytes();
+    static int MaxBlockBytes();
+    void CompressBlocks();
+    void WriteBlocks();
+    static bool Compress(z_stream &zs, Block &block);
+    static void PutLittleEndian(unsigned char *out, std::uint32_t value, int nBytes);
+};
+
+//
+// A streambuf that writes BGZF, the blocked gzip of BAM and tabix.
+// The output is an ordinary multi-member gzip file, so zcat and gzip -d
+// read it as well as htslib does.
+//
+// Writers only copy text into a 64 KB block; a full block is queued
+// and compressed by a worker of a BgzfThreadPool, which also writes
+// the compressed blocks to the file in order.  Mapping threads, which
+// write while holding MappingSemaphore::Writer, thus never wait on zlib
+// or on the file system unless the pool's queue is full.  The pool is
+// the stream's own, of 'nThreads' workers, unless one is given.
+//
+// Flushing the stream (std::endl) does not end a block; Close() writes
+// the last partial block and the empty block that ends a BGZF file.
+//
+class BgzfStreambuf : public std::streambuf
+{
+public:
+    // Input bytes per block, as in htslib, so that any block fits in 64 KB.
+    static const int BlockInputBytes = 0xff00;
+    static const int MaxBlockBytes = 0x10000;
+
+    BgzfStreambuf(int nThreads, int level = Z_DEFAULT_COMPRESSION)
+        : BgzfStreambuf(std::make_shared<BgzfThreadPool>(nThreads, level))
+    {
+    }
+
+    BgzfStreambuf(std::shared_ptr<BgzfThreadPool> poolP)
+        : pool(std::move(poolP)), file(NULL), failed(false)
+    {
+    }
+
+    ~BgzfStreambuf() override { Close(); }
+
+    bool Open(const std::string &fileName)
+    {
+        file = std::fopen(fileName.c_str(), "wb");
+        if (file == NULL) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            pool->Attach(this);
+        }
+        NewInputBlock();
+        return true;
+    }
+
+    bool IsOpen() const { return file != NULL; }
+
+    //
+    // Compress what is left, end the file and wait until all of its
+    // blocks are written.  Returns false if any block could not be
+    // compressed or written.
+    //
+    bool Close()
+    {
+        if (file == NULL) {
+            return not failed;
+        }
+        if (pptr() > pbase()) {
+            SubmitInputBlock();
+        }
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            if (inputBlock) {
+                pool->spare.push_back(std::move(inputBlock));
+            }
+            pool->wakeup.wait(lock, [this] { return queue.empty(); });
+            pool->Detach(this);
+        }
+        static const unsigned char eofBlock[] = {0x1f, 0x8b, 8,   4,   0, 0, 0,    0, 0, 0xff,
+                                                 6,    0,    'B', 'C', 2, 0, 0x1b, 0, 3, 0,
+                                                 0,    0,    0,   0,   0, 0, 0,    0};
+        if (std::fwrite(eofBlock, sizeof(eofBlock), 1, file) != 1) {
+            failed = true;
+        }
+        if (std::fclose(file) != 0) {
+            failed = true;
+        }
+        file = NULL;
+        setp(NULL, NULL);
+        return not failed;
+    }
+
+    // Output is compressed if the file name ends in .gz or .bgz.
+    static bool IsCompressedName(const std::string &fileName)
+    {
+        for (const char *ext : {".gz", ".bgz"}) {
+            size_t n = std::strlen(ext);
+            if (fileName.size() > n and fileName.compare(fileName.size() - n, n, ext) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (file == NULL) {
+            return traits_type::eof();
+        }
+        SubmitInputBlock();
+        if (not traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        if (file == NULL) {
+            return 0;
+        }
+        std::streamsize written = 0;
+        while (written < n) {
+            if (pptr() == epptr()) {
+                SubmitInputBlock();
+            }
+            std::streamsize chunk = std::min<std::streamsize>(n - written, epptr() - pptr());
+            std::memcpy(pptr(), s + written, chunk);
+            pbump(int(chunk));
+            written += chunk;
+        }
+        return n;
+    }
+
+    // Blocks are only ended when full, however often the stream is flushed.
+    int sync() override { return failed ? -1 : 0; }
+
+private:
+    friend class BgzfThreadPool;
+    typedef BgzfThreadPool::Block Block;
+
+    std::shared_ptr<BgzfThreadPool> pool;
+    std::FILE *file;
+    std::unique_ptr<Block> inputBlock;
+    std::deque<std::unique_ptr<Block> > queue;  // in file order; guarded by pool->mutex
+    bool failed;                                // guarded by pool->mutex while open
+
+    void NewInputBlock()
+    {
+        inputBlock = pool->NewBlock();
+        setp(inputBlock->input.data(), inputBlock->input.data() + BlockInputBytes);
+    }
+
+    void SubmitInputBlock()
+    {
+        inputBlock->inputBytes = pptr() - pbase();
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->wakeup.wait(lock, [this] { return not pool->Full() or failed; });
+            queue.push_back(std::move(inputBlock));
+            pool->nQueued++;
+        }
+        pool->wakeup.notify_all();
+        NewInputBlock();
+    }
+};
+
+inline int BgzfThreadPool::BlockInputBytes() { return BgzfStreambuf::BlockInputBytes; }
+
+inline int BgzfThreadPool::MaxBlockBytes() { return BgzfStreambuf::MaxBlockBytes; }
+
+inline void BgzfThreadPool::CompressBlocks()
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    bool initialized = deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        Block *block = NULL;
+        BgzfStreambuf *stream = NULL;
+        for (BgzfStreambuf *s : streams) {
+            for (std::unique_ptr<Block> &b : s->queue) {
+                if (b->state == Block::Waiting) {
+                    block = b.get();
+                    stream = s;
+                    break;
+                }
+            }
+            if (block != NULL) {
+                break;
+            }
+        }
+        if (block == NULL) {
+            if (stopping) {
+                break;
+            }
+            wakeup.wait(lock);
+            continue;
+        }
+        block->state = Block::Compressing;
+        lock.unlock();
+        bool compressed = initialized and Compress(zs, *block);
+        lock.lock();
+        block->state = Block::Compressed;
+        stream->failed = stream->failed or not compressed;
+        wakeup.notify_all();
+    }
+    lock.unlock();
+    if (initialized) {
+        deflateEnd(&zs);
+    }
+}
+
+//
+// Streams may be attached and detached while a block is written, so
+// they are visited by index; one that moves is visited next round.
+//
+inline void BgzfThreadPool::WriteBlocks()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        bool wrote = false;
+        for (size_t s = 0; s < streams.size(); s++) {
+            BgzfStreambuf *stream = streams[s];
+            if (stream->queue.empty() or stream->queue.front()->state != Block::Compressed) {
+                continue;
+            }
+            std::unique_ptr<Block> block = std::move(stream->queue.front());
+            stream->queue.pop_front();
+            bool skip = stream->failed;
+            lock.unlock();
+            bool written =
+                skip or std::fwrite(block->output.data(), block->outputBytes, 1, stream->file) == 1;
+            lock.lock();
+            stream->failed = stream->failed or not written;
+            spare.push_back(std::move(block));
+            nQueued--;
+            wrote = true;
+        }
+        if (wrote) {
+            wakeup.notify_all();
+        } else if (stopping) {
+            return;
+        } else {
+            wakeup.wait(lock);
+        }
+    }
+}
+
+// Deflate the block into a BGZF member: gzip header with the BC
+// extra field holding the member size, raw deflate data, CRC32 and
+// input size.
+inline bool BgzfThreadPool::Compress(z_stream &zs, Block &block)
+{
+    static const int HeaderBytes = 18, FooterBytes = 8;
+    unsigned char *out = block.output.data();
+    deflateReset(&zs);
+    zs.next_in = reinterpret_cast<Bytef *>(block.input.data());
+    zs.avail_in = block.inputBytes;
+    zs.next_out = out + HeaderBytes;
+    zs.avail_out = MaxBlockBytes() - HeaderBytes - FooterBytes;
+    int status = deflate(&zs, Z_FINISH);
+    if (status != Z_STREAM_END) {
+        // Incompressible; a stored block always fits.
+        z_stream stored;
+        std::memset(&stored, 0, sizeof(stored));
+        deflateInit2(&stored, 0, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        stored.next_in = reinterpret_cast<Bytef *>(block.input.data());
+        stored.avail_in = block.inputBytes;
+        stored.next_out = out + HeaderBytes;
+        stored.avail_out = MaxBlockBytes() - HeaderBytes - FooterBytes;
+        status = deflate(&stored, Z_FINISH);
+        zs.total_out = stored.total_out;
+        deflateEnd(&stored);
+        if (status != Z_STREAM_END) {
+            return false;
+        }
+    }
+    int size = HeaderBytes + zs.total_out + FooterBytes;
+    static const unsigned char header[] = {0x1f, 0x8b, 8, 4, 0,   0,   0, 0,
+                                           0,    0xff, 6, 0, 'B', 'C', 2, 0};
+    std::memcpy(out, header, sizeof(header));
+    PutLittleEndian(out + 16, size - 1, 2);
+    std::uint32_t crc = crc32(
+        crc32(0, NULL, 0), reinterpret_cast<const Bytef *>(block.input.data()), block.inputBytes);
+    PutLittleEndian(out + size - FooterBytes, crc, 4);
+    PutLittleEndian(out + size - 4, block.inputBytes, 4);
+    block.outputBytes = size;
+    return true;
+}
+
+inline void BgzfThreadPool::PutLittleEndian(unsigned char *out, std::uint32_t value, int nBytes)
+{
+    for (int i = 0; i < nBytes; i++) {
+        out[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+//
+// An output file for text formats and --unaligned, written plainly or,
+// for --compressOutput or a .gz/.bgz name, through BgzfStreambuf.
+// Files that compress at the same time may share one 'pool' of threads.
+//
+class TextOutputFile : public std::ostream
+{
+public:
+    TextOutputFile() : std::ostream(NULL) {}
+
+    ~TextOutputFile() override
+    {
+        if (bgzf) {
+            bgzf->Close();
+        }
+    }
+
+    void Open(const std::string &fileNameP, bool compress, int nThreads,
+              std::shared_ptr<BgzfThreadPool> pool = nullptr)
+    {
+        fileName = fileNameP;
+        bool opened;
+        if (compress) {
+            bgzf.reset(pool ? new BgzfStreambuf(pool) : new BgzfStreambuf(nThreads));
+            opened = bgzf->Open(fileName);
+            rdbuf(bgzf.get());
+        } else {
+            opened = plain.open(fileName.c_str(), std::ios::out | std::ios::binary) != NULL;
+            rdbuf(&plain);
+        }
+        if (not opened) {
+            std::cout << "ERROR, could not open " << fileName << " for writing." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        clear();
+    }
+
+    bool IsOpen() const { return bgzf ? bgzf->IsOpen() : plain.is_open(); }
+
+    void Close()
+    {
+        bool closed = true;
+        if (bgzf) {
+            closed = bgzf->Close();
+        } else if (plain.is_open()) {
+            closed = plain.close() != NULL;
+        }
+        if (not closed or fail()) {
+            std::cout << "ERROR, could not write " << fileName << "." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+private:
+    std::string fileName;
+    std::filebuf plain;
+    std::unique_ptr<BgzfStreambuf> bgzf;
+};
+
+//
+// Feeds a writer that only takes a file name, such as pbbam's
+// SamWriter, into an std::ostream: the writer opens Path(), the write
+// end of a pipe, and a thread copies what it writes to 'out'.  Close()
+// must be called after the writer has closed its own descriptor.
+//
+class StreamPipe
+{
+public:
+    StreamPipe(std::ostream &outP) : out(outP), readFd(-1), writeFd(-1)
+    {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            std::cout << "ERROR, could not create a pipe for compressed output." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        readFd = fds[0];
+        writeFd = fds[1];
+        fcntl(readFd, F_SETFD, FD_CLOEXEC);
+        fcntl(writeFd, F_SETFD, FD_CLOEXEC);
+        copier = std::thread(&StreamPipe::Copy, this);
+    }
+
+    ~StreamPipe() { Close(); }
+
+    std::string Path() const { return "/dev/fd/" + std::to_string(writeFd); }
+
+    void Close()
+    {
+        if (writeFd < 0) {
+            return;
+        }
+        close(writeFd);
+        writeFd = -1;
+        copier.join();
+        close(readFd);
+        readFd = -1;
+    }
+
+private:
+    std::ostream &out;
+    int readFd;
+    int writeFd;
+    std::thread copier;
+
+    // 'out' may throw on failure, as blasr's output files do.
+    void Copy()
+    {
+        std::vector<char> buffer(BgzfStreambuf::BlockInputBytes);
+        ssize_t n;
+        try {
+            while ((n = read(readFd, buffer.data(), buffer.size())) != 0) {
+                if (n > 0) {
+                    out.write(buffer.data(), n);
+                } else if (errno != EINTR) {
+                    break;
+                }
+            }
+        } catch (std::ostream::failure &) {
+            std::cout << "ERROR writing to output file. The output drive may be full, or you  "
+                      << std::endl;
+            std::cout << "may not have proper write permissions." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+};
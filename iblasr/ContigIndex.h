@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <pbdata/metagenome/SequenceIndexDatabase.hpp>
+
+//
+// Contig lookup in the concatenated reference, shared by all mapping
+// threads and built once after the reference is loaded.
+//
+// Find() gives the same answer as SequenceIndexDatabase::SearchForIndex
+// -- the last contig starting at or before a position -- but searches
+// the contig starts in Eytzinger (breadth first) order: the first
+// levels of the implicit tree share a few cache lines, and the
+// children of a node are adjacent, so with millions of contigs a
+// lookup touches far fewer lines than a binary search over the sorted
+// starts.  The space delimited names that alignments report are
+// computed once, and IndexOfName() replaces the linear scan of
+// SequenceIndexDatabase::GetIndexOfSeqName by a hash table that is
+// only built when first needed.
+//
+class ContigIndex
+{
+public:
+    ContigIndex() : nStarts(0) {}
+
+    template <typename T_Sequence>
+    void Build(SequenceIndexDatabase<T_Sequence> &seqdb)
+    {
+        std::vector<DNALength> starts(seqdb.seqStartPos, seqdb.seqStartPos + seqdb.nSeqPos);
+        std::vector<std::string> fullNames, names;
+        for (int i = 0; i < seqdb.nSeqPos - 1; i++) {
+            fullNames.push_back(seqdb.names[i]);
+            names.push_back(seqdb.GetSpaceDelimitedName(i));
+        }
+        Build(starts, fullNames, names);
+    }
+
+    //
+    // 'starts' are the sorted start positions of the contigs followed
+    // by the end of the last one, as in SequenceIndexDatabase::seqStartPos;
+    // 'fullNames' are the titles of the contigs and 'names' their names
+    // up to the first space.
+    //
+    void Build(const std::vector<DNALength> &starts, const std::vector<std::string> &fullNamesP,
+               const std::vector<std::string> &namesP)
+    {
+        nStarts = starts.size();
+        tree.assign(nStarts + 1, 0);
+        rank.assign(nStarts + 1, 0);
+        std::size_t next = 0;
+        Fill(starts, next, 1);
+        fullNames = fullNamesP;
+        names = namesP;
+    }
+
+    int NumContigs() const { return names.size(); }
+
+    // The index of the contig that holds 'pos'.
+    int Find(DNALength pos) const
+    {
+        if (nStarts <= 1) {
+            return 0;
+        }
+        // Descend to the first start greater than 'pos', as upper_bound.
+        std::size_t k = 1;
+        while (k <= nStarts) {
+#if defined(__GNUC__)
+            // Clamped, as the nodes that far down may not exist.
+            __builtin_prefetch(tree.data() + std::min(PrefetchDistance * k, nStarts));
+#endif
+            k = 2 * k + (tree[k] <= pos);
+        }
+// Drop the right turns below the last left turn, and that turn.
+#if defined(__GNUC__)
+        k >>= __builtin_ffsll(~k);
+#else
+        while (k & 1) {
+            k >>= 1;
+        }
+        k >>= 1;
+#endif
+        std::size_t upper = k == 0 ? nStarts : rank[k];
+        return int(upper) - 1;
+    }
+
+    const std::string &Name(int index) const { return names[index]; }
+
+    // The first contig titled 'fullName', or -1.
+    int IndexOfName(const std::string &fullName) const
+    {
+        std::call_once(nameTableBuilt, [this]() {
+            nameTable.reserve(fullNames.size());
+            for (std::size_t i = 0; i < fullNames.size(); i++) {
+                nameTable.emplace(fullNames[i], int(i));
+            }
+        });
+        auto it = nameTable.find(fullName);
+        return it == nameTable.end() ? -1 : it->second;
+    }
+
+private:
+    // Nodes 16*k to 16*k+15 are four levels below node k, one cache
+    // line of starts ahead of the descent.
+    static const std::size_t PrefetchDistance = 16;
+
+    std::size_t nStarts;
+    std::vector<DNALength> tree;      // 1-based, in Eytzinger order
+    std::vector<std::uint32_t> rank;  // index in 'starts' of each node
+    std::vector<std::string> fullNames;
+    std::vector<std::string> names;
+    mutable std::once_flag nameTableBuilt;
+    mutable std::unordered_map<std::string, int> nameTable;
+
+    // In-order traversal of the implicit tree assigns the sorted starts.
+    void Fill(const std::vector<DNALength> &starts, std::size_t &next, std::size_t k)
+    {
+        if (k <= nStarts) {
+            Fill(starts, next, 2 * k);
+            tree[k] = starts[next];
+            rank[k] = next;
+            next++;
+            Fill(starts, next, 2 * k + 1);
+        }
+    }
+};
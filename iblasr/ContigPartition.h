@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+//
+// Splits contigs of the given lengths into at most 'nParts' runs of
+// consecutive contigs, for --splitByRef files and sawriter -shards.
+// A run is closed before a contig that would take it past 'capacity'
+// bases, so a contig of at least 'capacity' bases is a run of its own.
+// 'capacity' is the smallest number of bases, no less than 1/nParts
+// of the reference, for which that gives no more than 'nParts' runs;
+// the number of runs only falls as the capacity grows, so it is found
+// by bisection.  Returns the first contig of each run followed by the
+// number of contigs.
+//
+class ContigPartition
+{
+public:
+    static std::vector<int> Split(const std::vector<std::uint64_t> &lengths, int nParts)
+    {
+        std::uint64_t total = 0;
+        for (std::uint64_t length : lengths) {
+            total += length;
+        }
+        nParts = std::max(1, nParts);
+        std::uint64_t low = std::max<std::uint64_t>(1, (total + nParts - 1) / nParts);
+        std::uint64_t high = std::max(low, total);
+        std::vector<int> firsts;
+        while (low < high) {
+            std::uint64_t capacity = low + (high - low) / 2;
+            if (Split(lengths, capacity, firsts) <= nParts) {
+                high = capacity;
+            } else {
+                low = capacity + 1;
+            }
+        }
+        Split(lengths, low, firsts);
+        return firsts;
+    }
+
+private:
+    // Returns the number of runs of at most 'capacity' bases.
+    static int Split(const std::vector<std::uint64_t> &lengths, std::uint64_t capacity,
+                     std::vector<int> &firsts)
+    {
+        firsts.clear();
+        std::uint64_t runBases = 0;
+        for (size_t c = 0; c < lengths.size(); c++) {
+            if (firsts.empty() or (runBases > 0 and runBases + lengths[c] > capacity)) {
+                firsts.push_back(c);
+                runBases = 0;
+            }
+            runBases += lengths[c];
+        }
+        int nRuns = firsts.size();
+        firsts.push_back(lengths.size());
+        return nRuns;
+    }
+};
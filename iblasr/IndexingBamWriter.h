@@ -0,0 +1,260 @@
+#pragma once
+
+#include <LibBlasrConfig.h>
+
+#ifdef USE_PBBAM
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pbbam/BamHeader.h>
+#include <pbbam/BamRecord.h>
+#include <pbbam/BamWriter.h>
+#include <pbbam/IRecordWriter.h>
+#include <pbbam/PbiBuilder.h>
+
+//
+// Builds a BAM index (.bai) from the virtual offset and reference span
+// of each record as it is written, rather than by reading the BAM back.
+// Records must be added in coordinate order, with unplaced records
+// last, and each record ends where the next one starts; Write() takes
+// the virtual offset at which the last one ends.  The layout and binning
+// follow the SAM specification, section 5.
+//
+class BaiBuilder
+{
+public:
+    BaiBuilder(int nReferences) : references(nReferences), nNoCoordinate(0), hasPrevious(false) {}
+
+    void AddRecord(const PacBio::BAM::BamRecord &record, std::uint64_t vOffset)
+    {
+        EndPrevious(vOffset);
+        int refId = record.Impl().ReferenceId();
+        if (refId < 0 or refId >= int(references.size())) {
+            nNoCoordinate++;
+            return;
+        }
+        std::int64_t begin = record.Impl().Position();
+        std::int64_t end = begin + 1;
+        if (record.IsMapped()) {
+            end = std::max<std::int64_t>(record.ReferenceEnd(), begin + 1);
+        }
+        hasPrevious = true;
+        previous.refId = refId;
+        previous.bin = RegionToBin(begin, end);
+        previous.begin = begin;
+        previous.end = end;
+        previous.mapped = record.IsMapped();
+        previous.vOffset = vOffset;
+    }
+
+    // 'endOffset' is the virtual offset just past the last record.
+    void Write(const std::string &fileName, std::uint64_t endOffset)
+    {
+        EndPrevious(endOffset);
+        std::ofstream out(fileName.c_str(), std::ios::out | std::ios::binary);
+        out.write("BAI\1", 4);
+        Put<std::int32_t>(out, references.size());
+        for (Reference &ref : references) {
+            bool hasPseudoBin = ref.nMapped + ref.nUnmapped > 0;
+            Put<std::int32_t>(out, ref.bins.size() + (hasPseudoBin ? 1 : 0));
+            for (const auto &bin : ref.bins) {
+                Put<std::uint32_t>(out, bin.first);
+                Put<std::int32_t>(out, bin.second.size());
+                for (const auto &chunk : bin.second) {
+                    Put<std::uint64_t>(out, chunk.first);
+                    Put<std::uint64_t>(out, chunk.second);
+                }
+            }
+            if (hasPseudoBin) {
+                Put<std::uint32_t>(out, PseudoBin);
+                Put<std::int32_t>(out, 2);
+                Put<std::uint64_t>(out, ref.firstOffset);
+                Put<std::uint64_t>(out, ref.lastOffset);
+                Put<std::uint64_t>(out, ref.nMapped);
+                Put<std::uint64_t>(out, ref.nUnmapped);
+            }
+            // Windows no record starts in take the offset of the one before.
+            for (size_t w = 1; w < ref.linear.size(); w++) {
+                if (ref.linear[w] == 0) {
+                    ref.linear[w] = ref.linear[w - 1];
+                }
+            }
+            Put<std::int32_t>(out, ref.linear.size());
+            for (std::uint64_t offset : ref.linear) {
+                Put<std::uint64_t>(out, offset);
+            }
+        }
+        Put<std::uint64_t>(out, nNoCoordinate);
+    }
+
+    static int RegionToBin(std::int64_t begin, std::int64_t end)
+    {
+        --end;
+        int offset = ((1 << 18) - 1) / 7;
+        for (int shift = 14; shift <= 26; shift += 3) {
+            offset >>= 3;
+            if (begin >> shift == end >> shift) {
+                return offset + (begin >> shift);
+            }
+        }
+        return 0;
+    }
+
+private:
+    static const std::uint32_t PseudoBin = 37450;
+    static const int LinearWindowShift = 14;
+
+    class Reference
+    {
+    public:
+        std::map<std::uint32_t, std::vector<std::pair<std::uint64_t, std::uint64_t> > > bins;
+        std::vector<std::uint64_t> linear;
+        std::uint64_t firstOffset = 0, lastOffset = 0;
+        std::uint64_t nMapped = 0, nUnmapped = 0;
+    };
+
+    class Record
+    {
+    public:
+        int refId;
+        std::uint32_t bin;
+        std::int64_t begin, end;
+        bool mapped;
+        std::uint64_t vOffset;
+    };
+
+    std::vector<Reference> references;
+    std::uint64_t nNoCoordinate;
+    bool hasPrevious;
+    Record previous;
+
+    // The extent of a record is only known once the next one starts.
+    void EndPrevious(std::uint64_t endOffset)
+    {
+        if (not hasPrevious) {
+            return;
+        }
+        hasPrevious = false;
+        Reference &ref = references[previous.refId];
+        auto &chunks = ref.bins[previous.bin];
+        if (not chunks.empty() and chunks.back().second == previous.vOffset) {
+            chunks.back().second = endOffset;
+        } else {
+            chunks.push_back(std::make_pair(previous.vOffset, endOffset));
+        }
+        size_t firstWindow = previous.begin >> LinearWindowShift;
+        size_t lastWindow = (previous.end - 1) >> LinearWindowShift;
+        if (ref.linear.size() <= lastWindow) {
+            ref.linear.resize(lastWindow + 1, 0);
+        }
+        for (size_t w = firstWindow; w <= lastWindow; w++) {
+            if (ref.linear[w] == 0) {
+                ref.linear[w] = previous.vOffset;
+            }
+        }
+        if (ref.nMapped + ref.nUnmapped == 0) {
+            ref.firstOffset = previous.vOffset;
+        }
+        ref.lastOffset = endOffset;
+        (previous.mapped ? ref.nMapped : ref.nUnmapped)++;
+    }
+
+    // BAM indexes are little endian, as is every host blasr runs on.
+    template <typename T>
+    static void Put(std::ostream &out, T value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+};
+
+//
+// A BamWriter that builds the PacBio index (.pbi) and, for coordinate
+// sorted output, the BAM index (.bai) from each record's virtual offset
+// as it is written, so that no separate indexing pass over the output
+// is needed.  The indexes are written by Close(), or when the writer is
+// deleted.  pbbam flushes the BGZF queue before it takes a record's
+// offset, so the offsets are exact with any number of 'nThreads'.
+//
+class IndexingBamWriter : public PacBio::BAM::IRecordWriter
+{
+public:
+    IndexingBamWriter(const std::string &fileNameP, const PacBio::BAM::BamHeader &header, bool pbi,
+                      bool bai, size_t nThreads)
+        : fileName(fileNameP)
+        , writer(new PacBio::BAM::BamWriter(fileNameP, header,
+                                            PacBio::BAM::BamWriter::DefaultCompression, nThreads))
+    {
+        size_t nReferences = header.Sequences().size();
+        if (pbi) {
+            pbiBuilder.reset(new PacBio::BAM::PbiBuilder(fileName + ".pbi", nReferences, bai));
+        }
+        if (bai) {
+            baiBuilder.reset(new BaiBuilder(nReferences));
+        }
+    }
+
+    ~IndexingBamWriter() override { Close(); }
+
+    void Write(const PacBio::BAM::BamRecord &record) override
+    {
+        std::int64_t vOffset;
+        writer->Write(record, &vOffset);
+        if (pbiBuilder) {
+            pbiBuilder->AddRecord(record, vOffset);
+        }
+        if (baiBuilder) {
+            baiBuilder->AddRecord(record, vOffset);
+        }
+    }
+
+    void Write(const PacBio::BAM::BamRecordImpl &recordImpl) override
+    {
+        Write(PacBio::BAM::BamRecord(recordImpl));
+    }
+
+    void TryFlush() override { writer->TryFlush(); }
+
+    void Close()
+    {
+        if (not writer) {
+            return;
+        }
+        writer.reset();
+        if (pbiBuilder) {
+            pbiBuilder->Close();
+            pbiBuilder.reset();
+        }
+        if (baiBuilder) {
+            baiBuilder->Write(fileName + ".bai", EndOffset());
+            baiBuilder.reset();
+        }
+    }
+
+private:
+    static const int BgzfEofBytes = 28;
+
+    std::string fileName;
+    std::unique_ptr<PacBio::BAM::BamWriter> writer;
+    std::unique_ptr<PacBio::BAM::PbiBuilder> pbiBuilder;
+    std::unique_ptr<BaiBuilder> baiBuilder;
+
+    // Virtual offset of the empty BGZF block that ends a closed BAM.
+    std::uint64_t EndOffset() const
+    {
+        struct stat st;
+        if (stat(fileName.c_str(), &st) != 0 or st.st_size < BgzfEofBytes) {
+            return 0;
+        }
+        return std::uint64_t(st.st_size - BgzfEofBytes) << 16;
+    }
+};
+
+#endif
@@ -9,6 +9,10 @@
 #include <alignment/tuples/DNATuple.hpp>
 #include <alignment/tuples/TupleList.hpp>
 
+#include "BlasrProbes.h"
+
+#include <array>
+#include <cstdint>
 #include <vector>
 
 //
@@ -46,10 +50,26 @@ public:
     ClusterList revStrandClusterList;
 
     void Reset(void);
+
+    //
+    // Bytes reserved by each buffer, for the memory report.  The
+    // cluster lists are small and not counted.
+    //
+    static constexpr int NumFields = 27;
+    static const char *FieldName(int field);
+    void FieldBytes(std::array<std::uint64_t, NumFields> &bytes) const;
+
+private:
+    template <typename T>
+    static std::uint64_t Bytes(const std::vector<T> &v)
+    {
+        return v.capacity() * sizeof(T);
+    }
 };
 
 inline void MappingBuffers::Reset(void)
 {
+    BLASR_PROBE(buffers__reset);
     std::vector<int>().swap(hpInsScoreMat);
     std::vector<int>().swap(insScoreMat);
     std::vector<int>().swap(kbandScoreMat);
@@ -76,3 +96,67 @@ inline void MappingBuffers::Reset(void)
     std::vector<float>().swap(lnMatchPValueMat);
     std::vector<int>().swap(clusterNumBases);
 }
+
+inline const char *MappingBuffers::FieldName(int field)
+{
+    static const char *names[NumFields] = {"hpInsScoreMat",
+                                           "insScoreMat",
+                                           "kbandScoreMat",
+                                           "hpInsPathMat",
+                                           "insPathMat",
+                                           "kbandPathMat",
+                                           "scoreMat",
+                                           "pathMat",
+                                           "affineScoreMat",
+                                           "affinePathMat",
+                                           "matchPosList",
+                                           "rcMatchPosList",
+                                           "globalChainEndpointBuffer",
+                                           "sdpFragmentSet",
+                                           "sdpPrefixFragmentSet",
+                                           "sdpSuffixFragmentSet",
+                                           "sdpCachedTargetTupleList",
+                                           "sdpCachedTargetPrefixTupleList",
+                                           "sdpCachedTargetSuffixTupleList",
+                                           "sdpCachedMaxFragmentChain",
+                                           "probMat",
+                                           "optPathProbMat",
+                                           "lnSubPValueMat",
+                                           "lnInsPValueMat",
+                                           "lnDelPValueMat",
+                                           "lnMatchPValueMat",
+                                           "clusterNumBases"};
+    return names[field];
+}
+
+inline void MappingBuffers::FieldBytes(std::array<std::uint64_t, NumFields> &bytes) const
+{
+    int f = 0;
+    bytes[f++] = Bytes(hpInsScoreMat);
+    bytes[f++] = Bytes(insScoreMat);
+    bytes[f++] = Bytes(kbandScoreMat);
+    bytes[f++] = Bytes(hpInsPathMat);
+    bytes[f++] = Bytes(insPathMat);
+    bytes[f++] = Bytes(kbandPathMat);
+    bytes[f++] = Bytes(scoreMat);
+    bytes[f++] = Bytes(pathMat);
+    bytes[f++] = Bytes(affineScoreMat);
+    bytes[f++] = Bytes(affinePathMat);
+    bytes[f++] = Bytes(matchPosList);
+    bytes[f++] = Bytes(rcMatchPosList);
+    bytes[f++] = Bytes(globalChainEndpointBuffer);
+    bytes[f++] = Bytes(sdpFragmentSet);
+    bytes[f++] = Bytes(sdpPrefixFragmentSet);
+    bytes[f++] = Bytes(sdpSuffixFragmentSet);
+    bytes[f++] = Bytes(sdpCachedTargetTupleList.tupleList);
+    bytes[f++] = Bytes(sdpCachedTargetPrefixTupleList.tupleList);
+    bytes[f++] = Bytes(sdpCachedTargetSuffixTupleList.tupleList);
+    bytes[f++] = Bytes(sdpCachedMaxFragmentChain);
+    bytes[f++] = Bytes(probMat);
+    bytes[f++] = Bytes(optPathProbMat);
+    bytes[f++] = Bytes(lnSubPValueMat);
+    bytes[f++] = Bytes(lnInsPValueMat);
+    bytes[f++] = Bytes(lnDelPValueMat);
+    bytes[f++] = Bytes(lnMatchPValueMat);
+    bytes[f++] = Bytes(clusterNumBases);
+}
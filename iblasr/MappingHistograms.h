@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+#include "BlasrProbes.h"
+
+//
+// A log-bucketed latency histogram.  Values are nanoseconds.  Each
+// power of two is split into 2^SubBucketBits linear sub-buckets, so
+// any reported quantile is within 12.5% of the true value, while the
+// whole histogram is a fixed-size array that is cheap to merge.
+//
+class LatencyHistogram
+{
+public:
+    static constexpr int SubBucketBits = 3;
+    static constexpr int NumSubBuckets = 1 << SubBucketBits;
+    static constexpr int NumBuckets = (64 - SubBucketBits + 1) * NumSubBuckets;
+
+    std::array<std::uint64_t, NumBuckets> counts;
+    std::uint64_t count;
+    std::uint64_t total;
+    std::uint64_t max;
+
+    LatencyHistogram() { Reset(); }
+
+    void Reset()
+    {
+        counts.fill(0);
+        count = total = max = 0;
+    }
+
+    static int BucketIndex(std::uint64_t value)
+    {
+        if (value < std::uint64_t(NumSubBuckets)) {
+            return int(value);
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        int sub = int(value >> (exponent - SubBucketBits)) & (NumSubBuckets - 1);
+        return ((exponent - SubBucketBits + 1) << SubBucketBits) + sub;
+    }
+
+    // Largest value that falls in bucket 'index'.
+    static std::uint64_t BucketUpperBound(int index)
+    {
+        if (index < NumSubBuckets) {
+            return std::uint64_t(index);
+        }
+        int exponent = (index >> SubBucketBits) + SubBucketBits - 1;
+        int sub = index & (NumSubBuckets - 1);
+        int shift = exponent - SubBucketBits;
+        std::uint64_t lower = std::uint64_t(NumSubBuckets + sub) << shift;
+        return lower + ((std::uint64_t(1) << shift) - 1);
+    }
+
+    void Add(std::uint64_t value)
+    {
+        ++counts[BucketIndex(value)];
+        ++count;
+        total += value;
+        max = std::max(max, value);
+    }
+
+    void Merge(const LatencyHistogram &rhs)
+    {
+        for (int b = 0; b < NumBuckets; b++) {
+            counts[b] += rhs.counts[b];
+        }
+        count += rhs.count;
+        total += rhs.total;
+        max = std::max(max, rhs.max);
+    }
+
+    // Returns the upper bound of the bucket holding quantile q in [0,1].
+    std::uint64_t Quantile(double q) const
+    {
+        if (count == 0) {
+            return 0;
+        }
+        std::uint64_t rank = std::uint64_t(q * count + 0.5);
+        rank = std::max<std::uint64_t>(1, std::min(rank, count));
+        std::uint64_t cumulative = 0;
+        for (int b = 0; b < NumBuckets; b++) {
+            cumulative += counts[b];
+            if (cumulative >= rank) {
+                return std::min(BucketUpperBound(b), max);
+            }
+        }
+        return max;
+    }
+
+    std::uint64_t Mean() const { return (count == 0) ? 0 : total / count; }
+};
+
+//
+// Stages of mapping a single read that are timed per invocation.  The
+// order here is the order rows are printed in, so only append.
+//
+enum class MappingStage
+{
+    ReaderWait,
+    MapToGenome,
+    SortMatchPosList,
+    FindMaxIncreasingInterval,
+    AlignIntervals,
+    RefineAlignments,
+    StoreMapQVs,
+    MapRead,
+    WriterWait,
+    PrintAlignments,
+    NumStages
+};
+
+inline const char *MappingStageName(MappingStage stage)
+{
+    switch (stage) {
+        case MappingStage::ReaderWait:
+            return "readerWait";
+        case MappingStage::MapToGenome:
+            return "mapToGenome";
+        case MappingStage::SortMatchPosList:
+            return "sortMatchPosList";
+        case MappingStage::FindMaxIncreasingInterval:
+            return "findMaxIncreasingInterval";
+        case MappingStage::AlignIntervals:
+            return "alignIntervals";
+        case MappingStage::RefineAlignments:
+            return "refineAlignments";
+        case MappingStage::StoreMapQVs:
+            return "storeMapQVs";
+        case MappingStage::MapRead:
+            return "mapRead";
+        case MappingStage::WriterWait:
+            return "writerWait";
+        case MappingStage::PrintAlignments:
+            return "printAlignments";
+        default:
+            return "unknown";
+    }
+}
+
+//
+// Per-thread latency histograms for every MappingStage.  Each thread
+// owns one of these in its MappingData, and the main thread merges them
+// with Collect() when it collects the MappingMetrics.
+//
+class MappingHistograms
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    static constexpr int NumStages = int(MappingStage::NumStages);
+
+    std::array<LatencyHistogram, NumStages> stages;
+    std::array<Clock::time_point, NumStages> startTimes;
+    // Nanoseconds per stage since ResetReadTotals(), for ReadTrace.
+    std::array<std::uint64_t, NumStages> readTotals;
+    // Stages are only timed for --latencyMetrics or --traceFile, so that
+    // other runs do not read the clock around every stage.
+    bool enabled;
+
+    MappingHistograms() : enabled(false) { readTotals.fill(0); }
+
+    void Tick(MappingStage stage)
+    {
+        if (not enabled) {
+            return;
+        }
+        BLASR_PROBE1(stage__start, int(stage));
+        startTimes[int(stage)] = Clock::now();
+    }
+
+    void Tock(MappingStage stage)
+    {
+        if (not enabled) {
+            return;
+        }
+        std::uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    Clock::now() - startTimes[int(stage)])
+                                    .count();
+        Add(stage, elapsed);
+        readTotals[int(stage)] += elapsed;
+        BLASR_PROBE2(stage__end, int(stage), elapsed);
+    }
+
+    void ResetReadTotals() { readTotals.fill(0); }
+
+    void Add(MappingStage stage, std::uint64_t nanoseconds) { stages[int(stage)].Add(nanoseconds); }
+
+    void Reset()
+    {
+        for (LatencyHistogram &h : stages) {
+            h.Reset();
+        }
+    }
+
+    const LatencyHistogram &operator[](MappingStage stage) const { return stages[int(stage)]; }
+
+    void Collect(const MappingHistograms &rhs)
+    {
+        for (int s = 0; s < NumStages; s++) {
+            stages[s].Merge(rhs.stages[s]);
+        }
+    }
+
+    //
+    // Print one tab separated row per stage with times in microseconds.
+    // Rows are always printed in MappingStage order, including stages
+    // that were never entered, so that files from different releases
+    // can be compared with diff.
+    //
+    void PrintTable(std::ostream &out) const
+    {
+        out << "stage\tcount\tmean_us\tp50_us\tp90_us\tp99_us\tmax_us" << std::endl;
+        out << std::fixed << std::setprecision(3);
+        for (int s = 0; s < NumStages; s++) {
+            const LatencyHistogram &h = stages[s];
+            out << MappingStageName(MappingStage(s)) << "\t" << h.count << "\t" << h.Mean() / 1000.0
+                << "\t" << h.Quantile(0.50) / 1000.0 << "\t" << h.Quantile(0.90) / 1000.0 << "\t"
+                << h.Quantile(0.99) / 1000.0 << "\t" << h.max / 1000.0 << std::endl;
+        }
+    }
+};
@@ -2,7 +2,20 @@
 
 #include <pthread.h>
 
+#include "ContigIndex.h"
+#include "MappingHistograms.h"
 #include "MappingParameters.h"
+#include "MappingProfiler.h"
+#include "MappingProgress.h"
+#include "MappingSemaphores.h"
+#include "MemoryReport.h"
+#include "ReadTrace.h"
+#include "ReferenceShards.h"
+#include "ShardedReads.h"
+#include "SideOutput.h"
+#include "SplitByRefOutput.h"
+#include "TargetRestriction.h"
+#include "ThreadOutput.h"
 
 #include <alignment/MappingMetrics.hpp>
 #include <alignment/bwt/BWT.hpp>
@@ -30,9 +43,18 @@ public:
     BWT *bwtPtr;
     T_GenomeSequence *referenceSeqPtr;
     SequenceIndexDatabase<FASTASequence> *seqDBPtr;
+    const ContigIndex *contigIndexPtr;        // shared lookup into seqDBPtr
+    ShardCycle *shardCyclePtr;                // for a sharded suffix array, otherwise NULL
+    ShardedReads *shardedReadsPtr;            // the thread's batch while mapping to shards
+    const TargetRestriction *restrictionPtr;  // for --restrictTo, otherwise NULL
     TupleCountTable<T_GenomeSequence, T_Tuple> *ctabPtr;
     MappingParameters params;
     MappingMetrics metrics;
+    MappingHistograms histograms;
+    MappingThreadProgress progress;
+    MappingThreadMemory memory;
+    MappingSemaphoreStats semaphoreStats;
+    ReadTrace trace;
     RegionTable *regionTablePtr;
     ReaderAgglomerate *reader;
     std::ostream *outFilePtr;
@@ -40,6 +62,18 @@ public:
     std::ostream *anchorFilePtr;
     std::ostream *clusterFilePtr;
     std::ostream *lcpBoundsOutPtr;
+    std::ostream *traceFilePtr;
+#ifdef USE_PBBAM
+    PacBio::BAM::IRecordWriter *bamWriterPtr;
+    PacBio::BAM::IRecordWriter *unalignedBamWriterPtr;  // for BAM --unaligned
+#endif
+    ThreadOutput *threadOutput;     // for --outputByThread, otherwise NULL
+    SplitByRefOutput *splitOutput;  // for --splitByRef, otherwise NULL
+    SideOutput anchorOutput;
+    SideOutput clusterOutput;
+    SideOutput lcpBoundsOutput;
+    bool sideOutputSampled;  // whether this ZMW is written to the side outputs
+    int threadIndex;
 
     // Declare a semaphore for blocking on reading from the same hdhf file.
 
@@ -91,6 +125,10 @@ public:
         suffixArrayPtr = saP;
         referenceSeqPtr = refP;
         seqDBPtr = seqDBP;
+        contigIndexPtr = NULL;
+        shardCyclePtr = NULL;
+        shardedReadsPtr = NULL;
+        restrictionPtr = NULL;
         ctabPtr = ctabP;
         regionTablePtr = regionTableP;
         params = paramsP;
@@ -99,5 +137,33 @@ public:
         unalignedFilePtr = unalignedFileP;
         anchorFilePtr = anchorFilePtrP;
         clusterFilePtr = clusterFilePtrP;
+#ifdef USE_PBBAM
+        bamWriterPtr = NULL;
+        unalignedBamWriterPtr = NULL;
+#endif
+        threadOutput = NULL;
+        splitOutput = NULL;
+        sideOutputSampled = true;
+        histograms.enabled = paramsP.latencyMetricsFileName != "" or paramsP.traceFileName != "";
+    }
+
+    //
+    // Buffer --anchors, --clusters and --lcpBounds in this thread; call
+    // after Initialize() and after setting lcpBoundsOutPtr.
+    //
+    void OpenSideOutputs(MappingSemaphores &semaphores)
+    {
+        bool lock = params.nProc > 1;
+        anchorOutput.Open(params.anchorFileName != "" ? anchorFilePtr : NULL, semaphores,
+                          MappingSemaphore::Writer, lock);
+        clusterOutput.Open(clusterFilePtr, semaphores, MappingSemaphore::HitCluster, lock);
+        lcpBoundsOutput.Open(lcpBoundsOutPtr, semaphores, MappingSemaphore::LcpBounds, lock);
+    }
+
+    void FlushSideOutputs()
+    {
+        anchorOutput.Flush();
+        clusterOutput.Flush();
+        lcpBoundsOutput.Flush();
     }
 };
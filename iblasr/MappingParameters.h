@@ -131,8 +131,18 @@ public:
     float minPctAccuracy;    // [0, 100]
     bool refineAlignments;
     int nCandidates;
+    int shardBatchSize;  // ZMWs per thread mapped to each suffix array shard
     bool doGlobalAlignment;
     std::string tempDirectory;
+    bool sortedOutput;
+    int sortMemory;  // MB
+    bool pbiOutput;
+    bool compressOutput;
+    int compressThreads;
+    bool splitByRef;
+    int splitMaxFiles;
+    std::string restrictToFileName;
+    bool offTargetMapQV;
     bool useTitleTable;
     std::string titleTableName;
     bool readSeparateRegionTable;
@@ -151,9 +161,22 @@ public:
     bool printUnaligned;
     bool noPrintUnalignedSeqs;  // print unaligned reads names only.
     std::string unalignedFileName;
+    bool unalignedFastq;  // by extension of unalignedFileName
+    bool unalignedBam;
     std::string metricsFileName;
     std::string lcpBoundsFileName;
     std::string fullMetricsFileName;
+    std::string latencyMetricsFileName;
+    int progressInterval;
+    std::string statusFileName;
+    std::string traceFileName;
+    float traceSampleRate;
+    float debugSampleRate;
+    std::string profileFileName;
+    int profileThread;
+    bool profileOnSignal;
+    std::string memoryReportFileName;
+    bool estimateMemory;
     bool printSubreadTitle;
     bool useCcs;
     bool useAllSubreadsInCcs;
@@ -179,6 +202,8 @@ public:
     int substitutionPrior;
     int globalDeletionPrior;
     bool outputByThread;
+    bool keepThreadOutput;
+    bool mergeInZmwOrder;
     int recurseOver;
     bool allowAdjacentIndels;
     bool separateGaps;
@@ -247,6 +272,7 @@ public:
         outFileName = "";
         nBest = 10;
         nCandidates = 10;
+        shardBatchSize = 1000;
         printWindow = 0;
         doCondense = 0;
         do4BitComp = 0;
@@ -307,6 +333,15 @@ public:
         minPctAccuracy = 0;
         doGlobalAlignment = false;
         tempDirectory = "";
+        sortedOutput = false;
+        sortMemory = 768;
+        pbiOutput = false;
+        compressOutput = false;
+        compressThreads = 2;
+        splitByRef = false;
+        splitMaxFiles = 64;
+        restrictToFileName = "";
+        offTargetMapQV = false;
         useTitleTable = false;
         titleTableName = "";
         readSeparateRegionTable = false;
@@ -323,10 +358,23 @@ public:
         setIgnoreHQRegions = false;
         printUnaligned = false;
         unalignedFileName = "";
+        unalignedFastq = false;
+        unalignedBam = false;
         noPrintUnalignedSeqs = false;
         globalChainType = 0;
         metricsFileName = "";
         fullMetricsFileName = "";
+        latencyMetricsFileName = "";
+        progressInterval = 0;
+        statusFileName = "";
+        traceFileName = "";
+        traceSampleRate = 1;
+        debugSampleRate = 1;
+        profileFileName = "";
+        profileThread = -1;
+        profileOnSignal = false;
+        memoryReportFileName = "";
+        estimateMemory = false;
         doSensitiveSearch = false;
         emulateNucmer = false;
         refineBetweenAnchorsOnly = false;
@@ -358,6 +406,8 @@ public:
         substitutionPrior = 20;
         globalDeletionPrior = 13;
         outputByThread = false;
+        keepThreadOutput = false;
+        mergeInZmwOrder = false;
         recurseOver = 10000;
         allowAdjacentIndels = false;
         separateGaps = false;
@@ -577,9 +627,28 @@ public:
         if (countTableName != "") {
             useCountTable = true;
         }
-        if (metricsFileName != "" or fullMetricsFileName != "") {
+        if (metricsFileName != "" or fullMetricsFileName != "" or latencyMetricsFileName != "") {
             storeMetrics = true;
         }
+        if (statusFileName != "" and progressInterval == 0) {
+            progressInterval = 10;
+        }
+        if (profileFileName != "") {
+#ifndef USE_GOOGLE_PROFILER
+            std::cout << "ERROR, --profile requires blasr to be built with gperftools "
+                         "(-Dgperftools=true)."
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+#endif
+            if (profileThread >= nProc) {
+                std::cout << "ERROR, --profileThread must be less than --nproc." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        } else if (profileThread >= 0 or profileOnSignal) {
+            std::cout << "ERROR, --profileThread and --profileOnSignal require --profile."
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
         if (useCcsOnly) {
             useCcs = true;
         }
@@ -591,6 +660,16 @@ public:
         }
         if (unalignedFileName != "") {
             printUnaligned = true;
+            std::string name = unalignedFileName;
+            for (const std::string ext : {".gz", ".bgz"}) {
+                if (name.size() > ext.size() and
+                    name.compare(name.size() - ext.size(), ext.size(), ext) == 0) {
+                    name.erase(name.size() - ext.size());
+                }
+            }
+            std::string ext = name.substr(std::min(name.size(), name.rfind('.')));
+            unalignedFastq = ext == ".fastq" or ext == ".fq";
+            unalignedBam = ext == ".bam" and name == unalignedFileName;
         }
         if (regionTableFileName != "") {
             useRegionTable = true;
@@ -677,13 +756,6 @@ public:
                 std::cout << "ERROR, SAM output file must be specified." << std::endl;
                 std::exit(EXIT_FAILURE);
             }
-            // VR Need to see what happens if printing SAM
-            // VR Check with Derek regarding sam_via_bam
-            if (outputByThread) {
-                std::cout << "ERROR, could not output alignments by threads in BAM format."
-                          << std::endl;
-                std::exit(EXIT_FAILURE);
-            }
 #endif
         }
 
@@ -712,15 +784,68 @@ public:
                 std::cout << "ERROR, BAM output file must be specified." << std::endl;
                 std::exit(EXIT_FAILURE);
             }
-            // VR Need to see what happens if printing SAM
-            // VR Check with Derek regarding sam_via_bam
-            if (outputByThread) {
-                std::cout << "ERROR, could not output alignments by threads in BAM format."
+#endif
+        }
+
+        if (sortedOutput and not printBAM) {
+            std::cout << "ERROR, --sorted requires --bam or --sam." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (outputByThread and nProc == 1) {
+            outputByThread = false;
+        }
+        if (outputByThread) {
+            if (outFileName == "") {
+                std::cout << "ERROR, --outputByThread requires --out." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            if (sortedOutput or pbiOutput) {
+                std::cout << "ERROR, --outputByThread cannot be used with --sorted or --pbi."
                           << std::endl;
                 std::exit(EXIT_FAILURE);
             }
+        }
+        if ((keepThreadOutput or mergeInZmwOrder) and not outputByThread) {
+            std::cout << "ERROR, --keepThreadOutput and --mergeInZmwOrder require "
+                         "--outputByThread and --nproc > 1."
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (pbiOutput and (not printBAM or sam_via_bam)) {
+            std::cout << "ERROR, --pbi requires --bam." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (splitByRef) {
+            if (outFileName == "") {
+                std::cout << "ERROR, --splitByRef requires --out." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            if (sortedOutput or pbiOutput or outputByThread) {
+                std::cout << "ERROR, --splitByRef cannot be used with --sorted, --pbi or "
+                             "--outputByThread."
+                          << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        if (offTargetMapQV and restrictToFileName == "") {
+            std::cout << "ERROR, --offTargetMapQV requires --restrictTo." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (unalignedBam) {
+#ifdef USE_PBBAM
+            if (queryFileType != FileType::PBBAM and queryFileType != FileType::PBDATASET) {
+                std::cout << "ERROR, BAM --unaligned output requires BAM or DATASET input."
+                          << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+#else
+            REQUIRE_PBBAM_ERROR();
 #endif
         }
+        if (compressOutput and outFileName == "" and unalignedFileName == "") {
+            std::cout << "ERROR, --compressOutput requires --out or --unaligned." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
 
         if (limsAlign != 0) {
             mapSubreadsSeparately = false;
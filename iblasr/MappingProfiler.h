@@ -0,0 +1,177 @@
+#pragma once
+
+#include <pthread.h>
+#include <signal.h>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef USE_GOOGLE_PROFILER
+#include "gperftools/profiler.h"
+#endif
+
+#include <pbdata/utils/TimeUtils.hpp>
+
+//
+// CPU profiling of the mapping phase with gperftools, for --profile.
+// Profiling starts when mapping starts, so index loading does not
+// dilute the profile, or, with --profileOnSignal, only once SIGUSR2 is
+// received.  Every SIGUSR2 toggles profiling, and each profiling
+// session is written to its own file: 'file', then 'file.1', ...
+//
+// gperftools supports one profile per process, so a per-thread profile
+// is made by restricting sampling to one mapping thread with
+// --profileThread.  Mapping threads identify themselves with
+// EnterThread().
+//
+// BlockSignal() must be called by main before any other thread is
+// created, so that every thread inherits a mask with SIGUSR2 blocked
+// and the signal is only ever taken by sigwait() in the watcher thread
+// started by Start().  Without profiler support, every method does
+// nothing.
+//
+class MappingProfiler
+{
+public:
+    MappingProfiler() : threadIndex(-1), sessions(0), profiling(false), stopping(false) {}
+
+    ~MappingProfiler() { Stop(); }
+
+    // Blocks SIGUSR2 in the calling thread and the threads it creates.
+    static void BlockSignal()
+    {
+#ifdef USE_GOOGLE_PROFILER
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR2);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+#endif
+    }
+
+    //
+    // fileName - base name of profile files; "" disables profiling.
+    // thread   - index of the only mapping thread to sample, or -1 for all.
+    // onSignal - wait for SIGUSR2 rather than starting immediately.
+    //
+    void Start(const std::string &fileName, int thread, bool onSignal)
+    {
+#ifdef USE_GOOGLE_PROFILER
+        if (fileName == "") {
+            return;
+        }
+        baseFileName = fileName;
+        threadIndex = thread;
+        stopping = false;
+        watcherThread = std::thread(&MappingProfiler::Watch, this);
+
+        if (not onSignal) {
+            Toggle();
+        }
+#else
+        (void)fileName;
+        (void)thread;
+        (void)onSignal;
+#endif
+    }
+
+    // Stop the watcher and write out the profile in progress, if any.
+    void Stop()
+    {
+        if (not watcherThread.joinable()) {
+            return;
+        }
+        stopping = true;
+        pthread_kill(watcherThread.native_handle(), SIGUSR2);
+        watcherThread.join();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (profiling) {
+            EndSession();
+        }
+    }
+
+    // Called by each mapping thread with its index, before mapping.
+    static void EnterThread(int index)
+    {
+        mappingThreadIndex = index;
+#ifdef USE_GOOGLE_PROFILER
+        ProfilerRegisterThread();
+#endif
+    }
+
+private:
+    std::string baseFileName;
+    int threadIndex;
+    int sessions;
+    bool profiling;
+    std::atomic<bool> stopping;
+    std::mutex mutex;
+    std::thread watcherThread;
+
+    inline static thread_local int mappingThreadIndex = -1;
+    inline static int sampledThreadIndex = -1;
+
+    static int InSampledThread(void *) { return mappingThreadIndex == sampledThreadIndex; }
+
+    void Watch()
+    {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR2);
+        int signal;
+        while (sigwait(&signals, &signal) == 0 and not stopping) {
+            Toggle();
+        }
+    }
+
+    void Toggle()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (profiling) {
+            EndSession();
+        } else {
+            BeginSession();
+        }
+    }
+
+    void BeginSession()
+    {
+#ifdef USE_GOOGLE_PROFILER
+        std::ostringstream fileName;
+        fileName << baseFileName;
+        if (sessions > 0) {
+            fileName << "." << sessions;
+        }
+        int started;
+        if (threadIndex >= 0) {
+            sampledThreadIndex = threadIndex;
+            ProfilerOptions options;
+            options.filter_in_thread = &MappingProfiler::InSampledThread;
+            options.filter_in_thread_arg = NULL;
+            started = ProfilerStartWithOptions(fileName.str().c_str(), &options);
+        } else {
+            started = ProfilerStart(fileName.str().c_str());
+        }
+        if (not started) {
+            std::cerr << "[WARNING] " << GetTimestamp() << " [blasr] could not start profiling to "
+                      << fileName.str() << std::endl;
+            return;
+        }
+        std::cerr << "[INFO] " << GetTimestamp() << " [blasr] profiling to " << fileName.str()
+                  << std::endl;
+        ++sessions;
+        profiling = true;
+#endif
+    }
+
+    void EndSession()
+    {
+#ifdef USE_GOOGLE_PROFILER
+        ProfilerStop();
+        std::cerr << "[INFO] " << GetTimestamp() << " [blasr] profiling stopped" << std::endl;
+#endif
+        profiling = false;
+    }
+};
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pbdata/utils/TimeUtils.hpp>
+
+#include "ProcessMemory.h"
+
+//
+// Work counters for one mapping thread.  They are written only by the
+// owning thread and read concurrently by the progress reporter, so
+// every access is a relaxed atomic; the reporter only needs a recent
+// value, not a consistent snapshot across counters.
+//
+class MappingThreadProgress
+{
+public:
+    std::atomic<std::uint64_t> records;  // input records consumed
+    std::atomic<std::uint64_t> zmws;
+    std::atomic<std::uint64_t> subreads;
+    std::atomic<std::uint64_t> alignedBases;
+    std::atomic<std::uint64_t> dpCells;
+    std::atomic<std::uint64_t> busyNanoseconds;  // excludes reader/writer waits
+    std::atomic<std::uint64_t> bufferBytes;      // held in MappingBuffers and candidates
+
+    MappingThreadProgress()
+        : records(0)
+        , zmws(0)
+        , subreads(0)
+        , alignedBases(0)
+        , dpCells(0)
+        , busyNanoseconds(0)
+        , bufferBytes(0)
+    {
+    }
+
+    static void Add(std::atomic<std::uint64_t> &counter, std::uint64_t value)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    static void Set(std::atomic<std::uint64_t> &counter, std::uint64_t value)
+    {
+        counter.store(value, std::memory_order_relaxed);
+    }
+
+    static std::uint64_t Get(const std::atomic<std::uint64_t> &counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+};
+
+//
+// Periodically prints a one line summary of mapping throughput to
+// stderr, and optionally rewrites a small JSON status file, so that a
+// stalled or I/O-starved job can be spotted from outside the process.
+// The status file is written to a temporary name and renamed over the
+// old one, so readers never see a partially written file.
+//
+class MappingProgressReporter
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    MappingProgressReporter() : intervalSeconds(0), expectedRecords(0), finished(false) {}
+
+    ~MappingProgressReporter() { Stop(); }
+
+    //
+    // threads          - per-thread counters to sum; must outlive Stop().
+    // expected         - number of input records, or 0 when unknown.
+    // interval         - seconds between reports; 0 disables reporting.
+    // statusFile       - file rewritten at every report, or "" for none.
+    //
+    void Start(const std::vector<const MappingThreadProgress *> &threads, std::uint64_t expected,
+               int interval, const std::string &statusFile)
+    {
+        if (interval <= 0) {
+            return;
+        }
+        threadProgress = threads;
+        expectedRecords = expected;
+        intervalSeconds = interval;
+        statusFileName = statusFile;
+        finished = false;
+        startTime = lastTime = Clock::now();
+        last = Totals();
+        lastBusy.assign(threadProgress.size(), 0);
+        reporterThread = std::thread(&MappingProgressReporter::Run, this);
+    }
+
+    // Stops the reporter and writes a final report.
+    void Stop()
+    {
+        if (not reporterThread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+        }
+        wakeup.notify_all();
+        reporterThread.join();
+        Report(true);
+    }
+
+private:
+    struct Counts
+    {
+        std::uint64_t records = 0;
+        std::uint64_t zmws = 0;
+        std::uint64_t subreads = 0;
+        std::uint64_t alignedBases = 0;
+        std::uint64_t dpCells = 0;
+        std::uint64_t bufferBytes = 0;
+    };
+
+    std::vector<const MappingThreadProgress *> threadProgress;
+    std::string statusFileName;
+    int intervalSeconds;
+    std::uint64_t expectedRecords;
+
+    std::thread reporterThread;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool finished;
+
+    Clock::time_point startTime, lastTime;
+    Counts last;
+    std::vector<std::uint64_t> lastBusy;
+
+    Counts Totals() const
+    {
+        Counts c;
+        for (const MappingThreadProgress *t : threadProgress) {
+            c.records += MappingThreadProgress::Get(t->records);
+            c.zmws += MappingThreadProgress::Get(t->zmws);
+            c.subreads += MappingThreadProgress::Get(t->subreads);
+            c.alignedBases += MappingThreadProgress::Get(t->alignedBases);
+            c.dpCells += MappingThreadProgress::Get(t->dpCells);
+            c.bufferBytes += MappingThreadProgress::Get(t->bufferBytes);
+        }
+        return c;
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (not finished) {
+            if (wakeup.wait_for(lock, std::chrono::seconds(intervalSeconds),
+                                [this] { return finished; })) {
+                break;
+            }
+            lock.unlock();
+            Report(false);
+            lock.lock();
+        }
+    }
+
+    static double Seconds(Clock::duration d) { return std::chrono::duration<double>(d).count(); }
+
+    static std::string FormatDuration(double seconds)
+    {
+        long s = long(seconds + 0.5);
+        std::ostringstream out;
+        out << std::setfill('0') << std::setw(2) << s / 3600 << ":" << std::setw(2) << (s / 60) % 60
+            << ":" << std::setw(2) << s % 60;
+        return out.str();
+    }
+
+    void Report(bool final)
+    {
+        Clock::time_point now = Clock::now();
+        double elapsed = Seconds(now - startTime);
+        double interval = Seconds(now - lastTime);
+        if (interval <= 0) {
+            interval = 1e-9;
+        }
+        Counts cur = Totals();
+
+        // Rates are over the last interval so that a stall shows up
+        // immediately, ETA is over the whole run so that it is stable.
+        double zmwRate = (cur.zmws - last.zmws) / interval;
+        double subreadRate = (cur.subreads - last.subreads) / interval;
+        double baseRate = (cur.alignedBases - last.alignedBases) / interval;
+        double cellRate = (cur.dpCells - last.dpCells) / interval;
+
+        bool knownTotal = expectedRecords > 0;
+        double percent = 0, eta = -1;
+        if (knownTotal) {
+            percent = std::min(100.0, 100.0 * cur.records / expectedRecords);
+            if (cur.records > 0 and elapsed > 0) {
+                double remaining =
+                    expectedRecords > cur.records ? expectedRecords - cur.records : 0;
+                eta = remaining / (cur.records / elapsed);
+            }
+        }
+
+        std::vector<double> utilization(threadProgress.size());
+        for (size_t i = 0; i < threadProgress.size(); i++) {
+            std::uint64_t busy = MappingThreadProgress::Get(threadProgress[i]->busyNanoseconds);
+            utilization[i] = std::min(1.0, (busy - lastBusy[i]) * 1e-9 / interval);
+            lastBusy[i] = busy;
+        }
+
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1) << "[INFO] " << GetTimestamp()
+             << " [blasr] progress: " << cur.zmws << " zmws (" << zmwRate << "/s), " << cur.subreads
+             << " subreads (" << subreadRate << "/s), " << std::setprecision(0) << baseRate
+             << " aligned bases/s, " << cellRate << " DP cells/s";
+        if (knownTotal) {
+            line << std::setprecision(1) << ", " << percent << "% of input";
+            if (eta >= 0) {
+                line << ", ETA " << FormatDuration(eta);
+            }
+        }
+        std::uint64_t residentBytes = ProcessMemory::ResidentBytes();
+        line << std::setprecision(0) << ", buffers " << cur.bufferBytes / 1048576.0
+             << " MB, resident " << residentBytes / 1048576.0 << " MB";
+        line << ", utilization";
+        for (double u : utilization) {
+            line << " " << std::setprecision(0) << 100 * u << "%";
+        }
+        std::cerr << line.str() << std::endl;
+
+        if (statusFileName != "") {
+            WriteStatus(final, elapsed, cur, zmwRate, subreadRate, baseRate, cellRate, knownTotal,
+                        percent, eta, utilization, residentBytes);
+        }
+        last = cur;
+        lastTime = now;
+    }
+
+    void WriteStatus(bool final, double elapsed, const Counts &cur, double zmwRate,
+                     double subreadRate, double baseRate, double cellRate, bool knownTotal,
+                     double percent, double eta, const std::vector<double> &utilization,
+                     std::uint64_t residentBytes) const
+    {
+        std::string tmpFileName = statusFileName + ".tmp";
+        {
+            std::ofstream out(tmpFileName.c_str());
+            if (not out) {
+                return;
+            }
+            out << std::fixed << std::setprecision(3) << "{\n"
+                << "  \"state\": \"" << (final ? "finished" : "running") << "\",\n"
+                << "  \"timestamp\": \"" << GetTimestamp() << "\",\n"
+                << "  \"elapsedSeconds\": " << elapsed << ",\n"
+                << "  \"inputRecords\": " << cur.records << ",\n"
+                << "  \"expectedInputRecords\": ";
+            if (knownTotal) {
+                out << expectedRecords;
+            } else {
+                out << "null";
+            }
+            out << ",\n"
+                << "  \"zmws\": " << cur.zmws << ",\n"
+                << "  \"subreads\": " << cur.subreads << ",\n"
+                << "  \"alignedBases\": " << cur.alignedBases << ",\n"
+                << "  \"dpCells\": " << cur.dpCells << ",\n"
+                << "  \"bufferBytes\": " << cur.bufferBytes << ",\n"
+                << "  \"residentBytes\": " << residentBytes << ",\n"
+                << "  \"peakResidentBytes\": " << ProcessMemory::PeakResidentBytes() << ",\n"
+                << "  \"zmwsPerSecond\": " << zmwRate << ",\n"
+                << "  \"subreadsPerSecond\": " << subreadRate << ",\n"
+                << "  \"alignedBasesPerSecond\": " << baseRate << ",\n"
+                << "  \"dpCellsPerSecond\": " << cellRate << ",\n"
+                << "  \"percentComplete\": ";
+            if (knownTotal) {
+                out << percent;
+            } else {
+                out << "null";
+            }
+            out << ",\n"
+                << "  \"etaSeconds\": ";
+            if (eta >= 0) {
+                out << eta;
+            } else {
+                out << "null";
+            }
+            out << ",\n"
+                << "  \"threadUtilization\": [";
+            for (size_t i = 0; i < utilization.size(); i++) {
+                out << (i > 0 ? ", " : "") << utilization[i];
+            }
+            out << "]\n"
+                << "}\n";
+        }
+        std::rename(tmpFileName.c_str(), statusFileName.c_str());
+    }
+};
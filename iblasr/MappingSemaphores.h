@@ -2,16 +2,189 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
 #include <vector>
 
-#ifndef __APPLE__
+#include "BlasrProbes.h"
+
+enum class MappingSemaphore
+{
+    Reader,
+    Writer,
+    Unaligned,
+    HitCluster,
+    Trace,
+    LcpBounds,
+    NumSemaphores
+};
+
+inline const char *MappingSemaphoreName(MappingSemaphore which)
+{
+    switch (which) {
+        case MappingSemaphore::Reader:
+            return "reader";
+        case MappingSemaphore::Writer:
+            return "writer";
+        case MappingSemaphore::Unaligned:
+            return "unaligned";
+        case MappingSemaphore::HitCluster:
+            return "hitCluster";
+        case MappingSemaphore::Trace:
+            return "trace";
+        case MappingSemaphore::LcpBounds:
+            return "lcpBounds";
+        default:
+            return "unknown";
+    }
+}
+
+//
+// Wait and hold times of one semaphore, as seen by one thread.
+//
+class SemaphoreStats
+{
+public:
+    std::uint64_t acquires;
+    std::uint64_t totalWait;  // nanoseconds
+    std::uint64_t maxWait;
+    std::uint64_t totalHold;
+    std::uint64_t maxHold;
+
+    SemaphoreStats() { Reset(); }
+
+    void Reset() { acquires = totalWait = maxWait = totalHold = maxHold = 0; }
+
+    void Collect(const SemaphoreStats &rhs)
+    {
+        acquires += rhs.acquires;
+        totalWait += rhs.totalWait;
+        maxWait = std::max(maxWait, rhs.maxWait);
+        totalHold += rhs.totalHold;
+        maxHold = std::max(maxHold, rhs.maxHold);
+    }
+};
+
+//
+// Per-thread contention accounting for all MappingSemaphores.  A
+// thread registers its own instance with
+// MappingSemaphores::SetThreadStats(); the acquire time is kept here
+// rather than in the semaphore so that hold times need no extra
+// synchronization.
+//
+class MappingSemaphoreStats
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    static constexpr int NumSemaphores = int(MappingSemaphore::NumSemaphores);
+
+    std::array<SemaphoreStats, NumSemaphores> semaphores;
+    std::array<Clock::time_point, NumSemaphores> acquiredAt;
+
+    void Reset()
+    {
+        for (SemaphoreStats &s : semaphores) {
+            s.Reset();
+        }
+    }
+
+    void Collect(const MappingSemaphoreStats &rhs)
+    {
+        for (int s = 0; s < NumSemaphores; s++) {
+            semaphores[s].Collect(rhs.semaphores[s]);
+        }
+    }
+
+    // Nanoseconds waited on all semaphores.
+    std::uint64_t TotalWait() const
+    {
+        std::uint64_t total = 0;
+        for (const SemaphoreStats &s : semaphores) {
+            total += s.totalWait;
+        }
+        return total;
+    }
+
+    void RecordAcquire(MappingSemaphore which, Clock::time_point waitStart)
+    {
+        SemaphoreStats &s = semaphores[int(which)];
+        acquiredAt[int(which)] = Clock::now();
+        std::uint64_t wait = Nanoseconds(acquiredAt[int(which)] - waitStart);
+        ++s.acquires;
+        s.totalWait += wait;
+        s.maxWait = std::max(s.maxWait, wait);
+    }
+
+    void RecordRelease(MappingSemaphore which)
+    {
+        SemaphoreStats &s = semaphores[int(which)];
+        std::uint64_t hold = Nanoseconds(Clock::now() - acquiredAt[int(which)]);
+        s.totalHold += hold;
+        s.maxHold = std::max(s.maxHold, hold);
+    }
+
+    static std::uint64_t Nanoseconds(Clock::duration d)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    }
+
+    //
+    // Print a table of acquires, total and max wait, and total and max
+    // hold time (in seconds and milliseconds) per semaphore, first
+    // summed over all threads and then for each thread.  A pipeline
+    // bound by input or output shows up as a large reader or writer
+    // wait relative to the run time.
+    //
+    static void PrintSummary(const std::vector<MappingSemaphoreStats> &threadStats,
+                             std::ostream &out)
+    {
+        MappingSemaphoreStats all;
+        for (const MappingSemaphoreStats &t : threadStats) {
+            all.Collect(t);
+        }
+        out << "semaphore\tthread\tacquires\ttotal_wait_s\tmax_wait_ms\ttotal_hold_s\tmax_hold_ms"
+            << std::endl;
+        for (int s = 0; s < NumSemaphores; s++) {
+            PrintRow(out, MappingSemaphore(s), "all", all.semaphores[s]);
+            for (size_t t = 0; t < threadStats.size(); t++) {
+                PrintRow(out, MappingSemaphore(s), std::to_string(t), threadStats[t].semaphores[s]);
+            }
+        }
+    }
+
+private:
+    static void PrintRow(std::ostream &out, MappingSemaphore which, const std::string &thread,
+                         const SemaphoreStats &s)
+    {
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << std::fixed << std::setprecision(6) << MappingSemaphoreName(which) << "\t" << thread
+            << "\t" << s.acquires << "\t" << s.totalWait * 1e-9 << "\t" << s.maxWait * 1e-6 << "\t"
+            << s.totalHold * 1e-9 << "\t" << s.maxHold * 1e-6 << std::endl;
+        out.flags(flags);
+        out.precision(precision);
+    }
+};
+
 class MappingSemaphores
 {
 public:
+    // Reads taken from the reader so far; only changed while holding Reader.
+    std::uint64_t nReadsFetched = 0;
+
+#ifndef __APPLE__
     sem_t reader;
     sem_t writer;
     sem_t unaligned;
     sem_t hitCluster;
+    sem_t trace;
+    sem_t lcpBounds;
 
     void InitializeAll()
     {
@@ -19,22 +192,92 @@ public:
         sem_init(&writer, 0, 1);
         sem_init(&unaligned, 0, 1);
         sem_init(&hitCluster, 0, 1);
+        sem_init(&trace, 0, 1);
+        sem_init(&lcpBounds, 0, 1);
+    }
+
+    sem_t *Get(MappingSemaphore which)
+    {
+        switch (which) {
+            case MappingSemaphore::Reader:
+                return &reader;
+            case MappingSemaphore::Writer:
+                return &writer;
+            case MappingSemaphore::Unaligned:
+                return &unaligned;
+            case MappingSemaphore::HitCluster:
+                return &hitCluster;
+            case MappingSemaphore::Trace:
+                return &trace;
+            default:
+                return &lcpBounds;
+        }
     }
-};
 #else
-class MappingSemaphores
-{
-public:
     sem_t *reader;
     sem_t *writer;
     sem_t *unaligned;
     sem_t *hitCluster;
+    sem_t *trace;
+    sem_t *lcpBounds;
     void InitializeAll()
     {
         reader = sem_open("/reader", O_CREAT, 0644, 1);
         writer = sem_open("/writer", O_CREAT, 0644, 1);
         unaligned = sem_open("/unaligned", O_CREAT, 0644, 1);
         hitCluster = sem_open("/hitCluster", O_CREAT, 0644, 1);
+        trace = sem_open("/trace", O_CREAT, 0644, 1);
+        lcpBounds = sem_open("/lcpBounds", O_CREAT, 0644, 1);
+    }
+
+    sem_t *Get(MappingSemaphore which)
+    {
+        switch (which) {
+            case MappingSemaphore::Reader:
+                return reader;
+            case MappingSemaphore::Writer:
+                return writer;
+            case MappingSemaphore::Unaligned:
+                return unaligned;
+            case MappingSemaphore::HitCluster:
+                return hitCluster;
+            case MappingSemaphore::Trace:
+                return trace;
+            default:
+                return lcpBounds;
+        }
     }
-};
 #endif
+
+    //
+    // Route subsequent Wait()/Post() calls made by the calling thread
+    // to 'stats', or stop accounting when it is NULL.
+    //
+    static void SetThreadStats(MappingSemaphoreStats *stats) { threadStats = stats; }
+
+    void Wait(MappingSemaphore which)
+    {
+        BLASR_PROBE1(semaphore__wait, int(which));
+        if (threadStats == NULL) {
+            sem_wait(Get(which));
+            BLASR_PROBE1(semaphore__acquire, int(which));
+            return;
+        }
+        MappingSemaphoreStats::Clock::time_point waitStart = MappingSemaphoreStats::Clock::now();
+        sem_wait(Get(which));
+        BLASR_PROBE1(semaphore__acquire, int(which));
+        threadStats->RecordAcquire(which, waitStart);
+    }
+
+    void Post(MappingSemaphore which)
+    {
+        if (threadStats != NULL) {
+            threadStats->RecordRelease(which);
+        }
+        BLASR_PROBE1(semaphore__release, int(which));
+        sem_post(Get(which));
+    }
+
+private:
+    inline static thread_local MappingSemaphoreStats *threadStats = NULL;
+};
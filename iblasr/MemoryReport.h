@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "MappingBuffers.hpp"
+#include "ProcessMemory.h"
+
+//
+// Bytes held by one mapping thread in each MappingBuffers field and in
+// alignment candidates, now and at their peak.  Updated by the owning
+// thread after every ZMW and read by the reporter, so the counters are
+// relaxed atomics like MappingThreadProgress.
+//
+class MappingThreadMemory
+{
+public:
+    static constexpr int Candidates = MappingBuffers::NumFields;
+    static constexpr int NumFields = MappingBuffers::NumFields + 1;
+
+    std::array<std::atomic<std::uint64_t>, NumFields> current;
+    std::array<std::atomic<std::uint64_t>, NumFields> peak;
+
+    MappingThreadMemory()
+    {
+        for (int f = 0; f < NumFields; f++) {
+            current[f] = 0;
+            peak[f] = 0;
+        }
+    }
+
+    static const char *FieldName(int field)
+    {
+        return field == Candidates ? "alignmentCandidates" : MappingBuffers::FieldName(field);
+    }
+
+    void Record(const MappingBuffers &buffers, std::uint64_t candidateBytes)
+    {
+        std::array<std::uint64_t, MappingBuffers::NumFields> bytes;
+        buffers.FieldBytes(bytes);
+        for (int f = 0; f < MappingBuffers::NumFields; f++) {
+            Set(f, bytes[f]);
+        }
+        Set(Candidates, candidateBytes);
+    }
+
+    std::uint64_t Total() const
+    {
+        std::uint64_t total = 0;
+        for (int f = 0; f < NumFields; f++) {
+            total += current[f].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    void Set(int field, std::uint64_t bytes)
+    {
+        current[field].store(bytes, std::memory_order_relaxed);
+        if (bytes > peak[field].load(std::memory_order_relaxed)) {
+            peak[field].store(bytes, std::memory_order_relaxed);
+        }
+    }
+};
+
+//
+// Memory held by each major structure, for --memoryReport and
+// --estimateMemory.  Shared structures (index, genome, ...) are added
+// once by the main thread; per-thread buffers are read from each
+// thread's MappingThreadMemory.
+//
+class MemoryReport
+{
+public:
+    void Add(const std::string &structure, std::uint64_t bytes)
+    {
+        shared.push_back(std::make_pair(structure, bytes));
+    }
+
+    std::uint64_t SharedBytes() const
+    {
+        std::uint64_t total = 0;
+        for (const auto &s : shared) {
+            total += s.second;
+        }
+        return total;
+    }
+
+    //
+    // Print one row per structure with current and peak sizes in MB.
+    // Shared structures and process totals have thread "all"; each
+    // buffer has one row summed over threads and one per thread.  The
+    // peak of a sum is the sum of per-thread peaks, an upper bound.
+    //
+    void PrintTable(std::ostream &out,
+                    const std::vector<const MappingThreadMemory *> &threads) const
+    {
+        out << "structure\tthread\tcurrent_mb\tpeak_mb" << std::endl;
+        for (const auto &s : shared) {
+            PrintRow(out, s.first, "all", s.second, s.second);
+        }
+        std::uint64_t buffersCurrent = 0, buffersPeak = 0;
+        for (int f = 0; f < MappingThreadMemory::NumFields; f++) {
+            std::uint64_t current = 0, peak = 0;
+            for (const MappingThreadMemory *t : threads) {
+                current += t->current[f].load(std::memory_order_relaxed);
+                peak += t->peak[f].load(std::memory_order_relaxed);
+            }
+            buffersCurrent += current;
+            buffersPeak += peak;
+            PrintRow(out, MappingThreadMemory::FieldName(f), "all", current, peak);
+            for (size_t t = 0; t < threads.size(); t++) {
+                PrintRow(out, MappingThreadMemory::FieldName(f), std::to_string(t),
+                         threads[t]->current[f].load(std::memory_order_relaxed),
+                         threads[t]->peak[f].load(std::memory_order_relaxed));
+            }
+        }
+        PrintRow(out, "threadBuffers", "all", buffersCurrent, buffersPeak);
+        PrintRow(out, "shared", "all", SharedBytes(), SharedBytes());
+        PrintRow(out, "processResident", "all", ProcessMemory::ResidentBytes(),
+                 ProcessMemory::PeakResidentBytes());
+    }
+
+    // Print the shared structures only, as estimated before loading.
+    void PrintEstimate(std::ostream &out) const
+    {
+        out << "structure\testimated_mb" << std::endl;
+        for (const auto &s : shared) {
+            out << std::fixed << std::setprecision(3) << s.first << "\t" << s.second / 1048576.0
+                << std::endl;
+        }
+        out << "total\t" << SharedBytes() / 1048576.0 << std::endl;
+    }
+
+private:
+    std::vector<std::pair<std::string, std::uint64_t> > shared;
+
+    static void PrintRow(std::ostream &out, const std::string &structure, const std::string &thread,
+                         std::uint64_t current, std::uint64_t peak)
+    {
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << std::fixed << std::setprecision(3) << structure << "\t" << thread << "\t"
+            << current / 1048576.0 << "\t" << peak / 1048576.0 << std::endl;
+        out.flags(flags);
+        out.precision(precision);
+    }
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <ios>
+#include <iterator>
+#include <locale>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+//
+// Number formatting for OutputBuffer with std::to_chars instead of the
+// generic locale machinery of std::num_put.  Only the plain cases are
+// handled: decimal integers and default, fixed or scientific floats,
+// with no field width, showpos, showpoint or uppercase.  Everything
+// else falls through to std::num_put, so the output is byte for byte
+// the same as that of an ordinary std::ostream in the "C" locale.
+//
+class ToCharsNumPut : public std::num_put<char>
+{
+public:
+    explicit ToCharsNumPut(std::size_t refs = 0) : std::num_put<char>(refs) {}
+
+protected:
+    static const std::ios_base::fmtflags SpecialFlags =
+        std::ios_base::showpos | std::ios_base::showpoint | std::ios_base::uppercase |
+        std::ios_base::showbase;
+
+    iter_type do_put(iter_type out, std::ios_base &io, char fill, long v) const override
+    {
+        return PutInteger(out, io, fill, v);
+    }
+    iter_type do_put(iter_type out, std::ios_base &io, char fill, unsigned long v) const override
+    {
+        return PutInteger(out, io, fill, v);
+    }
+    iter_type do_put(iter_type out, std::ios_base &io, char fill, long long v) const override
+    {
+        return PutInteger(out, io, fill, v);
+    }
+    iter_type do_put(iter_type out, std::ios_base &io, char fill,
+                     unsigned long long v) const override
+    {
+        return PutInteger(out, io, fill, v);
+    }
+    iter_type do_put(iter_type out, std::ios_base &io, char fill, double v) const override
+    {
+        return PutFloat(out, io, fill, v);
+    }
+
+private:
+    static bool Plain(const std::ios_base &io)
+    {
+        return io.width() == 0 and (io.flags() & SpecialFlags) == 0;
+    }
+
+    static iter_type Put(iter_type out, const char *begin, const char *end)
+    {
+        return std::copy(begin, end, out);
+    }
+
+    template <typename T>
+    iter_type PutInteger(iter_type out, std::ios_base &io, char fill, T v) const
+    {
+        if (not Plain(io) or (io.flags() & std::ios_base::basefield) != std::ios_base::dec) {
+            return std::num_put<char>::do_put(out, io, fill, v);
+        }
+        char buffer[24];
+        std::to_chars_result r = std::to_chars(buffer, buffer + sizeof(buffer), v);
+        return Put(out, buffer, r.ptr);
+    }
+
+    iter_type PutFloat(iter_type out, std::ios_base &io, char fill, double v) const
+    {
+#if defined(__cpp_lib_to_chars)
+        std::ios_base::fmtflags floatfield = io.flags() & std::ios_base::floatfield;
+        if (Plain(io) and io.precision() >= 0 and io.precision() <= 64) {
+            std::chars_format format;
+            int precision = io.precision();
+            if (floatfield == std::ios_base::fixed) {
+                format = std::chars_format::fixed;
+            } else if (floatfield == std::ios_base::scientific) {
+                format = std::chars_format::scientific;
+            } else if (floatfield == std::ios_base::fmtflags(0)) {
+                format = std::chars_format::general;
+                // %g treats a precision of 0 as 1, as std::num_put does.
+                precision = precision == 0 ? 1 : precision;
+            } else {
+                return std::num_put<char>::do_put(out, io, fill, v);
+            }
+            char buffer[384];
+            std::to_chars_result r =
+                std::to_chars(buffer, buffer + sizeof(buffer), v, format, precision);
+            if (r.ec == std::errc()) {
+                return Put(out, buffer, r.ptr);
+            }
+        }
+#endif
+        return std::num_put<char>::do_put(out, io, fill, v);
+    }
+};
+
+// Growable, reusable storage behind OutputBuffer.
+class OutputStorage : public std::streambuf
+{
+public:
+    OutputStorage()
+    {
+        storage.resize(InitialBytes);
+        Clear();
+    }
+
+    void Clear() { setp(storage.data(), storage.data() + storage.size()); }
+
+    std::size_t Size() const { return pptr() - pbase(); }
+
+    const char *Data() const { return pbase(); }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof())) {
+            return traits_type::not_eof(c);
+        }
+        Grow(1);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        if (epptr() - pptr() < n) {
+            Grow(n);
+        }
+        std::copy(s, s + n, pptr());
+        pbump(int(n));
+        return n;
+    }
+
+private:
+    static const std::size_t InitialBytes = 65536;
+
+    std::vector<char> storage;
+
+    void Grow(std::size_t atLeast)
+    {
+        std::size_t size = Size();
+        storage.resize(std::max(storage.size() * 2, size + atLeast));
+        setp(storage.data(), storage.data() + storage.size());
+        pbump(int(size));
+    }
+};
+
+//
+// An std::ostream over a reusable in-memory buffer.  A thread formats
+// all alignments of a ZMW into it before taking the writer semaphore,
+// and then writes them with a single write(), so that formatting is
+// done outside the critical section.  The storage grows to its
+// high-water mark and is kept, like MappingBuffers.
+//
+class OutputBuffer : public std::ostream
+{
+public:
+    OutputBuffer() : std::ostream(NULL)
+    {
+        rdbuf(&storage);
+        imbue(std::locale(std::locale::classic(), new ToCharsNumPut));
+    }
+
+    void Clear()
+    {
+        storage.Clear();
+        clear();
+    }
+
+    std::size_t Size() const { return storage.Size(); }
+
+    const char *Data() const { return storage.Data(); }
+
+    void WriteTo(std::ostream &out) const { out.write(Data(), Size()); }
+
+private:
+    OutputStorage storage;
+};
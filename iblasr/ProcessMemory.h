@@ -0,0 +1,37 @@
+#pragma once
+
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdint>
+#include <fstream>
+
+//
+// Resident memory of the whole process.  Both are 0 where /proc or
+// getrusage() are not available.
+//
+class ProcessMemory
+{
+public:
+    static std::uint64_t ResidentBytes()
+    {
+        std::ifstream statm("/proc/self/statm");
+        std::uint64_t size = 0, resident = 0;
+        if (statm >> size >> resident) {
+            return resident * sysconf(_SC_PAGESIZE);
+        }
+        return 0;
+    }
+
+    static std::uint64_t PeakResidentBytes()
+    {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+#ifdef __APPLE__
+        return usage.ru_maxrss;  // bytes
+#else
+        return std::uint64_t(usage.ru_maxrss) * 1024;  // kilobytes
+#endif
+    }
+};
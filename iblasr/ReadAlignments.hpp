@@ -4,6 +4,7 @@
 #include <alignment/datastructures/alignment/AlignmentCandidate.hpp>
 #include <pbdata/SMRTSequence.hpp>
 
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -61,6 +62,9 @@ public:
 
     inline void Print(std::ostream &out = std::cout);
 
+    // Approximate bytes held by the alignment candidates and their blocks.
+    inline std::uint64_t CandidateBytes() const;
+
     inline ~ReadAlignments();
 };
 
@@ -78,6 +82,18 @@ inline bool ReadAlignments::AllSubreadsHaveAlignments()
     return true;
 }
 
+inline std::uint64_t ReadAlignments::CandidateBytes() const
+{
+    std::uint64_t bytes = 0;
+    for (const std::vector<T_AlignmentCandidate *> &alignments : subreadAlignments) {
+        for (const T_AlignmentCandidate *alignment : alignments) {
+            bytes += sizeof(T_AlignmentCandidate) +
+                     alignment->blocks.capacity() * sizeof(alignment->blocks[0]);
+        }
+    }
+    return bytes;
+}
+
 inline void ReadAlignments::Clear()
 {
     int i;
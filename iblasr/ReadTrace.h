@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "MappingHistograms.h"
+
+//
+// Structured trace of how one subread (or whole ZMW, for CCS and
+// polymerase reads) was mapped, written as one JSON object per line
+// with --traceFile.  A thread fills in its ReadTrace while mapping
+// and the record is formatted before taking the trace semaphore, so
+// tracing adds no time inside critical sections beyond the write.
+//
+class ReadTrace
+{
+public:
+    // One pass of the anchor/chain/align loop in MapRead.
+    class Expansion
+    {
+    public:
+        int expand;
+        std::uint64_t forwardAnchors;
+        std::uint64_t reverseAnchors;
+        std::uint64_t intervals;
+        std::uint64_t dpCells;
+    };
+
+    bool active;
+    bool sensitiveRetry;
+    std::uint64_t refineDpCells;
+    std::vector<Expansion> expansions;
+
+    ReadTrace() : active(false), sensitiveRetry(false), refineDpCells(0) {}
+
+    //
+    // Returns true if the ZMW of the read 'title' and 'holeNumber'
+    // should be traced when sampling at 'rate'.  The decision depends
+    // only on the movie, the part of the title up to the first '/', and
+    // the hole number, so every subread of a ZMW is traced together
+    // whether the reads come as one record or one record per subread,
+    // and the sampled set does not change with --nproc.
+    //
+    static bool Sampled(const std::string &title, unsigned int holeNumber, float rate)
+    {
+        if (rate >= 1) {
+            return true;
+        }
+        if (rate <= 0) {
+            return false;
+        }
+        // splitmix64 finalizer, to spread neighbouring ZMWs evenly.
+        std::uint64_t h = std::hash<std::string>()(title.substr(0, title.find('/')));
+        h ^= (holeNumber + 1) * 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        h = h ^ (h >> 31);
+        return (h >> 11) * (1.0 / 9007199254740992.0) < rate;
+    }
+
+    // Start tracing a new subread.  Clears stage times in 'histograms'.
+    void Begin(MappingHistograms &histograms)
+    {
+        sensitiveRetry = false;
+        refineDpCells = 0;
+        expansions.clear();
+        histograms.ResetReadTotals();
+    }
+
+    void AddExpansion(int expand, std::uint64_t forwardAnchors, std::uint64_t reverseAnchors,
+                      std::uint64_t intervals, std::uint64_t dpCells)
+    {
+        Expansion e;
+        e.expand = expand;
+        e.forwardAnchors = forwardAnchors;
+        e.reverseAnchors = reverseAnchors;
+        e.intervals = intervals;
+        e.dpCells = dpCells;
+        expansions.push_back(e);
+    }
+
+    //
+    // Format the trace of one read as a single line of JSON.
+    //
+    std::string ToJSON(const std::string &title, unsigned int holeNumber, int subreadStart,
+                       int subreadEnd, int nAlignments, const MappingHistograms &histograms) const
+    {
+        static const MappingStage readStages[] = {MappingStage::MapToGenome,
+                                                  MappingStage::SortMatchPosList,
+                                                  MappingStage::FindMaxIncreasingInterval,
+                                                  MappingStage::AlignIntervals,
+                                                  MappingStage::RefineAlignments,
+                                                  MappingStage::StoreMapQVs};
+
+        std::ostringstream out;
+        out << "{\"read\":\"" << Escape(title) << "\",\"holeNumber\":" << holeNumber
+            << ",\"subreadStart\":" << subreadStart << ",\"subreadEnd\":" << subreadEnd
+            << ",\"length\":" << subreadEnd - subreadStart << ",\"expansions\":[";
+        for (size_t i = 0; i < expansions.size(); i++) {
+            const Expansion &e = expansions[i];
+            out << (i > 0 ? "," : "") << "{\"expand\":" << e.expand
+                << ",\"forwardAnchors\":" << e.forwardAnchors
+                << ",\"reverseAnchors\":" << e.reverseAnchors << ",\"intervals\":" << e.intervals
+                << ",\"dpCells\":" << e.dpCells << "}";
+        }
+        out << "],\"sensitiveRetry\":" << (sensitiveRetry ? "true" : "false")
+            << ",\"refineDpCells\":" << refineDpCells << ",\"alignments\":" << nAlignments
+            << ",\"stageMicroseconds\":{";
+        for (size_t i = 0; i < sizeof(readStages) / sizeof(readStages[0]); i++) {
+            std::uint64_t ns = histograms.readTotals[int(readStages[i])];
+            out << (i > 0 ? "," : "") << "\"" << MappingStageName(readStages[i])
+                << "\":" << ns / 1000;
+        }
+        // MapRead covers anchoring, chaining and aligning; refinement
+        // and storing mapQVs follow it.
+        std::uint64_t wall = histograms.readTotals[int(MappingStage::MapRead)] +
+                             histograms.readTotals[int(MappingStage::RefineAlignments)] +
+                             histograms.readTotals[int(MappingStage::StoreMapQVs)];
+        out << "},\"wallMicroseconds\":" << wall / 1000 << "}";
+        return out.str();
+    }
+
+    static std::string Escape(const std::string &s)
+    {
+        std::string r;
+        for (char c : s) {
+            if (c == '"' or c == '\\') {
+                r += '\\';
+                r += c;
+            } else if ((unsigned char)c < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+                r += buf;
+            } else {
+                r += c;
+            }
+        }
+        return r;
+    }
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <LibBlasrConfig.h>
+
+#ifdef USE_PBBAM
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <pbbam/BamRecord.h>
+#include <pbbam/IRecordWriter.h>
+
+//
+// The BAM counterpart of OutputBuffer.  BAMOutput::PrintAlignment
+// builds a record per alignment, which means copying, converting and,
+// for reverse strand hits, reversing every QV and kinetics track of the
+// read; a thread builds all records of a ZMW into this buffer before
+// taking the writer semaphore, and then hands them to the real writer
+// in one go, so that only encoding and compression are serialized.
+//
+// Records written by reference belong to the caller and are copied
+// into slots that are kept between ZMWs, so their htslib storage grows
+// to its high-water mark and is reused, like MappingBuffers.  Records
+// written as rvalues are moved into their slot instead.
+//
+class RecordBuffer : public PacBio::BAM::IRecordWriter
+{
+public:
+    RecordBuffer() : nRecords(0) {}
+
+    void Write(const PacBio::BAM::BamRecord &record) override
+    {
+        if (nRecords < records.size()) {
+            records[nRecords] = record;
+        } else {
+            records.push_back(record);
+        }
+        nRecords++;
+    }
+
+    void Write(PacBio::BAM::BamRecord &&record)
+    {
+        if (nRecords < records.size()) {
+            records[nRecords] = std::move(record);
+        } else {
+            records.push_back(std::move(record));
+        }
+        nRecords++;
+    }
+
+    void Write(const PacBio::BAM::BamRecordImpl &recordImpl) override
+    {
+        Write(PacBio::BAM::BamRecord(recordImpl));
+    }
+
+    // Records are only written out by WriteTo().
+    void TryFlush() override {}
+
+    std::size_t Size() const { return nRecords; }
+
+    void Clear() { nRecords = 0; }
+
+    void WriteTo(PacBio::BAM::IRecordWriter &out) const
+    {
+        for (std::size_t r = 0; r < nRecords; r++) {
+            out.Write(records[r]);
+        }
+    }
+
+private:
+    std::vector<PacBio::BAM::BamRecord> records;
+    std::size_t nRecords;
+};
+
+#endif
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ContigIndex.h"
+#include "ContigPartition.h"
+
+#include <alignment/suffixarray/SuffixArrayTypes.hpp>
+#include <alignment/tuples/TupleMetrics.hpp>
+#include <pbdata/FASTQSequence.hpp>
+#include <pbdata/metagenome/SequenceIndexDatabase.hpp>
+
+//
+// A suffix array split by contig, written by 'sawriter -shards N'.
+// Each shard is the suffix array, lookup table and tuple count table
+// of a run of consecutive contigs, built over that part of the
+// concatenated reference only, so sawriter never holds more than one
+// shard's construction arrays.  The shards are listed in a manifest
+// 'out.sa.shards', which blasr accepts as --sa:
+//
+//   <number of contigs> <reference length>
+//   <shard file> <first contig> <number of contigs>
+//   ...
+//
+// Shard files are named relative to the manifest, and the count table
+// of shard 'out.sa.0' is 'out.sa.0.ctab'.  blasr holds one shard's
+// suffix array at a time: the mapping threads step through the shards
+// together (ShardCycle), each mapping a batch of reads to the loaded
+// shard, and the candidates of each read are merged over all shards
+// before mapQV and hit selection, so they are ranked against all of
+// the reference as with a single suffix array.  The count tables of
+// the shards add up to that of the whole reference, so matches are
+// weighted the same way.
+//
+class ReferenceShard
+{
+public:
+    std::string fileName;
+    int firstContig;
+    int nContigs;
+    DNALength start;  // in the concatenated reference
+    DNALength length;
+    DNALength saLength;
+    int lookupPrefixLength;
+    std::unique_ptr<DNASuffixArray> sarray;  // only while loaded
+    std::vector<DNALength> seqStartPos;      // relative to 'start'
+    ContigIndex contigIndex;
+
+    ReferenceShard()
+        : firstContig(0), nContigs(0), start(0), length(0), saLength(0), lookupPrefixLength(0)
+    {
+    }
+
+    void ShallowCopySuffixArray(DNASuffixArray &dest)
+    {
+        dest.index = sarray->index;
+        dest.length = sarray->length;
+        dest.target = sarray->target;
+        dest.startPosTable = sarray->startPosTable;
+        dest.endPosTable = sarray->endPosTable;
+        dest.lookupTableLength = sarray->lookupTableLength;
+        dest.lookupPrefixLength = sarray->lookupPrefixLength;
+        dest.tm = sarray->tm;
+        dest.deleteStructures = false;
+    }
+
+    // The contigs of this shard in 'seqdb', with positions in the shard.
+    void ShallowCopySequenceIndexDatabase(SequenceIndexDatabase<FASTQSequence> &seqdb,
+                                          SequenceIndexDatabase<FASTQSequence> &dest)
+    {
+        dest.nSeqPos = nContigs + 1;
+        dest.seqStartPos = seqStartPos.data();
+        dest.nameLengths = seqdb.nameLengths + firstContig;
+        dest.names = seqdb.names + firstContig;
+        dest.deleteStructures = false;
+    }
+};
+
+class ReferenceShards
+{
+public:
+    ReferenceShards() : nContigs(0), genomeLength(0) {}
+
+    static bool IsManifestName(const std::string &fileName)
+    {
+        static const std::string suffix = ".shards";
+        return fileName.size() > suffix.size() and
+               fileName.compare(fileName.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    static std::string ManifestName(const std::string &saFileName)
+    {
+        return saFileName + ".shards";
+    }
+
+    static std::string ShardFileName(const std::string &saFileName, int shard)
+    {
+        return saFileName + "." + std::to_string(shard);
+    }
+
+    static std::string CountTableFileName(const std::string &shardFileName)
+    {
+        return shardFileName + ".ctab";
+    }
+
+    // Shards count tuples of blasr's default --saLookupTableLength.
+    static const int CountTableTupleSize = 8;
+
+    //
+    // Splits the contigs at 'starts', as in seqStartPos, into at most
+    // 'nShards' runs the way --splitByRef groups contigs.  Returns the
+    // first contig of each run followed by the number of contigs.
+    //
+    static std::vector<int> Partition(const std::vector<DNALength> &starts, int nShards)
+    {
+        std::vector<std::uint64_t> lengths;
+        for (std::size_t c = 0; c + 1 < starts.size(); c++) {
+            lengths.push_back(starts[c + 1] - starts[c]);
+        }
+        return ContigPartition::Split(lengths, nShards);
+    }
+
+    static void WriteManifest(const std::string &saFileName, const std::vector<int> &firsts,
+                              DNALength genomeLengthP)
+    {
+        std::ofstream manifest(ManifestName(saFileName).c_str());
+        std::string base = saFileName.substr(saFileName.rfind('/') + 1);
+        manifest << firsts.back() << "\t" << genomeLengthP << "\n";
+        for (std::size_t s = 0; s + 1 < firsts.size(); s++) {
+            manifest << ShardFileName(base, s) << "\t" << firsts[s] << "\t"
+                     << firsts[s + 1] - firsts[s] << "\n";
+        }
+        if (not manifest) {
+            std::cout << "ERROR, could not write " << ManifestName(saFileName) << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    // Lists the shards without reading them.
+    void ReadManifest(const std::string &manifestName)
+    {
+        std::ifstream manifest(manifestName.c_str());
+        if (not(manifest >> nContigs >> genomeLength)) {
+            std::cout << "ERROR, " << manifestName << " is not a suffix array shard manifest."
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        std::size_t slash = manifestName.rfind('/');
+        std::string dir = slash == std::string::npos ? "" : manifestName.substr(0, slash + 1);
+        shards.clear();
+        std::string fileName;
+        int first, n;
+        int nextContig = 0;
+        while (manifest >> fileName >> first >> n) {
+            if (first != nextContig or n <= 0) {
+                std::cout << "ERROR, the shards in " << manifestName
+                          << " do not cover consecutive contigs." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            shards.emplace_back(new ReferenceShard);
+            shards.back()->fileName = fileName[0] == '/' ? fileName : dir + fileName;
+            shards.back()->firstContig = first;
+            shards.back()->nContigs = n;
+            nextContig += n;
+        }
+        if (nextContig != nContigs) {
+            std::cout << "ERROR, the shards in " << manifestName << " cover " << nextContig
+                      << " of " << nContigs << " contigs." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    //
+    // Reads the manifest and the header of every shard, and checks that
+    // they were built for a reference of 'nContigsP' contigs and
+    // 'genomeLengthP' bases.  The suffix arrays are only read by Load().
+    // Returns false if a shard cannot be read.
+    //
+    bool Open(const std::string &manifestName, int nContigsP, DNALength genomeLengthP)
+    {
+        ReadManifest(manifestName);
+        if (nContigs != nContigsP or genomeLength != genomeLengthP) {
+            std::cout << "ERROR, " << manifestName << " was built for a reference of " << nContigs
+                      << " contigs and " << genomeLength << " bases, not " << nContigsP
+                      << " contigs and " << genomeLengthP << " bases." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        for (auto &shard : shards) {
+            DNASuffixArray sa;
+            if (not sa.LightRead(shard->fileName)) {
+                return false;
+            }
+            shard->saLength = sa.length;
+            shard->lookupPrefixLength = sa.lookupPrefixLength;
+            if (shard->lookupPrefixLength != shards[0]->lookupPrefixLength) {
+                std::cout << "ERROR, the shards in " << manifestName
+                          << " have different lookup table lengths." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        return true;
+    }
+
+    //
+    // Adds up the count tables of the shards into 'ct', which then
+    // counts the tuples of the whole reference.  Returns false, leaving
+    // 'ct' empty, if a shard has no count table or one of tuples other
+    // than 'tupleSize' bases.
+    //
+    template <typename T_CountTable>
+    bool ReadCountTables(T_CountTable &ct, int tupleSize)
+    {
+        std::vector<std::unique_ptr<T_CountTable> > tables;
+        for (auto &shard : shards) {
+            std::ifstream in(CountTableFileName(shard->fileName).c_str(),
+                             std::ios::in | std::ios::binary);
+            if (not in) {
+                return false;
+            }
+            tables.emplace_back(new T_CountTable);
+            tables.back()->Read(in);
+            if (tables.back()->tm.tupleSize != tupleSize) {
+                return false;
+            }
+        }
+        TupleMetrics tm;
+        tm.Initialize(tupleSize);
+        ct.InitCountTable(tm);
+        for (auto &table : tables) {
+            for (std::uint64_t t = 0; t < std::uint64_t(ct.countTableLength); t++) {
+                ct.countTable[t] += table->countTable[t];
+            }
+            ct.nTuples += table->nTuples;
+        }
+        return true;
+    }
+
+    //
+    // Places the shards in the reference and builds their contig
+    // lookups; call once the names in 'seqdb' are final.
+    //
+    template <typename T_Sequence>
+    void Attach(SequenceIndexDatabase<T_Sequence> &seqdb)
+    {
+        for (auto &shard : shards) {
+            int last = shard->firstContig + shard->nContigs;
+            shard->start = seqdb.seqStartPos[shard->firstContig];
+            shard->length =
+                std::min<DNALength>(seqdb.seqStartPos[last], genomeLength) - shard->start;
+            shard->seqStartPos.clear();
+            std::vector<std::string> fullNames, names;
+            for (int c = shard->firstContig; c <= last; c++) {
+                shard->seqStartPos.push_back(seqdb.seqStartPos[c] - shard->start);
+                if (c < last) {
+                    fullNames.push_back(seqdb.names[c]);
+                    names.push_back(seqdb.GetSpaceDelimitedName(c));
+                }
+            }
+            shard->contigIndex.Build(shard->seqStartPos, fullNames, names);
+        }
+    }
+
+    int NumShards() const { return shards.size(); }
+
+    ReferenceShard &Shard(int s) { return *shards[s]; }
+
+    int LookupPrefixLength() const { return shards.empty() ? 0 : shards[0]->lookupPrefixLength; }
+
+    // The suffix array that is loaded at a time is at most this long.
+    DNALength LargestSuffixArrayLength() const
+    {
+        DNALength largest = 0;
+        for (const auto &shard : shards) {
+            largest = std::max(largest, shard->saLength);
+        }
+        return largest;
+    }
+
+    void Load(int s)
+    {
+        shards[s]->sarray.reset(new DNASuffixArray);
+        if (not shards[s]->sarray->Read(shards[s]->fileName)) {
+            std::cout << "ERROR. " << shards[s]->fileName << " is not a valid suffix array. "
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    void Unload(int s) { shards[s]->sarray.reset(); }
+
+private:
+    int nContigs;
+    DNALength genomeLength;
+    std::vector<std::unique_ptr<ReferenceShard> > shards;
+};
+
+//
+// Steps the mapping threads through the shards together, so that one
+// shard is loaded at a time.  Each thread maps a batch of reads to
+// every shard in turn, calling Arrive() before each shard; the last
+// thread to arrive loads the shard the others then map to.  The shards
+// are visited in reference order and then in reverse, so the shard
+// that ends one round of the shards starts the next without a reload.
+// Start() is called before the threads of each query file start, and a
+// thread leaves once it has no more reads, between rounds.  The loaded
+// shard is kept from one query file to the next.
+//
+class ShardCycle
+{
+public:
+    ShardCycle(ReferenceShards &shardsP)
+        : shards(shardsP), nActive(0), nArrived(0), step(0), loaded(-1)
+    {
+    }
+
+    void Start(int nThreads)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        nActive = nThreads;
+        nArrived = 0;
+    }
+
+    int NumShards() const { return shards.NumShards(); }
+
+    ReferenceShard &Arrive()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        std::uint64_t arrivedAt = step;
+        if (++nArrived == nActive) {
+            Advance();
+        } else {
+            advanced.wait(lock, [this, arrivedAt] { return step != arrivedAt; });
+        }
+        return shards.Shard(loaded);
+    }
+
+    void Leave()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        nActive--;
+        if (nArrived > 0 and nArrived == nActive) {
+            Advance();
+        }
+    }
+
+private:
+    ReferenceShards &shards;
+    std::mutex mutex;
+    std::condition_variable advanced;
+    int nActive;
+    int nArrived;
+    std::uint64_t step;
+    int loaded;
+
+    // Called with 'mutex' held once every active thread has arrived.
+    void Advance()
+    {
+        int n = shards.NumShards();
+        int s = step % n;
+        if ((step / n) % 2 == 1) {
+            s = n - 1 - s;
+        }
+        if (s != loaded) {
+            if (loaded >= 0) {
+                shards.Unload(loaded);
+            }
+            shards.Load(s);
+            loaded = s;
+        }
+        nArrived = 0;
+        step++;
+        advanced.notify_all();
+    }
+};
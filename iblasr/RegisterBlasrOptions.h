@@ -39,6 +39,8 @@ void RegisterBlasrOptions(CommandLineParser& clp, MappingParameters& params)
     clp.RegisterIntOption("-limsAlign", &params.limsAlign, "", CommandLineParser::PositiveInteger);
     clp.RegisterFlagOption("-printOnlyBest", &params.printOnlyBest, "");
     clp.RegisterFlagOption("-outputByThread", &params.outputByThread, "");
+    clp.RegisterFlagOption("-keepThreadOutput", &params.keepThreadOutput, "");
+    clp.RegisterFlagOption("-mergeInZmwOrder", &params.mergeInZmwOrder, "");
     clp.RegisterFlagOption("-rbao", &params.refineBetweenAnchorsOnly, "");
     clp.RegisterFlagOption("-onegap", &params.separateGaps, "");
     clp.RegisterFlagOption("-allowAdjacentIndels", &params.allowAdjacentIndels, "", false);
@@ -127,6 +129,20 @@ void RegisterBlasrOptions(CommandLineParser& clp, MappingParameters& params)
     clp.RegisterStringOption("-metrics", &params.metricsFileName, "");
     clp.RegisterStringOption("-lcpBounds", &params.lcpBoundsFileName, "");
     clp.RegisterStringOption("-fullMetrics", &params.fullMetricsFileName, "");
+    clp.RegisterStringOption("-latencyMetrics", &params.latencyMetricsFileName, "");
+    clp.RegisterIntOption("-progress", &params.progressInterval, "",
+                          CommandLineParser::NonNegativeInteger);
+    clp.RegisterStringOption("-statusFile", &params.statusFileName, "");
+    clp.RegisterStringOption("-traceFile", &params.traceFileName, "");
+    clp.RegisterFloatOption("-traceSample", &params.traceSampleRate, "",
+                            CommandLineParser::NonNegativeFloat);
+    clp.RegisterFloatOption("-debugSample", &params.debugSampleRate, "",
+                            CommandLineParser::NonNegativeFloat);
+    clp.RegisterStringOption("-profile", &params.profileFileName, "");
+    clp.RegisterIntOption("-profileThread", &params.profileThread, "", CommandLineParser::Integer);
+    clp.RegisterFlagOption("-profileOnSignal", &params.profileOnSignal, "");
+    clp.RegisterStringOption("-memoryReport", &params.memoryReportFileName, "");
+    clp.RegisterFlagOption("-estimateMemory", &params.estimateMemory, "");
     clp.RegisterIntOption("-nbranch", &params.anchorParameters.numBranches, "",
                           CommandLineParser::NonNegativeInteger);
     clp.RegisterFlagOption("-divideByAdapter", &params.byAdapter, "");
@@ -152,7 +168,22 @@ void RegisterBlasrOptions(CommandLineParser& clp, MappingParameters& params)
     clp.RegisterFlagOption("-refineConcordantAlignments", &params.refineConcordantAlignments, "");
     clp.RegisterIntOption("-nCandidates", &params.nCandidates, "",
                           CommandLineParser::NonNegativeInteger);
+    clp.RegisterIntOption("-shardBatchSize", &params.shardBatchSize, "",
+                          CommandLineParser::PositiveInteger);
     clp.RegisterFlagOption("-useTemp", (bool*)&params.tempDirectory, "");
+    clp.RegisterStringOption("-tempDirectory", &params.tempDirectory, "");
+    clp.RegisterFlagOption("-sorted", &params.sortedOutput, "");
+    clp.RegisterFlagOption("-pbi", &params.pbiOutput, "");
+    clp.RegisterIntOption("-sortMemory", &params.sortMemory, "",
+                          CommandLineParser::PositiveInteger);
+    clp.RegisterFlagOption("-compressOutput", &params.compressOutput, "");
+    clp.RegisterIntOption("-compressThreads", &params.compressThreads, "",
+                          CommandLineParser::PositiveInteger);
+    clp.RegisterFlagOption("-splitByRef", &params.splitByRef, "");
+    clp.RegisterIntOption("-splitMaxFiles", &params.splitMaxFiles, "",
+                          CommandLineParser::PositiveInteger);
+    clp.RegisterStringOption("-restrictTo", &params.restrictToFileName, "");
+    clp.RegisterFlagOption("-offTargetMapQV", &params.offTargetMapQV, "");
     clp.RegisterFlagOption("-noSplitSubreads", &params.mapSubreadsSeparately, "");
     clp.RegisterFlagOption("-concordant", &params.concordant, "");
     // When -concordant is turned on, blasr first selects a subread (e.g., the median length full-pass subread)
@@ -252,6 +283,14 @@ const std::string BlasrHelp(MappingParameters& params)
         << "               Use the suffix array 'sa' for detecting matches" << std::endl
         << "               between the reads and the reference.  The suffix" << std::endl
         << "               array has been prepared by the sawriter program." << std::endl
+        << "               A manifest 'out.sa.shards' from 'sawriter -shards' maps" << std::endl
+        << "               each read to every shard of the reference, holding one" << std::endl
+        << "               shard's suffix array in memory at a time." << std::endl
+        << std::endl
+        << "   --shardBatchSize n (1000)" << std::endl
+        << "               With a sharded suffix array, each thread maps 'n' ZMWs to" << std::endl
+        << "               a shard before the next shard is loaded.  Larger batches" << std::endl
+        << "               load the shards less often, and hold more reads." << std::endl
         << std::endl
         << "   --ctab tab " << std::endl
         << "               A table of tuple counts used to estimate match significance.  This is "
@@ -263,6 +302,22 @@ const std::string BlasrHelp(MappingParameters& params)
         << std::endl
         << "               precompute the ctab." << std::endl
         << std::endl
+        << "   --restrictTo targets" << std::endl
+        << "               Only report alignments to the contigs listed in 'targets', one name "
+           "per line,"
+        << std::endl
+        << "               or to the regions of its BED lines 'name start end'.  Anchors off "
+           "the targets"
+        << std::endl
+        << "               are dropped before chaining, so their candidates are never aligned."
+        << std::endl
+        << "   --offTargetMapQV" << std::endl
+        << "               With --restrictTo, align off-target candidates too, so that they "
+           "lower the"
+        << std::endl
+        << "               mapQV of on-target alignments, and drop them only before printing."
+        << std::endl
+        << std::endl
         << "   --regionTable table (DEPRECATED)" << std::endl
         << "               Read in a read-region table in HDF format for masking portions of reads."
         << std::endl
@@ -387,6 +442,60 @@ const std::string BlasrHelp(MappingParameters& params)
            "supported"
         << std::endl
         << "               Use --bam, then translate from .bam to .sam" << std::endl
+        << "   --sorted" << std::endl
+        << "               Sort --bam or --sam output by reference coordinate, and index BAM "
+           "output (.bai)."
+        << std::endl
+        << "   --outputByThread" << std::endl
+        << "               Each thread writes to 'out.<thread>' without waiting for the others; "
+           "the files"
+        << std::endl
+        << "               are merged into 'out' at the end, BAM without recompression."
+        << std::endl
+        << "   --keepThreadOutput" << std::endl
+        << "               Keep the per-thread files of --outputByThread rather than merging "
+           "them."
+        << std::endl
+        << "   --mergeInZmwOrder" << std::endl
+        << "               Merge per-thread files in the order ZMWs appear in the input (BAM "
+           "output is"
+        << std::endl
+        << "               then recompressed)." << std::endl
+        << "   --pbi" << std::endl
+        << "               Write the PacBio index (.pbi) of --bam output while writing it."
+        << std::endl
+        << "   --sortMemory MB (768)" << std::endl
+        << "               Memory for records waiting to be sorted; beyond it, sorted runs are "
+           "written to"
+        << std::endl
+        << "               --tempDirectory and merged at the end." << std::endl
+        << "   --tempDirectory dir (.)" << std::endl
+        << "               Where to write sorted runs." << std::endl
+        << "   --compressOutput" << std::endl
+        << "               Write --out (unless --bam) and --unaligned as BGZF, which gzip "
+           "reads.  This is"
+        << std::endl
+        << "               the default for file names ending in .gz or .bgz." << std::endl
+        << "   --compressThreads n (2)" << std::endl
+        << "               Threads compressing each compressed or BAM output file." << std::endl
+        << "   --splitByRef" << std::endl
+        << "               Write one file per reference contig, 'out.<contig>.<ext>', or per "
+           "group of"
+        << std::endl
+        << "               small contigs, 'out.group<n>.<ext>'; 'out.split' lists the contigs "
+           "of each file."
+        << std::endl
+        << "   --splitMaxFiles n (64)" << std::endl
+        << "               Group contigs so that --splitByRef writes at most n files, plus "
+           "one for"
+        << std::endl
+        << "               unmapped BAM records.  Each file stays open to the end of the run,"
+        << std::endl
+        << "               compressed SAM taking three descriptors and a thread per file; "
+           "compressed"
+        << std::endl
+        << "               files share --compressThreads, and each BAM file has at least one."
+        << std::endl
         << "   -m t           " << std::endl
         << "               If not printing SAM, modify the output of the alignment." << std::endl
         << "                t=" << StickPrint
@@ -415,7 +524,13 @@ const std::string BlasrHelp(MappingParameters& params)
         << std::endl
         << "               very verbose titles exist in reference names." << std::endl
         << "   --unaligned file" << std::endl
-        << "               Output reads that are not aligned to 'file'" << std::endl
+        << "               Output reads that are not aligned to 'file', as FASTA, or as FASTQ "
+           "if 'file'"
+        << std::endl
+        << "               ends in .fastq or .fq.  If it ends in .bam, the input BAM records "
+           "are written"
+        << std::endl
+        << "               with all their tags, for mapping again." << std::endl
         << "   --noPrintUnalignedSeqs" << std::endl
         << "               Must be used together with -unaligned, print unaligned read names only."
         << std::endl
@@ -595,6 +710,62 @@ const std::string BlasrHelp(MappingParameters& params)
         << std::endl
         << "   --stride S (1)" << std::endl
         << "               Align one read every 'S' reads." << std::endl
+        << "   --progress N (0)" << std::endl
+        << "               Every N seconds, print the number of ZMWs, subreads, aligned bases and "
+           "DP cells"
+        << std::endl
+        << "               processed per second, the percentage of input consumed and ETA (when "
+           "the input"
+        << std::endl
+        << "               has a .pbi index), and the utilization of each thread.  0 disables "
+           "reporting."
+        << std::endl
+        << "   --statusFile file" << std::endl
+        << "               Atomically rewrite 'file' with the same information in JSON at every "
+           "report."
+        << std::endl
+        << "               Implies --progress 10 unless --progress is given." << std::endl
+        << "   --traceFile file" << std::endl
+        << "               Write one line of JSON per mapped subread (or ZMW in CCS and "
+           "polymerase modes)"
+        << std::endl
+        << "               to 'file', with anchors, candidate intervals and DP cells per "
+           "expansion, whether"
+        << std::endl
+        << "               the sensitive search was retried, and time spent in each stage."
+        << std::endl
+        << "   --traceSample f (1.0)" << std::endl
+        << "               Only trace a fraction 'f' of ZMWs, chosen by read name." << std::endl
+        << "   --debugSample f (1.0)" << std::endl
+        << "               Only write --anchors, --clusters and --lcpBounds for a fraction 'f' "
+           "of ZMWs."
+        << std::endl
+        << "               These are buffered per thread and written in large chunks." << std::endl
+        << "   --profile file" << std::endl
+        << "               Write a gperftools CPU profile of the mapping phase to 'file' (requires "
+           "a build"
+        << std::endl
+        << "               with -Dgperftools=true).  Each SIGUSR2 stops or restarts profiling; "
+           "later"
+        << std::endl
+        << "               sessions are written to 'file.1', 'file.2', ..." << std::endl
+        << "   --profileThread N" << std::endl
+        << "               Only sample mapping thread N, from 0 to --nproc - 1." << std::endl
+        << "   --profileOnSignal" << std::endl
+        << "               Do not start profiling until the first SIGUSR2." << std::endl
+        << "   --memoryReport file" << std::endl
+        << "               Write the memory held by the index, genome and other shared "
+           "structures, and"
+        << std::endl
+        << "               by each buffer of each thread now and at its peak, to 'file' at "
+           "the end of the run."
+        << std::endl
+        << "               --progress also reports buffer and resident memory." << std::endl
+        << "   --estimateMemory" << std::endl
+        << "               Print the memory the shared structures will need, from the sizes of "
+           "the genome"
+        << std::endl
+        << "               and index files, and exit without mapping." << std::endl
         << std::endl
         << " Options for subsampling reads." << std::endl
         << "   --subsample (0)" << std::endl
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <alignment/datastructures/alignment/AlignmentCandidate.hpp>
+#include <pbdata/SMRTSequence.hpp>
+
+//
+// The candidates of one search for a read, merged over the shards of
+// a sharded suffix array as if they came from one index: contig
+// indices are made global, the candidates are ranked by score and cut
+// to -nCandidates, with equal scores in reference order, and the
+// significant clusters of all shards count towards mapQV.  Contigs do
+// not span shards, so the candidates of different shards never overlap
+// on the reference.
+//
+class ShardCandidates
+{
+public:
+    ShardCandidates() : numSignificantClusters(0) {}
+
+    ~ShardCandidates() { Clear(); }
+
+    // Adds the candidates found in the shard that starts at 'firstContig'.
+    void Add(int firstContig, std::vector<T_AlignmentCandidate *> &alignmentPtrs, int nCandidates)
+    {
+        if (alignmentPtrs.size() > 0) {
+            numSignificantClusters += alignmentPtrs[0]->numSignificantClusters;
+        }
+        for (T_AlignmentCandidate *alignment : alignmentPtrs) {
+            alignment->tIndex += firstContig;
+            ranked.emplace_back(firstContig, alignment);
+        }
+        alignmentPtrs.clear();
+        std::stable_sort(ranked.begin(), ranked.end(), [](const Candidate &a, const Candidate &b) {
+            return a.second->score != b.second->score ? a.second->score < b.second->score
+                                                      : a.first < b.first;
+        });
+        for (std::size_t c = std::max(0, nCandidates); c < ranked.size(); c++) {
+            delete ranked[c].second;
+        }
+        ranked.resize(std::min<std::size_t>(ranked.size(), std::max(0, nCandidates)));
+    }
+
+    // Moves the merged candidates into 'alignmentPtrs'.
+    void Take(std::vector<T_AlignmentCandidate *> &alignmentPtrs)
+    {
+        alignmentPtrs.clear();
+        for (Candidate &candidate : ranked) {
+            candidate.second->numSignificantClusters = numSignificantClusters;
+            alignmentPtrs.push_back(candidate.second);
+        }
+        ranked.clear();
+    }
+
+    void Clear()
+    {
+        for (Candidate &candidate : ranked) {
+            delete candidate.second;
+        }
+        ranked.clear();
+        numSignificantClusters = 0;
+    }
+
+private:
+    typedef std::pair<int, T_AlignmentCandidate *> Candidate;  // first contig of the shard
+
+    std::vector<Candidate> ranked;
+    int numSignificantClusters;
+};
+
+//
+// A read that MapRead will be asked to map, with the candidates of
+// its search and, for -useSensitiveSearch, of its sensitive retry.
+//
+class ShardedRead
+{
+public:
+    SMRTSequence read;
+    SMRTSequence readRC;
+    bool sideOutputSampled;
+    bool withRetry;
+    ShardCandidates candidates[2];  // search, sensitive retry
+
+    ShardedRead() : sideOutputSampled(false), withRetry(false) {}
+
+    ~ShardedRead()
+    {
+        read.Free();
+        readRC.Free();
+    }
+};
+
+//
+// The reads of one mapping thread's batch when mapping to a sharded
+// suffix array (ShardCycle).  The reads MapRead will be asked to map
+// are added, in the order it will be asked for them, before the batch
+// goes round the shards; the candidates found in each shard are merged
+// into those of the read.  MapRead then takes the merged candidates of
+// each read in turn, and of its retry if it is retried.
+//
+class ShardedReads
+{
+public:
+    ShardedReads() : next(0) {}
+
+    ShardedRead &Add()
+    {
+        reads.emplace_back(new ShardedRead);
+        return *reads.back();
+    }
+
+    std::size_t Size() const { return reads.size(); }
+
+    ShardedRead &Read(std::size_t r) { return *reads[r]; }
+
+    //
+    // The merged candidates of the next read, or with 'retry' of the
+    // sensitive retry of the last one.  The candidates refer to the
+    // copies of the read that were mapped, so they are moved onto
+    // 'read' and 'readRC', which have the same sequence.
+    //
+    void Take(bool retry, SMRTSequence &read, SMRTSequence &readRC,
+              std::vector<T_AlignmentCandidate *> &alignmentPtrs)
+    {
+        if (not retry) {
+            next++;
+        }
+        assert(next > 0 and next <= reads.size());
+        ShardedRead &sharded = *reads[next - 1];
+        assert(not retry or sharded.withRetry);
+        for (T_AlignmentCandidate *alignment : alignmentPtrs) {
+            delete alignment;
+        }
+        sharded.candidates[retry ? 1 : 0].Take(alignmentPtrs);
+        for (T_AlignmentCandidate *alignment : alignmentPtrs) {
+            if (alignment->qStrand == 0) {
+                alignment->qAlignedSeq.ReferenceSubstring(
+                    read, alignment->qAlignedSeq.seq - sharded.read.seq,
+                    alignment->qAlignedSeqLength);
+            } else {
+                alignment->qAlignedSeq.ReferenceSubstring(
+                    readRC, alignment->qAlignedSeq.seq - sharded.readRC.seq,
+                    alignment->qAlignedSeqLength);
+            }
+        }
+    }
+
+    void Clear()
+    {
+        reads.clear();
+        next = 0;
+    }
+
+private:
+    std::vector<std::unique_ptr<ShardedRead> > reads;
+    std::size_t next;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+
+#include "MappingSemaphores.h"
+#include "OutputBuffer.h"
+
+//
+// One thread's buffer for a debug side output: --anchors, --clusters
+// or --lcpBounds.  Records are formatted into an OutputBuffer, with
+// '\n' rather than std::endl, and the buffer is written to the shared
+// file under the channel's semaphore only once it holds FlushBytes,
+// and when the thread ends.  Records of one thread therefore stay
+// contiguous, but those of different threads are interleaved in
+// chunks rather than read by read.
+//
+class SideOutput
+{
+public:
+    static const std::size_t FlushBytes = 1 << 20;
+
+    SideOutput() : file(NULL), semaphores(NULL), which(MappingSemaphore::Writer), lock(false) {}
+
+    void Open(std::ostream *fileP, MappingSemaphores &semaphoresP, MappingSemaphore whichP,
+              bool lockP)
+    {
+        file = fileP;
+        semaphores = &semaphoresP;
+        which = whichP;
+        lock = lockP;
+        if (file != NULL and not buffer) {
+            buffer.reset(new OutputBuffer);
+        }
+    }
+
+    bool IsOpen() const { return file != NULL; }
+
+    std::ostream &Out() { return *buffer; }
+
+    // Called once a record is complete.
+    void EndRecord()
+    {
+        if (buffer->Size() >= FlushBytes) {
+            Flush();
+        }
+    }
+
+    void Flush()
+    {
+        if (file == NULL or buffer->Size() == 0) {
+            return;
+        }
+        if (lock) {
+            semaphores->Wait(which);
+        }
+        buffer->WriteTo(*file);
+        if (lock) {
+            semaphores->Post(which);
+        }
+        buffer->Clear();
+    }
+
+private:
+    std::ostream *file;
+    MappingSemaphores *semaphores;
+    MappingSemaphore which;
+    bool lock;
+    std::unique_ptr<OutputBuffer> buffer;
+};
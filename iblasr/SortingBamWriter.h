@@ -0,0 +1,328 @@
+#pragma once
+
+#include <LibBlasrConfig.h>
+
+#ifdef USE_PBBAM
+
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pbbam/BamHeader.h>
+#include <pbbam/BamReader.h>
+#include <pbbam/BamRecord.h>
+#include <pbbam/BamWriter.h>
+#include <pbbam/IRecordWriter.h>
+#include <pbbam/SamWriter.h>
+
+#include "IndexingBamWriter.h"
+
+//
+// Coordinate sorted SAM/BAM output for --sorted.  Records are kept in
+// memory until they exceed half of 'memoryBytes', then sorted and
+// spilled to a fast-compressed BAM run in the temporary directory.
+// Close() merges the runs, and whatever is still in memory, into the
+// output file, indexing BAM output (.bai, and .pbi if asked for) as it
+// goes; runs are merged at most MaxMergeWidth at a time so the number
+// of open files, and their buffers, stay bounded.  Records are ordered
+// as by 'samtools sort': by reference, unmapped records last, then
+// position, then strand, ties keeping the order they were written in.
+//
+// Like the other writers, Write() is not thread safe; mapping threads
+// call it while holding MappingSemaphore::Writer.  So that they are
+// not held up by a spill, Write() only swaps in an empty buffer; the
+// full one is sorted and written on a background thread, while the
+// next one fills, which is why a buffer only takes half the memory.
+// A record's size is estimated from its length, since pbbam does not
+// expose its encoded size.
+//
+class SortingBamWriter : public PacBio::BAM::IRecordWriter
+{
+public:
+    static const int MaxMergeWidth = 64;
+    static const std::uint64_t RecordOverheadBytes = 512;
+    static const std::uint64_t BytesPerBase = 10;  // bases, QVs and kinetics tags
+
+    SortingBamWriter(const std::string &fileNameP, const PacBio::BAM::BamHeader &headerP, bool samP,
+                     bool pbiP, const std::string &tempDirectoryP, std::uint64_t memoryBytesP,
+                     size_t nThreadsP)
+        : fileName(fileNameP)
+        , header(headerP)
+        , sam(samP)
+        , pbi(pbiP)
+        , tempDirectory(tempDirectoryP)
+        , memoryBytes(memoryBytesP)
+        , nThreads(nThreadsP)
+        , bufferBytes(0)
+        , nRunsCreated(0)
+        , closed(false)
+    {
+        header.SortOrder("coordinate");
+    }
+
+    ~SortingBamWriter() override
+    {
+        if (spiller.joinable()) {
+            spiller.join();
+        }
+        for (const std::string &run : runs) {
+            std::remove(run.c_str());
+        }
+    }
+
+    void Write(const PacBio::BAM::BamRecord &record) override
+    {
+        Write(PacBio::BAM::BamRecord(record));
+    }
+
+    void Write(PacBio::BAM::BamRecord &&record)
+    {
+        bufferBytes += RecordBytes(record);
+        buffer.push_back(std::move(record));
+        if (bufferBytes >= memoryBytes / 2) {
+            Spill();
+        }
+    }
+
+    void Write(const PacBio::BAM::BamRecordImpl &recordImpl) override
+    {
+        Write(PacBio::BAM::BamRecord(recordImpl));
+    }
+
+    // Records are only written out by Close().
+    void TryFlush() override {}
+
+    //
+    // Merge all records into the output file, write its indexes, and
+    // remove the temporary runs.  Nothing may be written afterwards.
+    //
+    void Close()
+    {
+        if (closed) {
+            return;
+        }
+        closed = true;
+        JoinSpill();
+        if (runs.empty()) {
+            std::unique_ptr<PacBio::BAM::IRecordWriter> out(OpenOutput());
+            SortRecords(buffer);
+            for (const PacBio::BAM::BamRecord &record : buffer) {
+                out->Write(record);
+            }
+            ReleaseBuffer();
+        } else {
+            if (not buffer.empty()) {
+                Spill();
+                JoinSpill();
+            }
+            //
+            // Each pass merges consecutive groups of runs into one run
+            // in their place, so the runs stay in write order and ties
+            // keep their order through every pass.
+            //
+            while (runs.size() > size_t(MaxMergeWidth)) {
+                std::vector<std::string> merged;
+                for (size_t first = 0; first < runs.size(); first += MaxMergeWidth) {
+                    size_t last = std::min(runs.size(), first + MaxMergeWidth);
+                    if (last - first == 1) {
+                        merged.push_back(runs[first]);
+                        continue;
+                    }
+                    std::vector<std::string> inputs(runs.begin() + first, runs.begin() + last);
+                    std::string run = NextRunName();
+                    {
+                        PacBio::BAM::BamWriter out(run, header,
+                                                   PacBio::BAM::BamWriter::FastCompression);
+                        Merge(inputs, out);
+                    }
+                    merged.push_back(run);
+                }
+                runs.swap(merged);
+            }
+            std::unique_ptr<PacBio::BAM::IRecordWriter> out(OpenOutput());
+            std::vector<std::string> inputs = runs;
+            Merge(inputs, *out);
+            runs.clear();
+        }
+    }
+
+    int NumRuns() const { return nRunsCreated; }
+
+private:
+    // Sort key of one record, in memory or at the head of a run.
+    class Key
+    {
+    public:
+        std::uint32_t referenceId;  // unmapped (-1) sorts last
+        std::int64_t position;
+        bool reverse;
+
+        Key(const PacBio::BAM::BamRecord &record)
+            : referenceId(static_cast<std::uint32_t>(record.Impl().ReferenceId()))
+            , position(record.Impl().Position())
+            , reverse(record.Impl().IsReverseStrand())
+        {
+        }
+
+        bool operator<(const Key &rhs) const
+        {
+            if (referenceId != rhs.referenceId) {
+                return referenceId < rhs.referenceId;
+            }
+            if (position != rhs.position) {
+                return position < rhs.position;
+            }
+            return reverse < rhs.reverse;
+        }
+    };
+
+    class RunHead
+    {
+    public:
+        Key key;
+        int run;
+
+        RunHead(const Key &keyP, int runP) : key(keyP), run(runP) {}
+
+        // Reversed, for a min-heap; runs are in write order, so the
+        // earlier run wins ties.
+        bool operator<(const RunHead &rhs) const
+        {
+            if (rhs.key < key) {
+                return true;
+            }
+            if (key < rhs.key) {
+                return false;
+            }
+            return run > rhs.run;
+        }
+    };
+
+    std::string fileName;
+    PacBio::BAM::BamHeader header;
+    bool sam;
+    bool pbi;
+    std::string tempDirectory;
+    std::uint64_t memoryBytes;
+    size_t nThreads;  // compressing the output
+    std::vector<PacBio::BAM::BamRecord> buffer;
+    std::uint64_t bufferBytes;
+    std::vector<std::string> runs;
+    int nRunsCreated;
+    bool closed;
+    std::vector<PacBio::BAM::BamRecord> spilling;  // written to runs.back() by 'spiller'
+    std::thread spiller;
+    std::exception_ptr spillError;
+
+    static std::uint64_t RecordBytes(const PacBio::BAM::BamRecord &record)
+    {
+        return RecordOverheadBytes + BytesPerBase * record.Impl().SequenceLength();
+    }
+
+    PacBio::BAM::IRecordWriter *OpenOutput() const
+    {
+        if (sam) {
+            return new PacBio::BAM::SamWriter(fileName, header);
+        }
+        return new IndexingBamWriter(fileName, header, pbi, true, nThreads);
+    }
+
+    std::string NextRunName()
+    {
+        std::ostringstream name;
+        name << (tempDirectory == "" ? "." : tempDirectory) << "/blasr." << getpid() << ".sort."
+             << nRunsCreated++ << ".bam";
+        return name.str();
+    }
+
+    static void SortRecords(std::vector<PacBio::BAM::BamRecord> &records)
+    {
+        std::stable_sort(records.begin(), records.end(),
+                         [](const PacBio::BAM::BamRecord &a, const PacBio::BAM::BamRecord &b) {
+                             return Key(a) < Key(b);
+                         });
+    }
+
+    void ReleaseBuffer()
+    {
+        std::vector<PacBio::BAM::BamRecord>().swap(buffer);
+        bufferBytes = 0;
+    }
+
+    //
+    // Hands the buffer to the background thread, once the previous run
+    // is written.  The run is named here, so runs stay in write order.
+    //
+    void Spill()
+    {
+        JoinSpill();
+        spilling.swap(buffer);
+        bufferBytes = 0;
+        runs.push_back(NextRunName());
+        spiller = std::thread(&SortingBamWriter::WriteRun, this, runs.back());
+    }
+
+    // Waits for the run being written, and passes on its error, if any.
+    void JoinSpill()
+    {
+        if (spiller.joinable()) {
+            spiller.join();
+        }
+        if (spillError) {
+            std::exception_ptr error = spillError;
+            spillError = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    void WriteRun(const std::string &run)
+    {
+        try {
+            SortRecords(spilling);
+            PacBio::BAM::BamWriter out(run, header, PacBio::BAM::BamWriter::FastCompression);
+            for (const PacBio::BAM::BamRecord &record : spilling) {
+                out.Write(record);
+            }
+        } catch (...) {
+            spillError = std::current_exception();
+        }
+        std::vector<PacBio::BAM::BamRecord>().swap(spilling);
+    }
+
+    // k-way merge of sorted runs into 'out'; the runs are removed.
+    void Merge(const std::vector<std::string> &inputs, PacBio::BAM::IRecordWriter &out)
+    {
+        std::vector<std::unique_ptr<PacBio::BAM::BamReader> > readers;
+        std::vector<PacBio::BAM::BamRecord> heads(inputs.size());
+        std::priority_queue<RunHead> queue;
+        for (size_t r = 0; r < inputs.size(); r++) {
+            readers.emplace_back(new PacBio::BAM::BamReader(inputs[r]));
+            if (readers[r]->GetNext(heads[r])) {
+                queue.push(RunHead(Key(heads[r]), r));
+            }
+        }
+        while (not queue.empty()) {
+            int r = queue.top().run;
+            queue.pop();
+            out.Write(heads[r]);
+            if (readers[r]->GetNext(heads[r])) {
+                queue.push(RunHead(Key(heads[r]), r));
+            }
+        }
+        readers.clear();
+        for (const std::string &input : inputs) {
+            std::remove(input.c_str());
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <LibBlasrConfig.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifdef USE_PBBAM
+#include <pbbam/BamHeader.h>
+#include <pbbam/BamRecord.h>
+#include <pbbam/BamWriter.h>
+#include <pbbam/IRecordWriter.h>
+#include <pbbam/SamWriter.h>
+#endif
+
+#include "CompressedOutput.h"
+#include "ContigPartition.h"
+
+//
+// Output split by reference for --splitByRef: one file per contig, or
+// per run of consecutive small contigs, named by inserting the contig
+// name (or 'group<n>') before the extension of --out, e.g. out.chr1.bam.
+// Contigs are grouped by ContigPartition into at most 'maxFiles' files,
+// so a contig of at least 1/maxFiles of the reference has a file of its
+// own unless that would take more files.  BAM and SAM output also has
+// an 'unmapped' file.  Names that are the same once sanitized for the
+// file system get a suffix '_2', '_3', ... to keep the files apart.
+// Every file has the full header, and the contigs in each file are
+// listed in 'out.split' as soon as the files are opened, so consumers
+// can start on them without a separate split pass.
+//
+// Like the other writers, output is written while holding
+// MappingSemaphore::Writer.  All files stay open until Close(), so a
+// run holds one descriptor per file, and three per file for compressed
+// SAM, which pbbam writes through a StreamPipe that has a copier thread
+// per file.  Compressed text and SAM files share one BgzfThreadPool of
+// 'nThreads' workers and a writer thread; pbbam's BAM writers cannot
+// share threads, so each BAM file gets its share of 'nThreads', and at
+// least one.  --splitMaxFiles bounds both.
+//
+class SplitByRefOutput
+{
+public:
+    SplitByRefOutput(const std::string &outFileNameP, const std::vector<std::string> &refNames,
+                     const std::vector<std::uint64_t> &refLengths, int maxFiles)
+        : outFileName(outFileNameP), unmappedGroup(-1)
+    {
+        std::vector<int> firsts = ContigPartition::Split(refLengths, maxFiles);
+        for (size_t g = 0; g + 1 < firsts.size(); g++) {
+            groups.emplace_back(new Group);
+            for (int r = firsts[g]; r < firsts[g + 1]; r++) {
+                groups.back()->refs.push_back(r);
+                groupOfRef.push_back(g);
+            }
+        }
+        std::set<std::string> fileNames;
+        unmappedFileName = UniqueFileName("unmapped", fileNames);
+        for (size_t g = 0; g < groups.size(); g++) {
+            std::vector<int> &refs = groups[g]->refs;
+            groups[g]->fileName = UniqueFileName(
+                refs.size() == 1 ? refNames[refs[0]] : "group" + std::to_string(g), fileNames);
+        }
+        WriteManifest(refNames);
+    }
+
+    ~SplitByRefOutput() { Close(); }
+
+    int NumGroups() const { return groups.size(); }
+
+    // The group of reference 'refIndex'; unplaced records go to 'unmapped'.
+    int GroupOf(int refIndex) const
+    {
+        if (refIndex >= 0 and refIndex < int(groupOfRef.size())) {
+            return groupOfRef[refIndex];
+        }
+        assert(unmappedGroup >= 0);
+        return unmappedGroup;
+    }
+
+    void OpenText(bool compress, int nThreads)
+    {
+        pool = std::make_shared<BgzfThreadPool>(nThreads);
+        for (auto &group : groups) {
+            group->text.reset(new TextOutputFile);
+            group->text->Open(group->fileName, compress, nThreads, pool);
+        }
+    }
+
+    std::ostream &Text(int group) { return *groups[group]->text; }
+
+#ifdef USE_PBBAM
+    // SAM is written through a pipe into a TextOutputFile when compressed.
+    void OpenRecords(const PacBio::BAM::BamHeader &header, bool sam, bool compress, int nThreads)
+    {
+        unmappedGroup = groups.size();
+        groups.emplace_back(new Group);
+        groups.back()->fileName = unmappedFileName;
+        pool = std::make_shared<BgzfThreadPool>(nThreads);
+        int bamThreads = std::max(1, nThreads / int(groups.size()));
+        for (auto &group : groups) {
+            if (not sam) {
+                group->records.reset(new PacBio::BAM::BamWriter(
+                    group->fileName, header, PacBio::BAM::BamWriter::DefaultCompression,
+                    bamThreads));
+            } else if (compress) {
+                group->text.reset(new TextOutputFile);
+                group->text->Open(group->fileName, true, nThreads, pool);
+                group->pipe.reset(new StreamPipe(*group->text));
+                group->records.reset(new PacBio::BAM::SamWriter(group->pipe->Path(), header));
+            } else {
+                group->records.reset(new PacBio::BAM::SamWriter(group->fileName, header));
+            }
+        }
+    }
+
+    PacBio::BAM::IRecordWriter &Records(int group) { return *groups[group]->records; }
+#endif
+
+    void Close()
+    {
+        for (auto &group : groups) {
+#ifdef USE_PBBAM
+            group->records.reset();
+#endif
+            if (group->pipe) {
+                group->pipe->Close();
+            }
+            if (group->text and group->text->IsOpen()) {
+                group->text->Close();
+            }
+        }
+    }
+
+    //
+    // 'out.bam' with label 'chr1' becomes 'out.chr1.bam', and 'out.m4.gz'
+    // becomes 'out.chr1.m4.gz'.  Characters that do not belong in file
+    // names are replaced by '_'.
+    //
+    static std::string SplitFileName(const std::string &fileName, const std::string &label)
+    {
+        std::string suffix;
+        std::string stem = fileName;
+        if (BgzfStreambuf::IsCompressedName(stem)) {
+            size_t dot = stem.rfind('.');
+            suffix = stem.substr(dot);
+            stem.erase(dot);
+        }
+        size_t dot = stem.rfind('.');
+        size_t slash = stem.rfind('/');
+        if (dot != std::string::npos and (slash == std::string::npos or dot > slash)) {
+            suffix = stem.substr(dot) + suffix;
+            stem.erase(dot);
+        }
+        std::string safeLabel = label;
+        for (char &c : safeLabel) {
+            if (not(std::isalnum(static_cast<unsigned char>(c)) or c == '.' or c == '-' or
+                    c == '_')) {
+                c = '_';
+            }
+        }
+        return stem + "." + safeLabel + suffix;
+    }
+
+private:
+    class Group
+    {
+    public:
+        std::string fileName;
+        std::vector<int> refs;
+        std::unique_ptr<TextOutputFile> text;
+        std::unique_ptr<StreamPipe> pipe;
+#ifdef USE_PBBAM
+        std::unique_ptr<PacBio::BAM::IRecordWriter> records;
+#endif
+    };
+
+    std::string outFileName;
+    std::string unmappedFileName;
+    std::vector<std::unique_ptr<Group> > groups;
+    std::vector<int> groupOfRef;
+    int unmappedGroup;
+    std::shared_ptr<BgzfThreadPool> pool;  // compresses the text and SAM files
+
+    // The file name for 'label', made unique among 'fileNames'.
+    std::string UniqueFileName(const std::string &label, std::set<std::string> &fileNames) const
+    {
+        std::string fileName = SplitFileName(outFileName, label);
+        for (int n = 2; fileNames.count(fileName) > 0; n++) {
+            fileName = SplitFileName(outFileName, label + "_" + std::to_string(n));
+        }
+        fileNames.insert(fileName);
+        return fileName;
+    }
+
+    void WriteManifest(const std::vector<std::string> &refNames)
+    {
+        std::ofstream manifest((outFileName + ".split").c_str());
+        for (const auto &group : groups) {
+            for (int r : group->refs) {
+                manifest << group->fileName << "\t" << refNames[r] << "\n";
+            }
+        }
+    }
+};
+
+#ifdef USE_PBBAM
+// Routes each record to the file of its reference.
+class SplitByRefRecordWriter : public PacBio::BAM::IRecordWriter
+{
+public:
+    SplitByRefRecordWriter(SplitByRefOutput &outputP) : output(outputP) {}
+
+    void Write(const PacBio::BAM::BamRecord &record) override
+    {
+        output.Records(output.GroupOf(record.Impl().ReferenceId())).Write(record);
+    }
+
+    void Write(const PacBio::BAM::BamRecordImpl &recordImpl) override
+    {
+        Write(PacBio::BAM::BamRecord(recordImpl));
+    }
+
+    void TryFlush() override
+    {
+        for (int g = 0; g < output.NumGroups(); g++) {
+            output.Records(g).TryFlush();
+        }
+    }
+
+private:
+    SplitByRefOutput &output;
+};
+#endif
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <pbdata/utils/TimeUtils.hpp>
+
+#include "ProcessMemory.h"
+
+//
+// Wall time, bytes read and resident memory of each phase of startup,
+// from entering main() until the first read is mapped.  Bytes read is
+// 'rchar' from /proc/self/io, so it counts reads served from the page
+// cache too; both it and resident memory are 0 where /proc is not
+// available.
+//
+class StartupReport
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    class Phase
+    {
+    public:
+        std::string name;
+        std::uint64_t nanoseconds;
+        std::uint64_t bytesRead;
+        std::uint64_t residentBytes;  // at the end of the phase
+    };
+
+    std::vector<Phase> phases;
+
+    StartupReport() : phaseStart(Clock::now()), phaseBytesRead(BytesRead()) {}
+
+    //
+    // End the phase that started at the previous EndPhase(), or at
+    // construction, and call it 'name'.
+    //
+    void EndPhase(const std::string &name)
+    {
+        Clock::time_point now = Clock::now();
+        std::uint64_t bytesRead = BytesRead();
+        Phase p;
+        p.name = name;
+        p.nanoseconds =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - phaseStart).count();
+        p.bytesRead = bytesRead - phaseBytesRead;
+        p.residentBytes = ProcessMemory::ResidentBytes();
+        phases.push_back(p);
+        phaseStart = now;
+        phaseBytesRead = bytesRead;
+    }
+
+    Phase Total() const
+    {
+        Phase total;
+        total.name = "total";
+        total.nanoseconds = total.bytesRead = total.residentBytes = 0;
+        for (const Phase &p : phases) {
+            total.nanoseconds += p.nanoseconds;
+            total.bytesRead += p.bytesRead;
+            total.residentBytes = p.residentBytes;
+        }
+        return total;
+    }
+
+    // One [INFO] line per phase, and one for the total.
+    void PrintLog(std::ostream &out) const
+    {
+        for (const Phase &p : phases) {
+            out << "[INFO] " << GetTimestamp() << " [blasr] startup " << FormatPhase(p)
+                << std::endl;
+        }
+        out << "[INFO] " << GetTimestamp() << " [blasr] startup " << FormatPhase(Total())
+            << std::endl;
+    }
+
+    // A tab separated table, in the same units as PrintLog().
+    void PrintTable(std::ostream &out) const
+    {
+        out << "startup_phase\twall_s\tread_mb\trss_mb" << std::endl;
+        for (const Phase &p : phases) {
+            PrintRow(out, p);
+        }
+        PrintRow(out, Total());
+    }
+
+    static std::uint64_t BytesRead()
+    {
+        std::ifstream io("/proc/self/io");
+        std::string key;
+        std::uint64_t value;
+        while (io >> key >> value) {
+            if (key == "rchar:") {
+                return value;
+            }
+        }
+        return 0;
+    }
+
+private:
+    Clock::time_point phaseStart;
+    std::uint64_t phaseBytesRead;
+
+    static std::string FormatPhase(const Phase &p)
+    {
+        std::ostringstream s;
+        s << std::fixed << std::setprecision(3) << p.name << ": " << p.nanoseconds * 1e-9 << " s, "
+          << std::setprecision(1) << p.bytesRead / 1048576.0 << " MB read, "
+          << p.residentBytes / 1048576.0 << " MB resident";
+        return s.str();
+    }
+
+    static void PrintRow(std::ostream &out, const Phase &p)
+    {
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << std::fixed << std::setprecision(3) << p.name << "\t" << p.nanoseconds * 1e-9 << "\t"
+            << p.bytesRead / 1048576.0 << "\t" << p.residentBytes / 1048576.0 << std::endl;
+        out.flags(flags);
+        out.precision(precision);
+    }
+};
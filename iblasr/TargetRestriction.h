@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ContigIndex.h"
+
+//
+// The targets of --restrictTo: a list of contig names, one per line,
+// or BED lines 'name start end' with 0-based, half open positions.
+// Both may be mixed; a contig listed by name is targeted as a whole.
+//
+// Whether a contig is targeted at all is a bitmap over the contig
+// indices of the reference, so anchors on other contigs are dropped
+// with one lookup before they are chained.  BED regions of a contig
+// are merged and sorted, and an anchor is kept if it overlaps one.
+//
+class TargetRestriction
+{
+public:
+    bool IsEmpty() const { return targeted.empty(); }
+
+    void Read(const std::string &fileName, const ContigIndex &contigIndex)
+    {
+        std::ifstream in(fileName.c_str());
+        if (not in) {
+            std::cout << "ERROR, could not open --restrictTo file " << fileName << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        std::unordered_map<std::string, int> contigOfName;
+        for (int c = contigIndex.NumContigs() - 1; c >= 0; c--) {
+            contigOfName[contigIndex.Name(c)] = c;
+        }
+        targeted.assign(contigIndex.NumContigs(), false);
+        wholeContig.assign(contigIndex.NumContigs(), false);
+        regions.assign(contigIndex.NumContigs(), std::vector<Region>());
+
+        std::string line;
+        int lineNumber = 0, nTargets = 0;
+        while (std::getline(in, line)) {
+            ++lineNumber;
+            std::istringstream fields(line);
+            std::string name;
+            if (not(fields >> name) or name[0] == '#' or name == "track" or name == "browser") {
+                continue;
+            }
+            auto it = contigOfName.find(name);
+            int c = it == contigOfName.end() ? contigIndex.IndexOfName(name) : it->second;
+            if (c < 0) {
+                std::cout << "ERROR, " << fileName << ":" << lineNumber << ": " << name
+                          << " is not a contig of the reference." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            targeted[c] = true;
+            nTargets++;
+            long long start, end;
+            if (not(fields >> start) and fields.eof()) {
+                wholeContig[c] = true;
+            } else if (not fields.fail() and fields >> end and 0 <= start and start < end) {
+                regions[c].push_back(Region(start, end));
+            } else {
+                std::cout << "ERROR, " << fileName << ":" << lineNumber
+                          << ": expected a contig name, or 'name start end'." << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        // Otherwise every read would silently be unmapped.
+        if (nTargets == 0) {
+            std::cout << "ERROR, " << fileName << " lists no contigs or regions." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        for (size_t c = 0; c < regions.size(); c++) {
+            if (wholeContig[c]) {
+                regions[c].clear();
+            }
+            MergeRegions(regions[c]);
+        }
+    }
+
+    // Whether [begin, end) of contig 'contig' overlaps a target.
+    bool OnTarget(int contig, DNALength begin, DNALength end) const
+    {
+        if (not targeted[contig]) {
+            return false;
+        }
+        if (wholeContig[contig]) {
+            return true;
+        }
+        const std::vector<Region> &contigRegions = regions[contig];
+        auto it = std::upper_bound(contigRegions.begin(), contigRegions.end(), begin,
+                                   [](DNALength pos, const Region &r) { return pos < r.end; });
+        return it != contigRegions.end() and it->begin < end;
+    }
+
+    //
+    // Drops the anchors that miss every target.  Anchor positions are
+    // in the index of 'seqdb', whose first contig is 'firstContig' of
+    // the reference; that is not 0 for a shard of the suffix array.
+    //
+    template <typename T_MatchPos, typename T_SequenceDB>
+    void FilterAnchors(std::vector<T_MatchPos> &matches, T_SequenceDB &seqdb,
+                       const ContigIndex &contigIndex, int firstContig) const
+    {
+        size_t nKept = 0;
+        for (size_t m = 0; m < matches.size(); m++) {
+            int contig = contigIndex.Find(matches[m].t);
+            DNALength pos = matches[m].t - seqdb.seqStartPos[contig];
+            if (OnTarget(contig + firstContig, pos, pos + matches[m].l)) {
+                if (nKept != m) {
+                    matches[nKept] = matches[m];
+                }
+                nKept++;
+            }
+        }
+        matches.erase(matches.begin() + nKept, matches.end());
+    }
+
+private:
+    class Region
+    {
+    public:
+        DNALength begin;
+        DNALength end;
+        Region(DNALength beginP, DNALength endP) : begin(beginP), end(endP) {}
+    };
+
+    std::vector<bool> targeted;
+    std::vector<bool> wholeContig;
+    std::vector<std::vector<Region> > regions;
+
+    static void MergeRegions(std::vector<Region> &contigRegions)
+    {
+        std::sort(contigRegions.begin(), contigRegions.end(),
+                  [](const Region &a, const Region &b) { return a.begin < b.begin; });
+        size_t nMerged = 0;
+        for (size_t r = 0; r < contigRegions.size(); r++) {
+            if (nMerged > 0 and contigRegions[r].begin <= contigRegions[nMerged - 1].end) {
+                contigRegions[nMerged - 1].end =
+                    std::max(contigRegions[nMerged - 1].end, contigRegions[r].end);
+            } else {
+                contigRegions[nMerged++] = contigRegions[r];
+            }
+        }
+        contigRegions.erase(contigRegions.begin() + nMerged, contigRegions.end());
+    }
+};
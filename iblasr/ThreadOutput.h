@@ -0,0 +1,381 @@
+#pragma once
+
+#include <LibBlasrConfig.h>
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef USE_PBBAM
+#include <pbbam/BamHeader.h>
+#include <pbbam/BamReader.h>
+#include <pbbam/BamRecord.h>
+#include <pbbam/BamWriter.h>
+#include <pbbam/IRecordWriter.h>
+#include <pbbam/SamWriter.h>
+#endif
+
+#include <pbdata/utils.hpp>
+
+#ifdef USE_PBBAM
+//
+// The SAM or BAM file of one mapping thread.  Counts the records
+// written, and remembers the virtual offset of the first BAM record so
+// that the file can later be appended to another without decompressing
+// it.
+//
+class ThreadRecordWriter : public PacBio::BAM::IRecordWriter
+{
+public:
+    std::uint64_t nRecords;
+    std::int64_t firstRecordOffset;  // -1 until a BAM record is written
+
+    ThreadRecordWriter(const std::string &fileName, const PacBio::BAM::BamHeader &header, bool sam)
+        : nRecords(0), firstRecordOffset(-1)
+    {
+        if (sam) {
+            samWriter.reset(new PacBio::BAM::SamWriter(fileName, header));
+        } else {
+            // Each mapping thread compresses its own output.
+            bamWriter.reset(new PacBio::BAM::BamWriter(
+                fileName, header, PacBio::BAM::BamWriter::DefaultCompression, 1));
+        }
+    }
+
+    void Write(const PacBio::BAM::BamRecord &record) override
+    {
+        if (samWriter) {
+            samWriter->Write(record);
+        } else {
+            std::int64_t vOffset;
+            bamWriter->Write(record, &vOffset);
+            if (firstRecordOffset < 0) {
+                firstRecordOffset = vOffset;
+            }
+        }
+        nRecords++;
+    }
+
+    void Write(const PacBio::BAM::BamRecordImpl &recordImpl) override
+    {
+        Write(PacBio::BAM::BamRecord(recordImpl));
+    }
+
+    void TryFlush() override
+    {
+        if (bamWriter) {
+            bamWriter->TryFlush();
+        }
+    }
+
+    void Close()
+    {
+        samWriter.reset();
+        bamWriter.reset();
+    }
+
+private:
+    std::unique_ptr<PacBio::BAM::SamWriter> samWriter;
+    std::unique_ptr<PacBio::BAM::BamWriter> bamWriter;
+};
+#endif
+
+//
+// Output of one mapping thread for --outputByThread, written to
+// 'outFileName.<thread>' without taking the writer semaphore, and
+// merged into 'outFileName' by Merge() once all threads are done.
+//
+// By default the files are simply concatenated: text files byte for
+// byte, SAM files without their repeated headers, and BAM files block
+// for block, without recompression.  To restore the order of ZMWs in
+// the input, each thread records how much output each of its ZMWs
+// produced, in bytes for text and in records for SAM and BAM, and the
+// merge interleaves the files by input index; BAM records are then
+// decoded and recompressed.
+//
+class ThreadOutput
+{
+public:
+    enum Format
+    {
+        Text,
+        SAM,
+        BAM
+    };
+
+    std::string fileName;
+    std::ofstream text;
+#ifdef USE_PBBAM
+    std::unique_ptr<ThreadRecordWriter> records;
+#endif
+
+    ThreadOutput(const std::string &fileNameP, Format formatP, bool keepZmwOrderP)
+        : fileName(fileNameP), format(formatP), keepZmwOrder(keepZmwOrderP), lastEnd(0)
+    {
+    }
+
+    void OpenText() { CrucialOpen(fileName, text, std::ios::out | std::ios::binary); }
+
+#ifdef USE_PBBAM
+    void OpenRecords(const PacBio::BAM::BamHeader &header)
+    {
+        records.reset(new ThreadRecordWriter(fileName, header, format == SAM));
+    }
+#endif
+
+    //
+    // Called after the alignments of a ZMW have been written;
+    // 'readIndex' is the index of the ZMW in the input.
+    //
+    void EndZmw(std::uint64_t readIndex)
+    {
+        if (not keepZmwOrder) {
+            return;
+        }
+        std::uint64_t end = Written();
+        if (end > lastEnd) {
+            zmws.push_back(Zmw(readIndex, end - lastEnd));
+            lastEnd = end;
+        }
+    }
+
+    void Close()
+    {
+        if (text.is_open()) {
+            text.close();
+        }
+#ifdef USE_PBBAM
+        if (records) {
+            records->Close();
+        }
+#endif
+    }
+
+    //
+    // Merge the (closed) thread outputs.  Text and SAM are written to
+    // 'textOut', which may already hold a header and may compress;
+    // BAM is written to 'outFileName'.  The thread files are removed.
+    //
+    static void Merge(std::vector<std::unique_ptr<ThreadOutput> > &threads, std::ostream &textOut,
+                      const std::string &outFileName)
+    {
+        if (threads.empty()) {
+            return;
+        }
+        Format format = threads[0]->format;
+        bool ordered = threads[0]->keepZmwOrder;
+        if (format == Text) {
+            MergeText(threads, textOut, ordered);
+        }
+#ifdef USE_PBBAM
+        else if (format == SAM) {
+            MergeSam(threads, textOut, ordered);
+        } else if (ordered or not BlocksAreAligned(threads)) {
+            MergeBamRecords(threads, outFileName, ordered);
+        } else {
+            MergeBamBlocks(threads, outFileName);
+        }
+#else
+        (void)outFileName;
+#endif
+        for (const auto &t : threads) {
+            std::remove(t->fileName.c_str());
+        }
+    }
+
+private:
+    class Zmw
+    {
+    public:
+        std::uint64_t readIndex;
+        std::uint64_t size;  // bytes or records
+
+        Zmw(std::uint64_t readIndexP, std::uint64_t sizeP) : readIndex(readIndexP), size(sizeP) {}
+    };
+
+    // Size of the empty block that ends every BGZF file.
+    static const int BgzfEofBytes = 28;
+
+    Format format;
+    bool keepZmwOrder;
+    std::uint64_t lastEnd;
+    std::vector<Zmw> zmws;
+
+    std::uint64_t Written()
+    {
+#ifdef USE_PBBAM
+        if (records) {
+            return records->nRecords;
+        }
+#endif
+        return text.tellp();
+    }
+
+    //
+    // Call copy(thread, size) for the output of every ZMW in input
+    // order.  Each thread took ZMWs from the reader in increasing
+    // order, so this is a merge of already sorted lists.
+    //
+    template <typename T_Copy>
+    static void ForEachZmwInOrder(const std::vector<std::unique_ptr<ThreadOutput> > &threads,
+                                  T_Copy copy)
+    {
+        std::vector<size_t> next(threads.size(), 0);
+        while (true) {
+            int best = -1;
+            for (size_t t = 0; t < threads.size(); t++) {
+                if (next[t] < threads[t]->zmws.size() and
+                    (best < 0 or
+                     threads[t]->zmws[next[t]].readIndex <
+                         threads[best]->zmws[next[best]].readIndex)) {
+                    best = t;
+                }
+            }
+            if (best < 0) {
+                return;
+            }
+            copy(best, threads[best]->zmws[next[best]].size);
+            next[best]++;
+        }
+    }
+
+    static void CopyBytes(std::istream &in, std::ostream &out, std::uint64_t nBytes)
+    {
+        char buffer[65536];
+        while (nBytes > 0 and in) {
+            std::streamsize n = std::min<std::uint64_t>(nBytes, sizeof(buffer));
+            in.read(buffer, n);
+            out.write(buffer, in.gcount());
+            nBytes -= in.gcount();
+        }
+    }
+
+    static std::uint64_t FileSize(const std::string &fileName)
+    {
+        struct stat st;
+        return stat(fileName.c_str(), &st) == 0 ? st.st_size : 0;
+    }
+
+    static void MergeText(std::vector<std::unique_ptr<ThreadOutput> > &threads, std::ostream &out,
+                          bool ordered)
+    {
+        std::vector<std::unique_ptr<std::ifstream> > in;
+        for (const auto &t : threads) {
+            in.emplace_back(new std::ifstream(t->fileName.c_str(), std::ios::binary));
+        }
+        if (ordered) {
+            ForEachZmwInOrder(threads,
+                              [&](int t, std::uint64_t size) { CopyBytes(*in[t], out, size); });
+        } else {
+            for (size_t t = 0; t < threads.size(); t++) {
+                if (FileSize(threads[t]->fileName) > 0) {
+                    out << in[t]->rdbuf();
+                }
+            }
+        }
+    }
+
+#ifdef USE_PBBAM
+    // Copy the header of the first SAM file, then each file's records.
+    static void MergeSam(std::vector<std::unique_ptr<ThreadOutput> > &threads, std::ostream &out,
+                         bool ordered)
+    {
+        std::vector<std::unique_ptr<std::ifstream> > in;
+        std::string line;
+        for (size_t t = 0; t < threads.size(); t++) {
+            in.emplace_back(new std::ifstream(threads[t]->fileName.c_str()));
+            while (in[t]->peek() == '@' and std::getline(*in[t], line)) {
+                if (t == 0) {
+                    out << line << '\n';
+                }
+            }
+        }
+        if (ordered) {
+            ForEachZmwInOrder(threads, [&](int t, std::uint64_t size) {
+                for (std::uint64_t r = 0; r < size and std::getline(*in[t], line); r++) {
+                    out << line << '\n';
+                }
+            });
+        } else {
+            for (size_t t = 0; t < threads.size(); t++) {
+                if (in[t]->peek() != EOF) {
+                    out << in[t]->rdbuf();
+                }
+            }
+        }
+    }
+
+    //
+    // The header of a BAM file is flushed to its own BGZF blocks, so
+    // a thread's records can be appended block for block as long as its
+    // first record starts a block.
+    //
+    static bool BlocksAreAligned(const std::vector<std::unique_ptr<ThreadOutput> > &threads)
+    {
+        for (const auto &t : threads) {
+            if (t->records->firstRecordOffset > 0 and
+                (t->records->firstRecordOffset & 0xFFFF) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void MergeBamBlocks(std::vector<std::unique_ptr<ThreadOutput> > &threads,
+                               const std::string &outFileName)
+    {
+        std::ofstream out;
+        CrucialOpen(outFileName, out, std::ios::out | std::ios::binary);
+        for (size_t t = 0; t < threads.size(); t++) {
+            std::uint64_t size = FileSize(threads[t]->fileName);
+            std::uint64_t begin = 0;
+            if (t > 0) {
+                if (threads[t]->records->firstRecordOffset < 0) {
+                    continue;
+                }
+                begin = threads[t]->records->firstRecordOffset >> 16;
+            }
+            if (size < begin + BgzfEofBytes) {
+                continue;
+            }
+            std::ifstream in(threads[t]->fileName.c_str(), std::ios::binary);
+            in.seekg(begin);
+            CopyBytes(in, out, size - BgzfEofBytes - begin);
+        }
+        // Every file ends with the same empty block.
+        std::ifstream in(threads[0]->fileName.c_str(), std::ios::binary);
+        in.seekg(FileSize(threads[0]->fileName) - BgzfEofBytes);
+        CopyBytes(in, out, BgzfEofBytes);
+    }
+
+    static void MergeBamRecords(std::vector<std::unique_ptr<ThreadOutput> > &threads,
+                                const std::string &outFileName, bool ordered)
+    {
+        std::vector<std::unique_ptr<PacBio::BAM::BamReader> > in;
+        for (const auto &t : threads) {
+            in.emplace_back(new PacBio::BAM::BamReader(t->fileName));
+        }
+        PacBio::BAM::BamWriter out(outFileName, in[0]->Header());
+        PacBio::BAM::BamRecord record;
+        if (ordered) {
+            ForEachZmwInOrder(threads, [&](int t, std::uint64_t size) {
+                for (std::uint64_t r = 0; r < size and in[t]->GetNext(record); r++) {
+                    out.Write(record);
+                }
+            });
+        } else {
+            for (auto &reader : in) {
+                while (reader->GetNext(record)) {
+                    out.Write(record);
+                }
+            }
+        }
+    }
+#endif
+};
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <fstream>
 #include <string>
 #include <vector>
 
@@ -6,15 +8,20 @@
 #include <alignment/algorithms/sorting/qsufsort.hpp>
 #include <alignment/suffixarray/SuffixArray.hpp>
 #include <alignment/suffixarray/ssort.hpp>
+#include <alignment/tuples/DNATuple.hpp>
+#include <alignment/tuples/TupleCountTable.hpp>
 #include <pbdata/CompressedSequence.hpp>
 #include <pbdata/FASTAReader.hpp>
 #include <pbdata/FASTASequence.hpp>
 #include <pbdata/NucConversion.hpp>
+#include <pbdata/metagenome/SequenceIndexDatabase.hpp>
+
+#include "../iblasr/ReferenceShards.h"
 
 void PrintUsage()
 {
     std::cout << "usage: sawriter saOut fastaIn [fastaIn2 fastaIn3 ...] [-blt p] [-larsson] "
-                 "[-4bit] [-manmy] [-kar]"
+                 "[-4bit] [-manmy] [-kar] [-shards n]"
               << std::endl;
     std::cout << "   or  sawriter fastaIn  (writes to fastIn.sa)." << std::endl;
     std::cout << "       -blt p      Build a lookup table on prefixes of length 'p'. This speeds "
@@ -49,10 +56,95 @@ void PrintUsage()
         << "                   normal larsson." << std::endl
         << "       -welterweight N use a difference cover of size N for building the suffix array. "
            " Valid values are 7,32,64,111, and 2281."
+        << std::endl
+        << "       -shards n   Split the contigs of (one) fasta file into at most n runs of about"
+        << std::endl
+        << "                   the same length, and build a suffix array and a count table for"
+        << std::endl
+        << "                   each, written to saOut.0, saOut.0.ctab, saOut.1, ...  They are"
+        << std::endl
+        << "                   listed in saOut.shards, which is given to blasr as -sa."
         << std::endl;
 }
 
-int main(int argc, char* argv[])
+//
+// Builds the suffix array, and the lookup table if 'bltPrefixLength' is
+// not 0, of the three bit sequence 'seq'.
+//
+template <typename T_Sequence>
+void BuildSuffixArray(SuffixArray<Nucleotide, std::vector<int> > &sa, T_Sequence &seq,
+                      SAType saBuildType, int diffCoverSize, int bltPrefixLength)
+{
+    std::vector<int> alphabet;
+
+    //  sa.InitTwoBitDNAAlphabet(alphabet);
+    //  sa.InitAsciiCharDNAAlphabet(alphabet);
+    sa.InitThreeBitDNAAlphabet(alphabet);
+
+    if (saBuildType == manmy) {
+        sa.MMBuildSuffixArray(seq.seq, seq.length, alphabet);
+    } else if (saBuildType == mcilroy) {
+        sa.index = new SAIndex[seq.length + 1];
+        DNALength i;
+        for (i = 0; i < seq.length; i++) {
+            sa.index[i] = seq.seq[i] + 1;
+        }
+        sa.index[seq.length] = 0;
+        ssort(sa.index, NULL);
+        for (i = 1; i < seq.length + 1; i++) {
+            sa.index[i - 1] = sa.index[i];
+        };
+        sa.length = seq.length;
+    } else if (saBuildType == larsson) {
+        sa.LarssonBuildSuffixArray(seq.seq, seq.length, alphabet);
+    } else if (saBuildType == kark) {
+        sa.index = new SAIndex[seq.length];
+        seq.ToThreeBit();
+        DNALength p;
+        for (p = 0; p < seq.length; p++) {
+            seq.seq[p]++;
+        }
+        KarkkainenBuildSuffixArray<Nucleotide>(seq.seq, sa.index, seq.length, 5);
+        sa.length = seq.length;
+    } else if (saBuildType == mafe) {
+        //    sa.MaFeBuildSuffixArray(seq.seq, seq.length);
+
+    } else if (saBuildType == welter) {
+        if (diffCoverSize == 0) {
+            sa.LightweightBuildSuffixArray(seq.seq, seq.length);
+        } else {
+            sa.LightweightBuildSuffixArray(seq.seq, seq.length, diffCoverSize);
+        }
+    }
+    if (bltPrefixLength > 0) {
+        sa.BuildLookupTable(seq.seq, seq.length, bltPrefixLength);
+    }
+}
+
+//
+// Writes the tuple counts of the three bit sequence 'seq', a shard of
+// the reference, for blasr to add up into those of the reference.
+//
+void WriteCountTable(const std::string &fileName, FASTASequence &seq)
+{
+    FASTASequence asciiSeq;
+    asciiSeq.Copy(seq);
+    asciiSeq.ConvertThreeBitToAscii();
+    TupleMetrics tm;
+    tm.Initialize(ReferenceShards::CountTableTupleSize);
+    TupleCountTable<FASTASequence, DNATuple> ct;
+    ct.InitCountTable(tm);
+    ct.AddSequenceTupleCountsLR(asciiSeq);
+    asciiSeq.Free();
+    std::ofstream ctOut(fileName.c_str(), std::ios::out | std::ios::binary);
+    ct.Write(ctOut);
+    if (not ctOut) {
+        std::cout << "ERROR, could not write " << fileName << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[])
 {
 
     if (argc < 2) {
@@ -73,6 +165,7 @@ int main(int argc, char* argv[])
     SAType saBuildType = larsson;
     int read4BitCompressed = 0;
     int diffCoverSize = 0;
+    int nShards = 0;
     while (argi < argc) {
         if (strlen(argv[argi]) > 0 and argv[argi][0] == '-') {
             parsingOptions = 1;
@@ -126,6 +219,14 @@ int main(int argc, char* argv[])
                 }
             } else if (strcmp(argv[argi], "-4bit") == 0) {
                 read4BitCompressed = 1;
+            } else if (strcmp(argv[argi], "-shards") == 0) {
+                if (argi < argc - 1) {
+                    nShards = atoi(argv[++argi]);
+                }
+                if (nShards <= 0) {
+                    std::cout << "Please specify a positive number of shards." << std::endl;
+                    std::exit(EXIT_FAILURE);
+                }
             } else if (strcmp(argv[argi], "-h") == 0 or strcmp(argv[argi], "-help") == 0 or
                        strcmp(argv[argi], "--help") == 0) {
                 PrintUsage();
@@ -146,9 +247,14 @@ int main(int argc, char* argv[])
         inFiles.push_back(saFile);
         saFile = saFile + ".sa";
     }
+    if (nShards > 0 and (inFiles.size() != 1 or read4BitCompressed)) {
+        std::cout << "ERROR, -shards requires a single fasta file." << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
 
     VectorIndex inFileIndex;
     FASTASequence seq;
+    SequenceIndexDatabase<FASTASequence> seqdb;
     CompressedSequence<FASTASequence> compSeq;
 
     if (read4BitCompressed == 0) {
@@ -165,7 +271,7 @@ int main(int argc, char* argv[])
             }
 
             if (inFileIndex == 0) {
-                reader.ReadAllSequencesIntoOne(seq);
+                reader.ReadAllSequencesIntoOne(seq, &seqdb);
                 reader.Close();
             } else {
                 while (reader.ConcatenateNext(seq)) {
@@ -196,51 +302,32 @@ int main(int argc, char* argv[])
         std::cout << "against each file, and merging the result." << std::endl;
         std::exit(EXIT_FAILURE);
     }
-    std::vector<int> alphabet;
-
-    SuffixArray<Nucleotide, std::vector<int> > sa;
-    //  sa.InitTwoBitDNAAlphabet(alphabet);
-    //  sa.InitAsciiCharDNAAlphabet(alphabet);
-    sa.InitThreeBitDNAAlphabet(alphabet);
-
-    if (saBuildType == manmy) {
-        sa.MMBuildSuffixArray(seq.seq, seq.length, alphabet);
-    } else if (saBuildType == mcilroy) {
-        sa.index = new SAIndex[seq.length + 1];
-        DNALength i;
-        for (i = 0; i < seq.length; i++) {
-            sa.index[i] = seq.seq[i] + 1;
-        }
-        sa.index[seq.length] = 0;
-        ssort(sa.index, NULL);
-        for (i = 1; i < seq.length + 1; i++) {
-            sa.index[i - 1] = sa.index[i];
-        };
-        sa.length = seq.length;
-    } else if (saBuildType == larsson) {
-        sa.LarssonBuildSuffixArray(seq.seq, seq.length, alphabet);
-    } else if (saBuildType == kark) {
-        sa.index = new SAIndex[seq.length];
-        seq.ToThreeBit();
-        DNALength p;
-        for (p = 0; p < seq.length; p++) {
-            seq.seq[p]++;
-        }
-        KarkkainenBuildSuffixArray<Nucleotide>(seq.seq, sa.index, seq.length, 5);
-        sa.length = seq.length;
-    } else if (saBuildType == mafe) {
-        //    sa.MaFeBuildSuffixArray(seq.seq, seq.length);
-
-    } else if (saBuildType == welter) {
-        if (diffCoverSize == 0) {
-            sa.LightweightBuildSuffixArray(seq.seq, seq.length);
-        } else {
-            sa.LightweightBuildSuffixArray(seq.seq, seq.length, diffCoverSize);
+    if (nShards > 0) {
+        //
+        // Each shard is built over its part of the concatenated
+        // reference, so its positions are relative to its first contig.
+        //
+        std::vector<DNALength> starts(seqdb.seqStartPos, seqdb.seqStartPos + seqdb.nSeqPos);
+        std::vector<int> firsts = ReferenceShards::Partition(starts, nShards);
+        for (size_t s = 0; s + 1 < firsts.size(); s++) {
+            FASTASequence shardSeq;
+            shardSeq.ShallowCopy(seq);
+            shardSeq.deleteOnExit = false;
+            shardSeq.seq = seq.seq + starts[firsts[s]];
+            shardSeq.length =
+                std::min<DNALength>(starts[firsts[s + 1]], seq.length) - starts[firsts[s]];
+            std::string shardFile = ReferenceShards::ShardFileName(saFile, s);
+            WriteCountTable(ReferenceShards::CountTableFileName(shardFile), shardSeq);
+            SuffixArray<Nucleotide, std::vector<int> > sa;
+            BuildSuffixArray(sa, shardSeq, saBuildType, diffCoverSize, doBLT ? bltPrefixLength : 0);
+            sa.Write(shardFile);
         }
+        ReferenceShards::WriteManifest(saFile, firsts, seq.length);
+        return 0;
     }
-    if (doBLT) {
-        sa.BuildLookupTable(seq.seq, seq.length, bltPrefixLength);
-    }
+
+    SuffixArray<Nucleotide, std::vector<int> > sa;
+    BuildSuffixArray(sa, seq, saBuildType, diffCoverSize, doBLT ? bltPrefixLength : 0);
     sa.Write(saFile);
 
     return 0;
@@ -28,3 +28,15 @@ Make OUTDIR
 
   $ md5sum $OUTDIR/ecoli_welter.sa |cut -f 1 -d ' '
   e23b6afe6ddd74b2656e36bf93f6840c
+
+A single shard is the suffix array of the whole reference.
+  $ $EXEC $OUTDIR/ecoli_shards.sa $DATDIR/ecoli_reference.fasta -blt 11 -shards 1
+  $ echo $?
+  0
+
+  $ md5sum $OUTDIR/ecoli_shards.sa.0 |cut -f 1 -d ' '
+  e23b6afe6ddd74b2656e36bf93f6840c
+
+Each shard has the tuple count table of its contigs.
+  $ test -s $OUTDIR/ecoli_shards.sa.0.ctab && echo $?
+  0